@@ -0,0 +1,431 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "append_buffer.h"
+#include "pound.h"
+#include "row.h"
+
+//Each benchmark is repeated until it has run for at least this long
+#define BENCH_MIN_NS (300 * 1000000LL)
+
+/*
+ * Synthetic file which the benchmarks are run over. It is written to a temporary
+ * .c file, so opening it selects the C highlighting.
+ */
+struct Corpus {
+    const char *name;
+    char path[64];
+    size_t size;
+    char **lines;
+    size_t *lens;
+    int count;
+    //Rows built from the lines, for the benchmarks of the row functions
+    struct EditorRow *rows;
+    struct EditorRowRender *rrows;
+};
+
+/*
+ * A row as the row table held it before it was split into separate arrays: one 48-byte
+ * record mixing the text, the render and the highlighting state.
+ */
+struct LegacyRow {
+    int idx;
+    int size;
+    int rsize;
+    char *chars;
+    char *render;
+    unsigned char *hl;
+    int hlOpenComment;
+};
+
+/*
+ * Rows without any text, for sweeping the row table in both layouts.
+ */
+struct Sweep {
+    int count;
+    struct LegacyRow *legacy;
+    struct EditorRowRender *rrows;
+    bool *openComment;
+};
+
+typedef void (*CorpusWriter)(FILE *fp, size_t size);
+
+static char **filters;
+static int filterCount;
+//Counter of hardware cache misses, or -1 if the kernel or the machine doesn't provide one
+static int cacheMissFd = -1;
+static struct Sweep sweep;
+
+static long long benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Opens a counter of the cache misses of this process, which is left disabled until a benchmark runs.
+ */
+static void benchOpenCacheMissCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cacheMissFd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (cacheMissFd == -1) fprintf(stderr, "Cache misses aren't counted: perf_event_open: %s\n", strerror(errno));
+}
+
+/*** corpora ***/
+
+static void writeShortLines(FILE *fp, size_t size) {
+    for (size_t written = 0, i = 0; written < size; i++) {
+        int len = fprintf(fp, "    int value%zu = compute(%zu, \"name\") + 0x%zx;\n", i % 100, i, i * 7);
+        written += (size_t) len;
+    }
+}
+
+static void writeLongLines(FILE *fp, size_t size) {
+    //Each line is long enough to be in long-line mode
+    for (size_t written = 0, i = 0; written < size; i++) {
+        for (int j = 0; j < 4000; j++) written += (size_t) fprintf(fp, "{\"k%d\": %zu}, ", j, i + (size_t) j);
+        fputc('\n', fp);
+        written++;
+    }
+}
+
+static void writeTabLines(FILE *fp, size_t size) {
+    for (size_t written = 0, i = 0; written < size; i++) {
+        int len = fprintf(fp, "\t\tcase %zu:\tx\t=\t%zu;\tbreak;\t//\ttab\n", i, i * 3);
+        written += (size_t) len;
+    }
+}
+
+static void writeCommentLines(FILE *fp, size_t size) {
+    for (size_t written = 0, i = 0; written < size; i++) {
+        int len;
+        if (i % 8 == 0) len = fprintf(fp, "/* block %zu starts here\n", i);
+        else if (i % 8 == 7) len = fprintf(fp, "   and ends here */ int x%zu = %zu; // trailing\n", i, i);
+        else len = fprintf(fp, " * commented out: if (x == %zu) return \"string\";\n", i);
+        written += (size_t) len;
+    }
+}
+
+/**
+ * Writes a corpus to a temporary file and reads its lines back into memory.
+ *
+ * @param corpus to create
+ * @param name of the corpus
+ * @param writer which writes the text of the corpus
+ * @param size number of bytes to write (roughly)
+ * @param loadLines whether to keep the lines in memory, for the row benchmarks
+ */
+static void corpusCreate(struct Corpus *corpus, const char *name, CorpusWriter writer, size_t size, bool loadLines) {
+    memset(corpus, 0, sizeof(*corpus));
+    corpus->name = name;
+    snprintf(corpus->path, sizeof(corpus->path), "/tmp/pound_bench_XXXXXX.c");
+    int fd = mkstemps(corpus->path, 2);
+    FILE *fp = fd == -1 ? NULL : fdopen(fd, "w+");
+    if (fp == NULL) {
+        perror("mkstemps");
+        exit(1);
+    }
+    writer(fp, size);
+    corpus->size = (size_t) ftell(fp);
+    if (!loadLines) {
+        fclose(fp);
+        return;
+    }
+
+    rewind(fp);
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t lineLen;
+    int capacity = 0;
+    while ((lineLen = getline(&line, &lineCap, fp)) != -1) {
+        if (lineLen > 0 && line[lineLen - 1] == '\n') lineLen--;
+        if (corpus->count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            corpus->lines = realloc(corpus->lines, sizeof(char *) * capacity);
+            corpus->lens = realloc(corpus->lens, sizeof(size_t) * capacity);
+        }
+        corpus->lines[corpus->count] = strndup(line, (size_t) lineLen);
+        corpus->lens[corpus->count] = (size_t) lineLen;
+        corpus->count++;
+    }
+    free(line);
+    fclose(fp);
+
+    corpus->rows = malloc(sizeof(struct EditorRow) * corpus->count);
+    corpus->rrows = malloc(sizeof(struct EditorRowRender) * corpus->count);
+    for (int i = 0; i < corpus->count; i++)
+        editorInitRow(&corpus->rows[i], &corpus->rrows[i], corpus->lines[i], corpus->lens[i]);
+}
+
+static void corpusFree(struct Corpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) {
+        free(corpus->lines[i]);
+        editorFreeRow(&corpus->rows[i], &corpus->rrows[i]);
+    }
+    free(corpus->lines);
+    free(corpus->lens);
+    free(corpus->rows);
+    free(corpus->rrows);
+    unlink(corpus->path);
+}
+
+/*** benchmarks ***/
+
+static void benchUpdateRowRender(struct Corpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) editorUpdateRowRender(&corpus->rows[i], &corpus->rrows[i]);
+}
+
+static void benchRowCxToRx(struct Corpus *corpus) {
+    volatile int64_t sink = 0;
+    for (int i = 0; i < corpus->count; i++) {
+        sink += editorRowCxToRx(&corpus->rows[i], corpus->rows[i].size / 2);
+        sink += editorRowCxToRx(&corpus->rows[i], corpus->rows[i].size);
+    }
+}
+
+static void benchAbAppend(struct Corpus *corpus) {
+    struct AppendBuffer ab = ABUF_INIT;
+    for (int i = 0; i < corpus->count; i++) abAppend(&ab, corpus->lines[i], corpus->lens[i]);
+    abFree(&ab);
+}
+
+static void benchOpen(struct Corpus *corpus) {
+    editorClearRows();
+    editorOpen(corpus->path);
+}
+
+static void benchUpdateRowSyntax(struct Corpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) editorUpdateRowSyntax(i);
+}
+
+/**
+ * Writes the rows back over the corpus file, which they were opened from so it's left the same.
+ */
+static void benchSave(struct Corpus *corpus) {
+    (void) corpus;
+    editorSave();
+}
+
+/**
+ * Sweeps the per-row state which highlighting and drawing read, in the layout the row table had before it was split.
+ */
+static void benchSweepLegacy(struct Corpus *corpus) {
+    (void) corpus;
+    long long sum = 0;
+    for (int i = 0; i < sweep.count; i++) {
+        struct LegacyRow *row = &sweep.legacy[i];
+        if (row->hl != NULL) sum += row->rsize;
+        sum += row->hlOpenComment;
+    }
+    volatile long long sink = sum;
+    (void) sink;
+}
+
+/**
+ * Sweeps the same state in the split row table, where it's packed into the render and comment state arrays.
+ */
+static void benchSweepSplit(struct Corpus *corpus) {
+    (void) corpus;
+    long long sum = 0;
+    for (int i = 0; i < sweep.count; i++) {
+        struct EditorRowRender *rrow = &sweep.rrows[i];
+        if (rrow->hl != NULL) sum += rrow->rsize;
+        sum += sweep.openComment[i];
+    }
+    volatile long long sink = sum;
+    (void) sink;
+}
+
+static void benchRowsToString(struct Corpus *corpus) {
+    (void) corpus;
+    size_t len;
+    free(editorRowsToString(&len));
+}
+
+/**
+ * @return whether the benchmark with the specified name matches any of the filters, or there aren't any
+ */
+static bool benchSelected(const char *name) {
+    if (filterCount == 0) return true;
+    for (int i = 0; i < filterCount; i++) {
+        if (strstr(name, filters[i]) != NULL) return true;
+    }
+    return false;
+}
+
+/**
+ * Runs a benchmark over a corpus repeatedly for at least BENCH_MIN_NS and prints its speed.
+ *
+ * @param function name of the function being measured
+ * @param corpus to run the benchmark over
+ * @param bench runs the function over the whole corpus once
+ * @param opsPerRun number of times bench calls the function
+ * @param bytesPerRun number of bytes bench processes, or 0 if its speed doesn't depend on the size of the corpus
+ */
+static void benchRun(const char *function, struct Corpus *corpus, void (*bench)(struct Corpus *), long long opsPerRun,
+                     size_t bytesPerRun) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s", function, corpus->name);
+    if (!benchSelected(name)) return;
+
+    if (cacheMissFd != -1) {
+        ioctl(cacheMissFd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(cacheMissFd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    long long runs = 0;
+    long long start = benchNow(), elapsed;
+    do {
+        bench(corpus);
+        runs++;
+        elapsed = benchNow() - start;
+    } while (elapsed < BENCH_MIN_NS);
+    uint64_t misses = 0;
+    if (cacheMissFd != -1) {
+        ioctl(cacheMissFd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(cacheMissFd, &misses, sizeof(misses)) != sizeof(misses)) misses = 0;
+    }
+
+    printf("%-36s %14.1f ns/op", name, (double) elapsed / (double) (runs * opsPerRun));
+    if (bytesPerRun) printf(" %10.1f MB/s", (double) bytesPerRun * (double) runs / ((double) elapsed / 1e9) / (1024 * 1024));
+    if (cacheMissFd != -1) printf(" %10.3f misses/op", (double) misses / (double) (runs * opsPerRun));
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * Runs the benchmarks which work on the editor's rows: the corpus is opened first.
+ */
+static void benchEditor(struct Corpus *corpus, bool all) {
+    benchRun("editorOpen", corpus, benchOpen, 1, corpus->size);
+    editorClearRows();
+    editorOpen(corpus->path);
+    if (all) {
+        //Every row's result is cached by the open, so the lexer is only measured with the cache bypassed
+        editorBypassHighlightCache(true);
+        benchRun("editorUpdateRowSyntax", corpus, benchUpdateRowSyntax, corpus->count, corpus->size);
+        editorBypassHighlightCache(false);
+        benchRun("editorUpdateRowSyntaxCached", corpus, benchUpdateRowSyntax, corpus->count, corpus->size);
+    }
+    benchRun("editorRowsToString", corpus, benchRowsToString, 1, corpus->size);
+    benchRun("editorSave", corpus, benchSave, 1, corpus->size);
+    editorClearRows();
+}
+
+/**
+ * Sweeps a table of rows in both layouts, which is only worth measuring once it's much bigger than the caches.
+ *
+ * @param count number of rows
+ */
+static void benchSweep(int count) {
+    if (!benchSelected("rowSweepLegacy/rows") && !benchSelected("rowSweepSplit/rows")) return;
+    static unsigned char hl[1];
+    sweep.count = count;
+    sweep.legacy = calloc((size_t) count, sizeof(struct LegacyRow));
+    sweep.rrows = calloc((size_t) count, sizeof(struct EditorRowRender));
+    sweep.openComment = calloc((size_t) count, sizeof(bool));
+    if (sweep.legacy == NULL || sweep.rrows == NULL || sweep.openComment == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        sweep.legacy[i] = (struct LegacyRow) {.idx = i, .size = i % 80, .rsize = i % 80, .hl = hl,
+                                              .hlOpenComment = i % 8 == 0};
+        sweep.rrows[i] = (struct EditorRowRender) {.rsize = i % 80, .rwidth = i % 80, .hl = hl};
+        sweep.openComment[i] = i % 8 == 0;
+    }
+
+    struct Corpus corpus = {.name = "rows"};
+    benchRun("rowSweepLegacy", &corpus, benchSweepLegacy, count, 0);
+    benchRun("rowSweepSplit", &corpus, benchSweepSplit, count, 0);
+    free(sweep.legacy);
+    free(sweep.rrows);
+    free(sweep.openComment);
+}
+
+static void benchRows(struct Corpus *corpus) {
+    benchRun("editorUpdateRowRender", corpus, benchUpdateRowRender, corpus->count, corpus->size);
+    benchRun("editorRowCxToRx", corpus, benchRowCxToRx, 2LL * corpus->count, 0);
+    benchRun("abAppend", corpus, benchAbAppend, corpus->count, corpus->size);
+    benchEditor(corpus, true);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option options[] = {
+            {"size",   required_argument, NULL, 's'},
+            {"big-mb", required_argument, NULL, 'b'},
+            {"sweep-rows", required_argument, NULL, 'r'},
+            {NULL, 0,                     NULL, 0}
+    };
+
+    size_t size = 16 * 1024 * 1024;
+    size_t bigSize = 1024 * 1024 * 1024;
+    int sweepRows = 10 * 1000 * 1000;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                size = (size_t) strtoull(optarg, NULL, 10) * 1024 * 1024;
+                break;
+            case 'b':
+                bigSize = (size_t) strtoull(optarg, NULL, 10) * 1024 * 1024;
+                break;
+            case 'r':
+                sweepRows = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--size=MB] [--big-mb=MB] [--sweep-rows=N] [filter...]\n", argv[0]);
+                return 1;
+        }
+    }
+    filters = &argv[optind];
+    filterCount = argc - optind;
+
+    editorInitHeadless(24, 80);
+    initEditor();
+    benchOpenCacheMissCounter();
+    if (sweepRows > 0) benchSweep(sweepRows);
+
+    struct {
+        const char *name;
+        CorpusWriter writer;
+    } corpora[] = {
+            {"short",    writeShortLines},
+            {"long",     writeLongLines},
+            {"tabs",     writeTabLines},
+            {"comments", writeCommentLines},
+    };
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        struct Corpus corpus;
+        corpusCreate(&corpus, corpora[i].name, corpora[i].writer, size, true);
+        benchRows(&corpus);
+        corpusFree(&corpus);
+    }
+
+    //The big file is only opened and saved, its lines aren't kept in memory twice
+    if (bigSize > 0) {
+        struct Corpus corpus;
+        corpusCreate(&corpus, "big", writeShortLines, bigSize, false);
+        benchEditor(&corpus, false);
+        corpusFree(&corpus);
+    }
+    return 0;
+}
@@ -2,16 +2,33 @@
 #include <memory.h>
 
 #include "append_buffer.h"
+#include "memstats.h"
 
-void abAppend(struct AppendBuffer *ab, const char *s, int len) {
-    char *new = realloc(ab->data, (size_t) (ab->len + len));
+void abAppend(struct AppendBuffer *ab, const char *s, size_t len) {
+    if (ab->len + len > ab->capacity) {
+        //Doubling keeps appending a frame's worth of small pieces from reallocating each time
+        size_t capacity = ab->capacity ? ab->capacity : 256;
+        while (capacity < ab->len + len) capacity *= 2;
 
-    if (new == NULL) return;
-    memcpy(&new[ab->len], s, (size_t) len);
-    ab->data = new;
+        char *new = memRealloc(MEM_OUTPUT, ab->data, capacity);
+        if (new == NULL) return;
+        ab->data = new;
+        ab->capacity = capacity;
+    }
+    memcpy(&ab->data[ab->len], s, len);
     ab->len += len;
 }
 
+/**
+ * Empties the buffer, keeping its memory to be appended to again.
+ */
+void abClear(struct AppendBuffer *ab) {
+    ab->len = 0;
+}
+
 void abFree(struct AppendBuffer *ab) {
-    free(ab->data);
+    memFree(MEM_OUTPUT, ab->data);
+    ab->data = NULL;
+    ab->len = 0;
+    ab->capacity = 0;
 }
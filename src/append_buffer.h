@@ -1,13 +1,19 @@
 #pragma once
 
+#include <stddef.h>
+
 struct AppendBuffer {
     char *data;
-    int len;
+    size_t len;
+    //Number of bytes allocated for data
+    size_t capacity;
 };
 
 //Null constructor
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
+
+void abAppend(struct AppendBuffer *ab, const char *s, size_t len);
 
-void abAppend(struct AppendBuffer *ab, const char *s, int len);
+void abClear(struct AppendBuffer *ab);
 
 void abFree(struct AppendBuffer *ab);
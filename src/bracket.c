@@ -0,0 +1,157 @@
+#include "bracket.h"
+
+/**
+ * Gets the depths of two runs of rows read one after the other.
+ */
+struct BracketDepth bracketJoin(struct BracketDepth a, struct BracketDepth b) {
+    struct BracketDepth joined;
+    joined.delta = a.delta + b.delta;
+    joined.minPrefix = a.delta + b.minPrefix < a.minPrefix ? a.delta + b.minPrefix : a.minPrefix;
+    return joined;
+}
+
+static void bracketPull(void *node, const void *left, const void *right) {
+    struct BracketDepths *n = node;
+    n->rows = bracketJoin(bracketJoin(((const struct BracketDepths *) left)->rows, n->row),
+                          ((const struct BracketDepths *) right)->rows);
+}
+
+static void bracketInitNode(void *node, int i, const void *rows) {
+    ((struct BracketDepths *) node)->row = ((const struct BracketDepth *) rows)[i];
+}
+
+static struct BracketDepths *bracketDepths(struct BracketIndex *index, int node) {
+    return treapPayload(&index->tree, node);
+}
+
+void bracketInit(struct BracketIndex *index) {
+    index->valid = false;
+    treapInit(&index->tree, sizeof(struct BracketDepths), bracketPull);
+}
+
+/**
+ * Marks the tree as out of date, so it gets rebuilt before it's next used.
+ */
+void bracketInvalidate(struct BracketIndex *index) {
+    index->valid = false;
+}
+
+/**
+ * Builds the tree from the depths of every row in O(n).
+ *
+ * @param index to build
+ * @param rows depths of each row
+ * @param numRows number of rows
+ */
+void bracketBuild(struct BracketIndex *index, const struct BracketDepth *rows, int numRows) {
+    treapBuild(&index->tree, numRows, bracketInitNode, rows);
+    index->valid = true;
+}
+
+/**
+ * Updates the tree after a range of rows was replaced, in O(log n) plus the number of rows replaced.
+ *
+ * @param index to update
+ * @param at index of the first row replaced
+ * @param delCount number of rows removed
+ * @param rows depths of each row inserted in their place
+ * @param insCount number of rows inserted
+ */
+void bracketSplice(struct BracketIndex *index, int at, int delCount, const struct BracketDepth *rows, int insCount) {
+    if (!index->valid) return;
+    treapSplice(&index->tree, at, delCount, insCount, bracketInitNode, rows);
+}
+
+/**
+ * Updates the tree after the depth of a row changed, in O(log n).
+ */
+void bracketUpdate(struct BracketIndex *index, int at, struct BracketDepth depth) {
+    if (!index->valid || at >= index->tree.numRows) return;
+    ((struct BracketDepths *) treapRow(&index->tree, at))->row = depth;
+    treapPullRow(&index->tree, at);
+}
+
+/**
+ * @param first index of the first row of the subtree
+ */
+static int bracketSearchClose(struct BracketIndex *index, int node, int first, int from, int *depth) {
+    if (node == 0) return -1;
+    struct TreapNode *n = treapNode(&index->tree, node);
+    struct BracketDepths *d = bracketDepths(index, node);
+    if (first + n->size <= from) return -1;
+    //None of the brackets still open are closed in this subtree
+    if (first >= from && *depth + d->rows.minPrefix > 0) {
+        *depth += d->rows.delta;
+        return -1;
+    }
+
+    int found = bracketSearchClose(index, n->left, first, from, depth);
+    if (found != -1) return found;
+    int at = first + treapNode(&index->tree, n->left)->size;
+    if (at >= from) {
+        if (*depth + d->row.minPrefix <= 0) return at;
+        *depth += d->row.delta;
+    }
+    return bracketSearchClose(index, n->right, at + 1, from, depth);
+}
+
+/**
+ * @param first index of the first row of the subtree
+ */
+static int bracketSearchOpen(struct BracketIndex *index, int node, int first, int from, int *depth) {
+    if (node == 0) return -1;
+    struct TreapNode *n = treapNode(&index->tree, node);
+    struct BracketDepths *d = bracketDepths(index, node);
+    if (first > from) return -1;
+    //None of the brackets still to be opened are opened in this subtree
+    if (first + n->size - 1 <= from && d->rows.delta - d->rows.minPrefix < *depth) {
+        *depth -= d->rows.delta;
+        return -1;
+    }
+
+    int at = first + treapNode(&index->tree, n->left)->size;
+    int found = bracketSearchOpen(index, n->right, at + 1, from, depth);
+    if (found != -1) return found;
+    if (at <= from) {
+        if (d->row.delta - d->row.minPrefix >= *depth) return at;
+        *depth -= d->row.delta;
+    }
+    return bracketSearchOpen(index, n->left, first, from, depth);
+}
+
+/**
+ * Finds the first row, from the specified one on, in which the depth drops to 0.
+ *
+ * @param index to search, which must be valid
+ * @param from row to start at
+ * @param depth number of brackets open at the start of from
+ * @param entry set to the number of brackets open at the start of the row found
+ * @return index of the row, or -1 if the brackets are never all closed
+ */
+int bracketFindClose(struct BracketIndex *index, int from, int depth, int *entry) {
+    if (from >= index->tree.numRows) return -1;
+    int found = bracketSearchClose(index, index->tree.root, 0, from, &depth);
+    *entry = depth;
+    return found;
+}
+
+/**
+ * Finds the last row, from the specified one back, in which the depth read backwards rises to 0.
+ *
+ * @param index to search, which must be valid
+ * @param from row to start at the end of
+ * @param depth number of closing brackets still to be matched at the end of from
+ * @param exit set to the number of closing brackets still to be matched at the end of the row found
+ * @return index of the row, or -1 if the brackets are never all opened
+ */
+int bracketFindOpen(struct BracketIndex *index, int from, int depth, int *exit) {
+    if (from < 0) return -1;
+    int found = bracketSearchOpen(index, index->tree.root, 0, from, &depth);
+    *exit = depth;
+    return found;
+}
+
+void bracketFree(struct BracketIndex *index) {
+    treapFree(&index->tree);
+    index->valid = false;
+}
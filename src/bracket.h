@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "treap.h"
+
+/*
+ * How the brackets of a row (or of a run of rows) change the nesting depth, counting
+ * each opening bracket as +1 and each closing bracket as -1.
+ */
+struct BracketDepth {
+    //Depth at the end relative to the start
+    int delta;
+    //Lowest depth reached reading forwards from the start, 0 if it never drops below it.
+    //Reading backwards from the end the highest depth reached is delta - minPrefix
+    int minPrefix;
+};
+
+/*
+ * Depths of a row in the bracket index's tree, and of every row of its subtree read in order.
+ */
+struct BracketDepths {
+    struct BracketDepth row;
+    struct BracketDepth rows;
+};
+
+/*
+ * Bracket depths of every row, kept in order in a treap with the depths of each subtree.
+ * This way the row holding the bracket which matches one in another row can be found in O(log n)
+ * however far away it is, and a row's depth updated or rows inserted and removed in O(log n).
+ */
+struct BracketIndex {
+    //Whether the tree matches the rows, false if it has to be rebuilt
+    bool valid;
+    //Payloads are struct BracketDepths
+    struct Treap tree;
+};
+
+struct BracketDepth bracketJoin(struct BracketDepth a, struct BracketDepth b);
+
+void bracketInit(struct BracketIndex *index);
+
+void bracketInvalidate(struct BracketIndex *index);
+
+void bracketBuild(struct BracketIndex *index, const struct BracketDepth *rows, int numRows);
+
+void bracketSplice(struct BracketIndex *index, int at, int delCount, const struct BracketDepth *rows, int insCount);
+
+void bracketUpdate(struct BracketIndex *index, int at, struct BracketDepth depth);
+
+int bracketFindClose(struct BracketIndex *index, int from, int depth, int *entry);
+
+int bracketFindOpen(struct BracketIndex *index, int from, int depth, int *exit);
+
+void bracketFree(struct BracketIndex *index);
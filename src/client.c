@@ -0,0 +1,113 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "server.h"
+#include "terminal.h"
+
+static volatile sig_atomic_t clientResized = 0;
+
+static void clientWindowResized(int sig) {
+    (void) sig;
+    clientResized = 1;
+}
+
+/**
+ * Sends the size of the terminal, in a hello or a resize message.
+ *
+ * @param extra bytes which follow the size in the message, or NULL
+ */
+static int clientSendSize(int fd, char type, const char *extra, size_t extraLen) {
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) return -1;
+
+    char msg[4 + 1 + PATH_MAX];
+    uint16_t size[2] = {(uint16_t) rows, (uint16_t) cols};
+    memcpy(msg, size, sizeof(size));
+    if (extraLen > 0) memcpy(&msg[4], extra, extraLen);
+    return serverWriteMessage(fd, type, msg, 4 + extraLen);
+}
+
+/**
+ * Attaches to a server, passing keys typed into this terminal to it
+ * and drawing the frames it sends back, until the server detaches it.
+ *
+ * @param path of the server's socket
+ * @param filename to show, which the server opens if it isn't open already, or NULL
+ * @param view whether the file should be opened read-only in the viewer
+ * @return exit status
+ */
+int clientAttach(const char *path, const char *filename, bool view) {
+    int fd = serverConnect(path);
+    if (fd == -1) {
+        fprintf(stderr, "No server at %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    //The server resolves the file from its own directory, so send an absolute path
+    char hello[1 + PATH_MAX];
+    size_t helloLen = 1;
+    if (filename) {
+        char cwd[PATH_MAX] = "";
+        if (filename[0] != '/' && getcwd(cwd, sizeof(cwd)) == NULL) die("getcwd");
+        int len = snprintf(&hello[1], sizeof(hello) - 1, "%s%s%s", cwd, cwd[0] ? "/" : "", filename);
+        if (len < 0 || (size_t) len >= sizeof(hello) - 1) {
+            fprintf(stderr, "%s: %s\n", filename, strerror(ENAMETOOLONG));
+            return 1;
+        }
+        helloLen += (size_t) len;
+    }
+
+    enableRawMode();
+    hello[0] = (char) ((terminalSupportsSyncUpdate() ? HELLO_SYNC_UPDATE : 0) | (view ? HELLO_VIEW : 0));
+    if (clientSendSize(fd, MSG_HELLO, hello, helloLen) == -1) die("hello");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = clientWindowResized;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    struct pollfd pfds[2] = {{.fd = STDIN_FILENO, .events = POLLIN}, {.fd = fd, .events = POLLIN}};
+    while (1) {
+        if (clientResized) {
+            clientResized = 0;
+            if (clientSendSize(fd, MSG_RESIZE, NULL, 0) == -1) break;
+        }
+
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            char keys[4096];
+            ssize_t nread = read(STDIN_FILENO, keys, sizeof(keys));
+            if (nread > 0 && serverWriteMessage(fd, MSG_KEYS, keys, (size_t) nread) == -1) break;
+        }
+
+        if (pfds[1].revents) {
+            char type;
+            char *data;
+            size_t len;
+            if (serverReadMessage(fd, &type, &data, &len) == -1) break;
+            if (type == MSG_OUTPUT) write(STDOUT_FILENO, data, len);
+            free(data);
+            if (type == MSG_EXIT) break;
+        }
+    }
+
+    close(fd);
+    char cmdBuf[16];
+    int cmdLen = getCursorSetPositionCmd(cmdBuf, 1, 1);
+    terminalWrite(CLEAR_DISPLAY_CMD, 4);
+    terminalWrite(cmdBuf, cmdLen);
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdbool.h>
+
+int clientAttach(const char *path, const char *filename, bool view);
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+
+#include "diff.h"
+
+/*
+ * State shared by every level of a diff, so the two V arrays are only allocated once.
+ */
+struct DiffContext {
+    const uint64_t *a;
+    const uint64_t *b;
+    //Furthest x reached on each diagonal, going forwards from the start and backwards from the end
+    int *forward;
+    int *backward;
+    struct DiffScript *script;
+    bool failed;
+};
+
+/**
+ * Adds a change to the end of the script, merging it into the last change if they touch.
+ */
+static void diffAddChange(struct DiffContext *ctx, int oldFrom, int oldCount, int newFrom, int newCount) {
+    struct DiffScript *script = ctx->script;
+    if (script->count > 0) {
+        struct DiffChange *last = &script->changes[script->count - 1];
+        if (last->oldFrom + last->oldCount == oldFrom && last->newFrom + last->newCount == newFrom) {
+            last->oldCount += oldCount;
+            last->newCount += newCount;
+            return;
+        }
+    }
+
+    if (script->count == script->capacity) {
+        int capacity = script->capacity ? script->capacity * 2 : 64;
+        struct DiffChange *changes = realloc(script->changes, sizeof(struct DiffChange) * (size_t) capacity);
+        if (changes == NULL) {
+            ctx->failed = true;
+            return;
+        }
+        script->changes = changes;
+        script->capacity = capacity;
+    }
+    script->changes[script->count++] = (struct DiffChange) {oldFrom, oldCount, newFrom, newCount};
+}
+
+/**
+ * Finds a point on a shortest edit script between two ranges of lines by following the
+ * furthest reaching paths forwards from the start and backwards from the end until they overlap,
+ * in O((n + m) * d) time and O(n + m) space.
+ *
+ * @param splitX set to the offset into the old range of the point
+ * @param splitY set to the offset into the new range of the point
+ * @return false if the paths never overlap, so the ranges have nothing in common
+ */
+static bool diffBisect(struct DiffContext *ctx, int aLo, int aHi, int bLo, int bHi, int *splitX, int *splitY) {
+    const uint64_t *a = ctx->a, *b = ctx->b;
+    int n = aHi - aLo, m = bHi - bLo;
+    int maxD = (n + m + 1) / 2;
+    int offset = maxD;
+    int vLen = 2 * maxD + 2;
+    int *v1 = ctx->forward, *v2 = ctx->backward;
+    for (int i = 0; i < vLen; i++) v1[i] = v2[i] = -1;
+    v1[offset + 1] = 0;
+    v2[offset + 1] = 0;
+
+    int delta = n - m;
+    //With an odd delta the forward path is the one to check for overlaps, otherwise the backward one
+    bool front = delta % 2 != 0;
+    //Diagonals on either side which have run off the edge of the grid, and are skipped from then on
+    int k1Start = 0, k1End = 0, k2Start = 0, k2End = 0;
+    for (int d = 0; d < maxD; d++) {
+        for (int k1 = -d + k1Start; k1 <= d - k1End; k1 += 2) {
+            int k1Off = offset + k1;
+            int x1 = k1 == -d || (k1 != d && v1[k1Off - 1] < v1[k1Off + 1]) ? v1[k1Off + 1] : v1[k1Off - 1] + 1;
+            int y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[aLo + x1] == b[bLo + y1]) {
+                x1++;
+                y1++;
+            }
+            v1[k1Off] = x1;
+            if (x1 > n) {
+                k1End += 2;
+            } else if (y1 > m) {
+                k1Start += 2;
+            } else if (front) {
+                int k2Off = offset + delta - k1;
+                if (k2Off >= 0 && k2Off < vLen && v2[k2Off] != -1 && x1 >= n - v2[k2Off]) {
+                    *splitX = x1;
+                    *splitY = y1;
+                    return true;
+                }
+            }
+        }
+
+        for (int k2 = -d + k2Start; k2 <= d - k2End; k2 += 2) {
+            int k2Off = offset + k2;
+            int x2 = k2 == -d || (k2 != d && v2[k2Off - 1] < v2[k2Off + 1]) ? v2[k2Off + 1] : v2[k2Off - 1] + 1;
+            int y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[aHi - 1 - x2] == b[bHi - 1 - y2]) {
+                x2++;
+                y2++;
+            }
+            v2[k2Off] = x2;
+            if (x2 > n) {
+                k2End += 2;
+            } else if (y2 > m) {
+                k2Start += 2;
+            } else if (!front) {
+                int k1Off = offset + delta - k2;
+                if (k1Off >= 0 && k1Off < vLen && v1[k1Off] != -1 && v1[k1Off] >= n - x2) {
+                    *splitX = v1[k1Off];
+                    *splitY = v1[k1Off] - (k1Off - offset);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Diffs a range of the old lines against a range of the new lines, adding the changes to the script.
+ * Lines the ranges start or end with in common are skipped before they're split in two.
+ */
+static void diffRange(struct DiffContext *ctx, int aLo, int aHi, int bLo, int bHi) {
+    while (aLo < aHi && bLo < bHi && ctx->a[aLo] == ctx->b[bLo]) {
+        aLo++;
+        bLo++;
+    }
+    while (aLo < aHi && bLo < bHi && ctx->a[aHi - 1] == ctx->b[bHi - 1]) {
+        aHi--;
+        bHi--;
+    }
+    if (aLo == aHi && bLo == bHi) return;
+
+    int x, y;
+    if (aLo == aHi || bLo == bHi || !diffBisect(ctx, aLo, aHi, bLo, bHi, &x, &y)) {
+        diffAddChange(ctx, aLo, aHi - aLo, bLo, bHi - bLo);
+        return;
+    }
+    diffRange(ctx, aLo, aLo + x, bLo, bLo + y);
+    diffRange(ctx, aLo + x, aHi, bLo + y, bHi);
+}
+
+/**
+ * Finds the shortest script of changes turning one version of a file into another (Myers' diff,
+ * splitting on the middle of the edit path so it only needs linear space). Lines are
+ * compared by their hashes.
+ *
+ * @param a hash of each line of the old version
+ * @param n number of lines in a
+ * @param b hash of each line of the new version
+ * @param m number of lines in b
+ * @param script set to the changes, which must be freed with diffFree
+ * @return false if there wasn't enough memory
+ */
+bool diffLines(const uint64_t *a, int n, const uint64_t *b, int m, struct DiffScript *script) {
+    script->changes = NULL;
+    script->count = 0;
+    script->capacity = 0;
+
+    size_t vLen = (size_t) (n + m + 1) + 2;
+    struct DiffContext ctx = {a, b, malloc(sizeof(int) * vLen), malloc(sizeof(int) * vLen), script, false};
+    if (ctx.forward && ctx.backward) diffRange(&ctx, 0, n, 0, m);
+    bool ok = ctx.forward && ctx.backward && !ctx.failed;
+    free(ctx.forward);
+    free(ctx.backward);
+    if (!ok) diffFree(script);
+    return ok;
+}
+
+void diffFree(struct DiffScript *script) {
+    free(script->changes);
+    script->changes = NULL;
+    script->count = 0;
+    script->capacity = 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A run of lines of the old version replaced by a run of lines of the new version,
+ * either of which may be empty.
+ */
+struct DiffChange {
+    int oldFrom;
+    int oldCount;
+    int newFrom;
+    int newCount;
+};
+
+/*
+ * Changes turning one version into the other, in order.
+ */
+struct DiffScript {
+    struct DiffChange *changes;
+    int count;
+    int capacity;
+};
+
+bool diffLines(const uint64_t *a, int n, const uint64_t *b, int m, struct DiffScript *script);
+
+void diffFree(struct DiffScript *script);
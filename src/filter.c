@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "filter.h"
+
+//Size asked for the pipe into the command, so more of the input is handed over in each call
+#define FILTER_PIPE_SIZE (1024 * 1024)
+
+/**
+ * Writes as much of the input as the pipe will take. vmsplice is used while it's
+ * supported, which hands the pages the input is kept in to the pipe rather than copying
+ * them in through write, falling back to writev when it isn't.
+ *
+ * The pages are referenced rather than copied, so the input mustn't be changed while the
+ * command may still read it, which the editor doesn't do as it waits for the command to finish.
+ *
+ * @return 1 if there may be more to write, 0 at the end of the input, -1 on error
+ */
+static int filterWrite(int fd, struct FilterIo *io, bool *spliceable) {
+    struct iovec iov[FILTER_MAX_PIECES];
+    int n = io->pieces(io->ctx, iov, FILTER_MAX_PIECES);
+    if (n == 0) return 0;
+
+    ssize_t written = -1;
+    if (*spliceable) {
+        written = vmsplice(fd, iov, (unsigned long) n, SPLICE_F_NONBLOCK);
+        if (written == -1 && (errno == EINVAL || errno == ENOSYS)) *spliceable = false;
+    }
+    if (!*spliceable) written = writev(fd, iov, n);
+
+    if (written == -1) return errno == EAGAIN || errno == EINTR ? 1 : -1;
+    io->consumed(io->ctx, (size_t) written);
+    return 1;
+}
+
+static void filterClose(int *fd) {
+    if (*fd == -1) return;
+    close(*fd);
+    *fd = -1;
+}
+
+/**
+ * Runs a shell command, writing the input to its stdin while reading its stdout at the same
+ * time with poll, so neither side waits on the other however much they write.
+ *
+ * @param command to run with /bin/sh
+ * @param io where the input comes from and the output goes
+ * @param error set to the start of what the command wrote to stderr
+ * @param errorSize size of error
+ * @return exit status of the command (128 plus the signal if it was killed), or -1 if it couldn't be run
+ */
+int filterRun(const char *command, struct FilterIo *io, char *error, size_t errorSize) {
+    int in[2], out[2], err[2];
+    error[0] = '\0';
+    if (pipe2(in, O_CLOEXEC) == -1) return -1;
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+    if (pipe2(err, O_CLOEXEC) == -1) {
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+    if (pid == -1) {
+        close(in[1]);
+        close(out[0]);
+        close(err[0]);
+        return -1;
+    }
+
+    int inFd = in[1], outFd = out[0], errFd = err[0];
+    fcntl(inFd, F_SETPIPE_SZ, FILTER_PIPE_SIZE);
+    fcntl(inFd, F_SETFL, O_NONBLOCK);
+    fcntl(outFd, F_SETFL, O_NONBLOCK);
+    fcntl(errFd, F_SETFL, O_NONBLOCK);
+
+    //A command which exits without reading all of its input would otherwise kill the editor with SIGPIPE
+    struct sigaction ignore, saved;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+
+    char *chunk = malloc(FILTER_CHUNK_SIZE);
+    size_t errorLen = 0;
+    bool spliceable = true;
+    while (chunk && (outFd != -1 || errFd != -1)) {
+        struct pollfd pfds[3] = {
+                {.fd = inFd, .events = POLLOUT},
+                {.fd = outFd, .events = POLLIN},
+                {.fd = errFd, .events = POLLIN}
+        };
+        if (poll(pfds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (inFd != -1 && pfds[0].revents && filterWrite(inFd, io, &spliceable) <= 0) filterClose(&inFd);
+
+        if (outFd != -1 && pfds[1].revents) {
+            ssize_t nread = read(outFd, chunk, FILTER_CHUNK_SIZE);
+            if (nread > 0) io->output(io->ctx, chunk, (size_t) nread);
+            else if (nread == 0 || (errno != EAGAIN && errno != EINTR)) filterClose(&outFd);
+        }
+
+        if (errFd != -1 && pfds[2].revents) {
+            ssize_t nread = read(errFd, chunk, FILTER_CHUNK_SIZE);
+            if (nread > 0 && errorLen + 1 < errorSize) {
+                size_t len = (size_t) nread < errorSize - 1 - errorLen ? (size_t) nread : errorSize - 1 - errorLen;
+                memcpy(&error[errorLen], chunk, len);
+                errorLen += len;
+                error[errorLen] = '\0';
+            } else if (nread == 0 || (nread == -1 && errno != EAGAIN && errno != EINTR)) {
+                filterClose(&errFd);
+            }
+        }
+    }
+    free(chunk);
+    filterClose(&inFd);
+    filterClose(&outFd);
+    filterClose(&errFd);
+    sigaction(SIGPIPE, &saved, NULL);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+//Maximum number of pieces of input handed to the kernel at once
+#define FILTER_MAX_PIECES 64
+//Number of bytes of output read at once
+#define FILTER_CHUNK_SIZE (64 * 1024)
+
+/*
+ * Where the input of a filter comes from and where its output goes, so input can be
+ * written straight out of the memory it's kept in rather than copied into one buffer first.
+ */
+struct FilterIo {
+    //Fills iov with up to max pieces of the input, starting where it's up to, and returns how many (0 at the end)
+    int (*pieces)(void *ctx, struct iovec *iov, int max);
+    //Moves the input on by the number of bytes which were written
+    void (*consumed)(void *ctx, size_t len);
+    //Takes a chunk of output
+    void (*output)(void *ctx, const char *data, size_t len);
+    void *ctx;
+};
+
+int filterRun(const char *command, struct FilterIo *io, char *error, size_t errorSize);
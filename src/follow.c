@@ -0,0 +1,108 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "follow.h"
+
+/**
+ * Opens the file at the path being followed, and watches the file it currently refers to.
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+static int followOpen(struct Follow *follow) {
+    struct stat st;
+    follow->fd = open(follow->path, O_RDONLY);
+    if (follow->fd == -1 || fstat(follow->fd, &st) == -1) return -1;
+    follow->dev = st.st_dev;
+    follow->inode = st.st_ino;
+
+    if (follow->fileWatch != -1) inotify_rm_watch(follow->inotifyFd, follow->fileWatch);
+    follow->fileWatch = inotify_add_watch(follow->inotifyFd, follow->path,
+                                          IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    return 0;
+}
+
+/**
+ * Starts following the file at the specified path.
+ *
+ * @param follow to start
+ * @param path of the file
+ * @param offset number of bytes of the file which have already been read
+ * @return 0 if successful, -1 otherwise
+ */
+int followStart(struct Follow *follow, const char *path, off_t offset) {
+    follow->path = strdup(path);
+    follow->offset = offset;
+    follow->fileWatch = -1;
+    follow->dirWatch = -1;
+    follow->fd = -1;
+
+    follow->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follow->inotifyFd == -1) return -1;
+
+    char *dir = strdup(path);
+    follow->dirWatch = inotify_add_watch(follow->inotifyFd, dirname(dir), IN_CREATE | IN_MOVED_TO);
+    free(dir);
+
+    return followOpen(follow);
+}
+
+/**
+ * Checks whether the file changed, without blocking. Only calls stat when
+ * inotify reported that something happened to the file or its directory.
+ *
+ * @param follow file to check
+ * @return what happened to the file
+ */
+enum FollowEvent followPoll(struct Follow *follow) {
+    char events[4096];
+    bool changed = false;
+    while (read(follow->inotifyFd, events, sizeof(events)) > 0) changed = true;
+    if (!changed) return FOLLOW_NONE;
+
+    struct stat st;
+    if (stat(follow->path, &st) == -1) {
+        //Rotated away and not replaced yet, the new file will trigger the directory watch
+        return FOLLOW_NONE;
+    }
+
+    if (st.st_dev != follow->dev || st.st_ino != follow->inode) {
+        close(follow->fd);
+        if (followOpen(follow) == -1) return FOLLOW_NONE;
+        follow->offset = 0;
+        return FOLLOW_RESET;
+    }
+    if (st.st_size < follow->offset) {
+        follow->offset = 0;
+        return FOLLOW_RESET;
+    }
+    return st.st_size > follow->offset ? FOLLOW_APPENDED : FOLLOW_NONE;
+}
+
+/**
+ * Reads the next bytes appended to the file since it was last read.
+ *
+ * @return number of bytes read, 0 at the end of the file, or -1 on error
+ */
+ssize_t followRead(struct Follow *follow, char *buf, size_t len) {
+    ssize_t nread;
+    do {
+        nread = pread(follow->fd, buf, len, follow->offset);
+    } while (nread == -1 && errno == EINTR);
+    if (nread > 0) follow->offset += nread;
+    return nread;
+}
+
+void followStop(struct Follow *follow) {
+    if (follow->fd != -1) close(follow->fd);
+    if (follow->inotifyFd != -1) close(follow->inotifyFd);
+    free(follow->path);
+    follow->path = NULL;
+}
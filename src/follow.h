@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+enum FollowEvent {
+    //Nothing happened to the file
+    FOLLOW_NONE = 0,
+    //Bytes were appended to the file
+    FOLLOW_APPENDED,
+    //The file was truncated or replaced, so it has to be read again from the start
+    FOLLOW_RESET
+};
+
+/*
+ * Watches a file which is being appended to (like tail -f), using inotify
+ * to find out when it changes rather than reading it again.
+ */
+struct Follow {
+    char *path;
+    int fd;
+    int inotifyFd;
+    //Watch on the file, for writes, and on its directory, for a new file being rotated in
+    int fileWatch;
+    int dirWatch;
+    dev_t dev;
+    ino_t inode;
+    //Number of bytes of the file which have been read
+    off_t offset;
+};
+
+int followStart(struct Follow *follow, const char *path, off_t offset);
+
+enum FollowEvent followPoll(struct Follow *follow);
+
+ssize_t followRead(struct Follow *follow, char *buf, size_t len);
+
+void followStop(struct Follow *follow);
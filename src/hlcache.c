@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include "hlcache.h"
+#include "memstats.h"
+#include "row.h"
+
+static struct HlCacheEntry *hlCacheSlot(struct HlCache *cache, uint64_t hash, const void *syntax,
+                                        bool entryComment) {
+    //The low bits of FNV-1a are mixed the least, so fold the high bits in
+    uint64_t key = hash ^ (hash >> 32) ^ (uintptr_t) syntax ^ (uint64_t) entryComment;
+    return &cache->slots[key & (HL_CACHE_SLOTS - 1)];
+}
+
+/**
+ * Looks up the highlighting of a row.
+ *
+ * @param cache to look in
+ * @param hash of the render
+ * @param render of the row
+ * @param rsize of the render
+ * @param syntax the row is highlighted with
+ * @param entryComment whether the row starts inside a multi-line comment
+ * @return the result, whose hl the row can take a reference to, or NULL if it isn't cached
+ */
+struct HlCacheEntry *hlCacheFind(struct HlCache *cache, uint64_t hash, const char *render, int rsize,
+                                 const void *syntax, bool entryComment) {
+    if (cache->bypass) return NULL;
+    if (cache->slots != NULL) {
+        struct HlCacheEntry *slot = hlCacheSlot(cache, hash, syntax, entryComment);
+        if (slot->hl != NULL && slot->hash == hash && slot->rsize == rsize && slot->syntax == syntax &&
+            slot->entryComment == entryComment && memcmp(slot->render, render, (size_t) rsize) == 0) {
+            cache->hits++;
+            return slot;
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+/**
+ * Caches the highlighting of a row, taking a reference to its hl and a copy of its render,
+ * and replacing whatever was in its slot.
+ */
+void hlCacheStore(struct HlCache *cache, const struct HlCacheEntry *entry) {
+    if (cache->bypass || entry->rsize > HL_CACHE_MAX_RENDER) return;
+    if (cache->slots == NULL) {
+        cache->slots = memAlloc(MEM_HIGHLIGHT, sizeof(struct HlCacheEntry) * HL_CACHE_SLOTS);
+        if (cache->slots == NULL) return;
+        memset(cache->slots, 0, sizeof(struct HlCacheEntry) * HL_CACHE_SLOTS);
+    }
+
+    struct HlCacheEntry *slot = hlCacheSlot(cache, entry->hash, entry->syntax, entry->entryComment);
+    char *render = memRealloc(MEM_RENDER, slot->render, (size_t) entry->rsize + 1);
+    if (render == NULL) return;
+    memcpy(render, entry->render, (size_t) entry->rsize);
+    editorReleaseRowHl(slot->hl);
+    *slot = *entry;
+    slot->render = render;
+    slot->hl = editorRetainRowHl(entry->hl);
+}
+
+void hlCacheFree(struct HlCache *cache) {
+    if (cache->slots == NULL) return;
+    for (int i = 0; i < HL_CACHE_SLOTS; i++) {
+        editorReleaseRowHl(cache->slots[i].hl);
+        memFree(MEM_RENDER, cache->slots[i].render);
+    }
+    memFree(MEM_HIGHLIGHT, cache->slots);
+    cache->slots = NULL;
+}
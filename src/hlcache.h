@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bracket.h"
+
+//Number of slots in the highlight cache, a power of 2
+#define HL_CACHE_SLOTS (1 << 16)
+//Rows whose render is longer than this aren't cached, so the copies of the renders take up at most 64 MB
+#define HL_CACHE_MAX_RENDER 1024
+
+/*
+ * Highlighting of a rendered row, which any other row with the same render entered
+ * in the same state with the same syntax can share rather than being lexed again.
+ */
+struct HlCacheEntry {
+    //Hash of the render
+    uint64_t hash;
+    int rsize;
+    //Copy of the render, compared on a hit so rows whose hashes collide don't share highlighting
+    char *render;
+    //Syntax the row was highlighted with
+    const void *syntax;
+    //Whether the row starts and ends inside a multi-line comment
+    bool entryComment;
+    bool exitComment;
+    struct BracketDepth depth;
+    //Shared hl, or NULL if the slot is empty
+    unsigned char *hl;
+};
+
+/*
+ * Direct-mapped cache of highlighting results, shared by every buffer. A result is replaced
+ * by the next one hashing to the same slot, so at most HL_CACHE_SLOTS hl are kept
+ * alive by the cache once no row uses them.
+ */
+struct HlCache {
+    struct HlCacheEntry *slots;
+    size_t hits;
+    size_t misses;
+    //Set to neither look results up nor store them, so every row is lexed
+    bool bypass;
+};
+
+struct HlCacheEntry *hlCacheFind(struct HlCache *cache, uint64_t hash, const char *render, int rsize,
+                                 const void *syntax, bool entryComment);
+
+void hlCacheStore(struct HlCache *cache, const struct HlCacheEntry *entry);
+
+void hlCacheFree(struct HlCache *cache);
@@ -0,0 +1,202 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lineindex.h"
+
+//Number of bytes counted at once while indexing, only blocks which hold an indexed line are searched
+#define LINE_INDEX_BLOCK_SIZE 4096
+
+/**
+ * Counts the newlines in a string, checking 16 bytes at a time where SSE2 is available.
+ *
+ * @param s string to search
+ * @param len number of bytes in s
+ * @return number of newlines
+ */
+size_t lineIndexCountNewlines(const char *s, size_t len) {
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) &s[i]);
+        count += (size_t) __builtin_popcount((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+    }
+#endif
+    for (; i < len; i++)
+        if (s[i] == '\n') count++;
+    return count;
+}
+
+/**
+ * Adds the offset of the line after the newline at the specified offset to the index
+ * if it is one of the lines the index keeps. Must be called with the lock held.
+ */
+static void lineIndexAddNewline(struct LineIndex *index, off_t newline) {
+    index->lines++;
+    if (index->lines % LINE_INDEX_STRIDE != 0) return;
+
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 1024;
+        off_t *offsets = realloc(index->offsets, sizeof(off_t) * capacity);
+        if (offsets == NULL) return;
+        index->offsets = offsets;
+        index->capacity = capacity;
+    }
+    index->offsets[index->count++] = newline + 1;
+}
+
+static void *lineIndexBuild(void *arg) {
+    struct LineIndex *index = arg;
+    char *buf = malloc(LINE_INDEX_CHUNK_SIZE);
+    off_t offset = 0;
+
+    while (buf) {
+        pthread_mutex_lock(&index->lock);
+        bool stopping = index->stopping;
+        pthread_mutex_unlock(&index->lock);
+        if (stopping) break;
+
+        ssize_t nread;
+        do {
+            nread = pread(index->fd, buf, LINE_INDEX_CHUNK_SIZE, offset);
+        } while (nread == -1 && errno == EINTR);
+        if (nread <= 0) break;
+
+        pthread_mutex_lock(&index->lock);
+        for (ssize_t block = 0; block < nread; block += LINE_INDEX_BLOCK_SIZE) {
+            size_t len = nread - block < LINE_INDEX_BLOCK_SIZE ? (size_t) (nread - block) : LINE_INDEX_BLOCK_SIZE;
+            size_t count = lineIndexCountNewlines(&buf[block], len);
+            if (index->lines % LINE_INDEX_STRIDE + (long long) count < LINE_INDEX_STRIDE) {
+                index->lines += (long long) count;
+                continue;
+            }
+
+            //One of the lines kept in the index starts in this block, so find where each line starts
+            const char *p = &buf[block], *end = &buf[block] + len;
+            while ((p = memchr(p, '\n', (size_t) (end - p))) != NULL) {
+                lineIndexAddNewline(index, offset + (p - buf));
+                p++;
+            }
+        }
+        offset += nread;
+        index->scanned = offset;
+        pthread_mutex_unlock(&index->lock);
+    }
+
+    pthread_mutex_lock(&index->lock);
+    index->done = true;
+    pthread_mutex_unlock(&index->lock);
+    free(buf);
+    return NULL;
+}
+
+/**
+ * Starts indexing the lines of a file in the background.
+ *
+ * @param index to build
+ * @param fd of the file, which is closed when the index is stopped
+ * @return 0 if successful, -1 otherwise (fd is left open)
+ */
+int lineIndexStart(struct LineIndex *index, int fd) {
+    index->fd = fd;
+    index->offsets = malloc(sizeof(off_t) * 1024);
+    if (index->offsets == NULL) return -1;
+    index->offsets[0] = 0;
+    index->count = 1;
+    index->capacity = 1024;
+    index->lines = 0;
+    index->scanned = 0;
+    index->done = false;
+    index->stopping = false;
+    pthread_mutex_init(&index->lock, NULL);
+    if (pthread_create(&index->thread, NULL, lineIndexBuild, index) != 0) {
+        pthread_mutex_destroy(&index->lock);
+        free(index->offsets);
+        index->offsets = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Finds the nearest indexed line at or before an offset.
+ *
+ * @param index to search
+ * @param offset to find the line before
+ * @param checkpoint set to the offset of the indexed line
+ * @param line set to the number of the indexed line, counting from 0
+ * @return false if that part of the file hasn't been indexed yet
+ */
+bool lineIndexCheckpoint(struct LineIndex *index, off_t offset, off_t *checkpoint, long long *line) {
+    pthread_mutex_lock(&index->lock);
+    bool indexed = offset <= index->scanned || index->done;
+    if (indexed) {
+        size_t lo = 0, hi = index->count - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi + 1) / 2;
+            if (index->offsets[mid] <= offset) lo = mid;
+            else hi = mid - 1;
+        }
+        *checkpoint = index->offsets[lo];
+        *line = (long long) lo * LINE_INDEX_STRIDE;
+    }
+    pthread_mutex_unlock(&index->lock);
+    return indexed;
+}
+
+/**
+ * Finds the nearest indexed line at or before a line number, without searching.
+ *
+ * @param index to look in
+ * @param line number of the line to find, counting from 0
+ * @param checkpoint set to the offset of the indexed line
+ * @param checkpointLine set to the number of the indexed line
+ * @return false if the index hasn't got to that line yet
+ */
+bool lineIndexFind(struct LineIndex *index, long long line, off_t *checkpoint, long long *checkpointLine) {
+    pthread_mutex_lock(&index->lock);
+    bool indexed = line <= index->lines || index->done;
+    if (indexed) {
+        size_t i = (size_t) (line / LINE_INDEX_STRIDE);
+        if (i >= index->count) i = index->count - 1;
+        *checkpoint = index->offsets[i];
+        *checkpointLine = (long long) i * LINE_INDEX_STRIDE;
+    }
+    pthread_mutex_unlock(&index->lock);
+    return indexed;
+}
+
+/**
+ * Gets how far the index has got.
+ *
+ * @param index to check
+ * @param lines set to the number of lines found so far
+ * @param scanned set to the number of bytes of the file indexed so far
+ * @param done set to whether the whole file has been indexed
+ */
+void lineIndexProgress(struct LineIndex *index, long long *lines, off_t *scanned, bool *done) {
+    pthread_mutex_lock(&index->lock);
+    *lines = index->lines;
+    *scanned = index->scanned;
+    *done = index->done;
+    pthread_mutex_unlock(&index->lock);
+}
+
+void lineIndexStop(struct LineIndex *index) {
+    pthread_mutex_lock(&index->lock);
+    index->stopping = true;
+    pthread_mutex_unlock(&index->lock);
+    pthread_join(index->thread, NULL);
+    pthread_mutex_destroy(&index->lock);
+    free(index->offsets);
+    index->offsets = NULL;
+    close(index->fd);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//Number of lines between the offsets kept in the index
+#define LINE_INDEX_STRIDE 1024
+//Number of bytes read from the file at once while indexing
+#define LINE_INDEX_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Sparse index of the lines of a file, built on a background thread: the byte offset
+ * of every LINE_INDEX_STRIDE-th line is kept, so the offset of any line can be found
+ * by scanning at most LINE_INDEX_STRIDE lines from the nearest indexed one.
+ */
+struct LineIndex {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    //offsets[i] is the offset of line i * LINE_INDEX_STRIDE
+    off_t *offsets;
+    size_t count;
+    size_t capacity;
+    //Number of newlines in the part of the file which has been indexed
+    long long lines;
+    //Number of bytes of the file which have been indexed
+    off_t scanned;
+    //Whether the whole file (or an error) was reached
+    bool done;
+    bool stopping;
+};
+
+int lineIndexStart(struct LineIndex *index, int fd);
+
+bool lineIndexCheckpoint(struct LineIndex *index, off_t offset, off_t *checkpoint, long long *line);
+
+bool lineIndexFind(struct LineIndex *index, long long line, off_t *checkpoint, long long *checkpointLine);
+
+void lineIndexProgress(struct LineIndex *index, long long *lines, off_t *scanned, bool *done);
+
+size_t lineIndexCountNewlines(const char *s, size_t len);
+
+void lineIndexStop(struct LineIndex *index);
@@ -0,0 +1,126 @@
+#define _DEFAULT_SOURCE
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "pound.h"
+#include "server.h"
+#include "terminal.h"
+#include "trace.h"
+
+int main(int argc, char *argv[]) {
+    static struct option options[] = {
+            {"follow",   no_argument,       NULL, 'f'},
+            {"view",     no_argument,       NULL, 'v'},
+            {"headless", required_argument, NULL, 'H'},
+            {"size",     required_argument, NULL, 's'},
+            {"trace",    required_argument, NULL, 't'},
+            {"hud",      no_argument,       NULL, 'u'},
+            {"stats",    no_argument,       NULL, 'S'},
+            {"server",   optional_argument, NULL, 'D'},
+            {"attach",   optional_argument, NULL, 'A'},
+            {NULL, 0,                       NULL, 0}
+    };
+
+    bool follow = false;
+    bool view = false;
+    char *script = NULL;
+    char *size = "24x80";
+    char *tracePath = NULL;
+    bool hud = false;
+    bool stats = false;
+    bool server = false;
+    bool attach = false;
+    char socketPath[108];
+    serverDefaultPath(socketPath, sizeof(socketPath));
+    int opt;
+    while ((opt = getopt_long(argc, argv, "fv", options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                follow = true;
+                break;
+            case 'v':
+                view = true;
+                break;
+            case 'H':
+                script = optarg;
+                break;
+            case 's':
+                size = optarg;
+                break;
+            case 't':
+                tracePath = optarg;
+                break;
+            case 'u':
+                hud = true;
+                break;
+            case 'S':
+                stats = true;
+                break;
+            case 'D':
+            case 'A':
+                if (opt == 'D') server = true;
+                else attach = true;
+                if (optarg) snprintf(socketPath, sizeof(socketPath), "%s", optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f|--follow] [-v|--view] [--headless=SCRIPT [--size=ROWSxCOLS]] "
+                                "[--trace=FILE] [--hud] [--stats] [--server[=SOCKET]|--attach[=SOCKET]] "
+                                "[file...|-]\n", argv[0]);
+                return 1;
+        }
+    }
+    char *filename = optind < argc ? argv[optind] : NULL;
+    if (attach) return clientAttach(socketPath, filename, view);
+    if (script) editorStartHeadless(script, size);
+    if (server) editorStartServer(socketPath);
+    if (tracePath) {
+        if (traceStart(tracePath) == -1) {
+            perror(tracePath);
+            return 1;
+        }
+        atexit(traceStop);
+    }
+
+    //"-" reads the file from stdin, so keys have to come from the terminal instead
+    int stdinFd = -1;
+    if (filename && strcmp(filename, "-") == 0) {
+        stdinFd = script || server ? dup(STDIN_FILENO) : terminalReopenStdin();
+        if (stdinFd == -1) die("terminalReopenStdin");
+    }
+
+    //Registered before raw mode, so the terminal has been restored by the time it prints
+    if (stats) atexit(editorPrintStats);
+    if (!script && !server) enableRawMode();
+    initEditor();
+    if (hud) editorSetHud(true);
+    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+
+    if (stdinFd != -1) {
+        editorOpenStream(stdinFd);
+    } else {
+        //Each file is opened in a buffer of its own, and the first one is shown
+        for (int i = optind; i < argc; i++) {
+            if (i > optind) editorNewBuffer();
+            if (view) {
+                editorView(argv[i]);
+            } else {
+                off_t bytesRead = editorOpen(argv[i]);
+                if (follow && bytesRead != -1) editorFollow(bytesRead);
+            }
+        }
+        editorSwitchBuffer(0);
+    }
+
+    while (1) {
+        editorScheduleRefresh();
+        editorProcessKeypress();
+    }
+
+    return 0;
+}
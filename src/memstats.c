@@ -0,0 +1,77 @@
+#include <malloc.h>
+#include <stdlib.h>
+
+#include "memstats.h"
+
+const char *memCategoryNames[MEM_CATEGORIES] = {"text", "render", "hl", "columns", "rows", "output"};
+
+static struct MemStats stats[MEM_CATEGORIES];
+
+/**
+ * Counts a change in the memory allocated for a category,
+ * using the usable size of the blocks rather than the size asked for.
+ */
+static void memCount(enum MemCategory category, size_t freed, size_t allocated) {
+    struct MemStats *s = &stats[category];
+    s->bytes = s->bytes - freed + allocated;
+    if (s->bytes > s->peak) s->peak = s->bytes;
+}
+
+/**
+ * Allocates memory, counting it towards a category.
+ *
+ * @param category the memory is used for
+ * @param size number of bytes
+ * @return the memory, or NULL if it couldn't be allocated
+ */
+void *memAlloc(enum MemCategory category, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr) {
+        stats[category].blocks++;
+        stats[category].allocations++;
+        memCount(category, 0, malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+/**
+ * Reallocates memory which was allocated for a category (or allocates it if ptr is NULL).
+ *
+ * @param category the memory is used for
+ * @param ptr memory to reallocate, or NULL
+ * @param size number of bytes
+ * @return the memory, or NULL if it couldn't be allocated (ptr is left alone)
+ */
+void *memRealloc(enum MemCategory category, void *ptr, size_t size) {
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void *new = realloc(ptr, size);
+    if (new) {
+        if (ptr == NULL) stats[category].blocks++;
+        stats[category].allocations++;
+        memCount(category, old, malloc_usable_size(new));
+    }
+    return new;
+}
+
+/**
+ * Frees memory which was allocated for a category.
+ */
+void memFree(enum MemCategory category, void *ptr) {
+    if (ptr == NULL) return;
+    stats[category].blocks--;
+    memCount(category, malloc_usable_size(ptr), 0);
+    free(ptr);
+}
+
+const struct MemStats *memGetStats(enum MemCategory category) {
+    return &stats[category];
+}
+
+/**
+ * @return number of bytes allocated now, across every category
+ */
+size_t memTotalBytes() {
+    size_t total = 0;
+    for (int i = 0; i < MEM_CATEGORIES; i++) total += stats[i].bytes;
+    return total;
+}
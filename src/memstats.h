@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+
+//What the memory allocated through memAlloc is used for
+enum MemCategory {
+    //chars of each row
+    MEM_TEXT = 0,
+    //render of each row
+    MEM_RENDER,
+    //hl of each row
+    MEM_HIGHLIGHT,
+    //Column index of each row
+    MEM_COLUMNS,
+    //Row table: the arrays indexed by row
+    MEM_ROWS,
+    //Append buffers the frames are built in
+    MEM_OUTPUT,
+    MEM_CATEGORIES
+};
+
+struct MemStats {
+    //Number of bytes allocated now
+    size_t bytes;
+    //Most bytes which have been allocated at once
+    size_t peak;
+    //Number of blocks allocated now
+    size_t blocks;
+    //Number of times memory was allocated or reallocated
+    size_t allocations;
+};
+
+extern const char *memCategoryNames[MEM_CATEGORIES];
+
+void *memAlloc(enum MemCategory category, size_t size);
+
+void *memRealloc(enum MemCategory category, void *ptr, size_t size);
+
+void memFree(enum MemCategory category, void *ptr);
+
+const struct MemStats *memGetStats(enum MemCategory category);
+
+size_t memTotalBytes();
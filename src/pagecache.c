@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pagecache.h"
+
+/**
+ * Starts reading a file through a page cache.
+ *
+ * @param cache to open
+ * @param fd of the file, which is closed when the cache is
+ * @param budget number of bytes which can be used for pages
+ * @return 0 if successful, -1 otherwise
+ */
+int pageCacheOpen(struct PageCache *cache, int fd, size_t budget) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) return -1;
+
+    cache->fd = fd;
+    cache->size = st.st_size;
+    cache->count = (int) (budget / PAGE_CACHE_PAGE_SIZE);
+    if (cache->count < 2) cache->count = 2;
+    cache->clock = 0;
+    cache->pages = calloc((size_t) cache->count, sizeof(struct CachePage));
+    if (cache->pages == NULL) return -1;
+    for (int i = 0; i < cache->count; i++) cache->pages[i].start = -1;
+    return 0;
+}
+
+/**
+ * Gets the bytes of the file starting at the specified offset, reading the page they
+ * are in (and evicting the least recently used page) if it isn't in the cache.
+ *
+ * @param cache to read through
+ * @param offset of the first byte to get
+ * @param avail set to the number of bytes which can be read from the pointer returned
+ * @return pointer to the byte at offset, or NULL at the end of the file or on error
+ */
+const char *pageCacheGet(struct PageCache *cache, off_t offset, size_t *avail) {
+    *avail = 0;
+    if (offset < 0 || offset >= cache->size) return NULL;
+    off_t start = offset - offset % PAGE_CACHE_PAGE_SIZE;
+
+    struct CachePage *page = NULL;
+    struct CachePage *victim = &cache->pages[0];
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->pages[i].start == start) {
+            page = &cache->pages[i];
+            break;
+        }
+        if (cache->pages[i].lastUsed < victim->lastUsed) victim = &cache->pages[i];
+    }
+
+    if (page == NULL) {
+        page = victim;
+        page->start = -1;
+        if (page->data == NULL) page->data = malloc(PAGE_CACHE_PAGE_SIZE);
+        if (page->data == NULL) return NULL;
+
+        ssize_t nread;
+        do {
+            nread = pread(cache->fd, page->data, PAGE_CACHE_PAGE_SIZE, start);
+        } while (nread == -1 && errno == EINTR);
+        if (nread <= 0) return NULL;
+        page->start = start;
+        page->len = (size_t) nread;
+    }
+
+    page->lastUsed = ++cache->clock;
+    if ((size_t) (offset - start) >= page->len) return NULL;
+    *avail = page->len - (size_t) (offset - start);
+    return &page->data[offset - start];
+}
+
+/**
+ * Copies bytes of the file into a buffer.
+ *
+ * @return number of bytes copied, less than len at the end of the file
+ */
+size_t pageCacheRead(struct PageCache *cache, off_t offset, char *buf, size_t len) {
+    size_t copied = 0;
+    while (copied < len) {
+        size_t avail;
+        const char *p = pageCacheGet(cache, offset + (off_t) copied, &avail);
+        if (p == NULL) break;
+        if (avail > len - copied) avail = len - copied;
+        memcpy(&buf[copied], p, avail);
+        copied += avail;
+    }
+    return copied;
+}
+
+/**
+ * Finds the first occurrence of a byte at or after an offset.
+ *
+ * @param cache to search
+ * @param from offset to start searching at
+ * @param limit maximum number of bytes to search
+ * @param c byte to find
+ * @return offset of the byte, or -1 if it wasn't found
+ */
+off_t pageCacheFindByte(struct PageCache *cache, off_t from, off_t limit, char c) {
+    off_t end = from + limit < cache->size ? from + limit : cache->size;
+    while (from < end) {
+        size_t avail;
+        const char *p = pageCacheGet(cache, from, &avail);
+        if (p == NULL) break;
+        if ((off_t) avail > end - from) avail = (size_t) (end - from);
+        const char *match = memchr(p, c, avail);
+        if (match) return from + (match - p);
+        from += (off_t) avail;
+    }
+    return -1;
+}
+
+/**
+ * Finds the last occurrence of a byte before an offset.
+ *
+ * @param cache to search
+ * @param to offset just after the last byte to search
+ * @param limit maximum number of bytes to search
+ * @param c byte to find
+ * @return offset of the byte, or -1 if it wasn't found
+ */
+off_t pageCacheFindByteBack(struct PageCache *cache, off_t to, off_t limit, char c) {
+    off_t begin = to - limit > 0 ? to - limit : 0;
+    while (to > begin) {
+        //Search the part of the page which holds the byte before to
+        off_t start = (to - 1) - (to - 1) % PAGE_CACHE_PAGE_SIZE;
+        if (start < begin) start = begin;
+        size_t avail;
+        const char *p = pageCacheGet(cache, start, &avail);
+        if (p == NULL) break;
+        const char *match = memrchr(p, c, (size_t) (to - start));
+        if (match) return start + (match - p);
+        to = start;
+    }
+    return -1;
+}
+
+/**
+ * Finds the first occurrence of a string at or after an offset.
+ *
+ * @param cache to search
+ * @param from offset to start searching at
+ * @param needle string to find
+ * @param len number of bytes in needle
+ * @return offset of the string, or -1 if it wasn't found
+ */
+off_t pageCacheFind(struct PageCache *cache, off_t from, const char *needle, size_t len) {
+    if (len == 0) return from < cache->size ? from : -1;
+    char *joined = malloc(2 * len);
+    off_t found = -1;
+
+    while (joined && from < cache->size) {
+        size_t avail;
+        const char *p = pageCacheGet(cache, from, &avail);
+        if (p == NULL) break;
+        const char *match = memmem(p, avail, needle, len);
+        if (match) {
+            found = from + (match - p);
+            break;
+        }
+
+        //Matches which start near the end of this page and carry on into the next one
+        off_t next = from + (off_t) avail;
+        size_t keep = len - 1 < avail ? len - 1 : avail;
+        size_t joinedLen = keep + pageCacheRead(cache, next, &joined[keep], len - 1);
+        pageCacheRead(cache, next - (off_t) keep, joined, keep);
+        match = memmem(joined, joinedLen, needle, len);
+        if (match) {
+            found = next - (off_t) keep + (match - joined);
+            break;
+        }
+        from = next;
+    }
+
+    free(joined);
+    return found;
+}
+
+void pageCacheClose(struct PageCache *cache) {
+    for (int i = 0; i < cache->count; i++) free(cache->pages[i].data);
+    free(cache->pages);
+    cache->pages = NULL;
+    cache->count = 0;
+    close(cache->fd);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//Number of bytes read from the file into each page
+#define PAGE_CACHE_PAGE_SIZE (1024 * 1024)
+
+struct CachePage {
+    //Offset of the first byte of the page in the file, or -1 if the page is unused
+    off_t start;
+    size_t len;
+    //Value of the cache's clock when the page was last used
+    unsigned long long lastUsed;
+    char *data;
+};
+
+/*
+ * Reads a file through a fixed number of pages, so files much bigger than memory
+ * can be viewed. When every page is in use the least recently used one is reused.
+ */
+struct PageCache {
+    int fd;
+    off_t size;
+    struct CachePage *pages;
+    int count;
+    unsigned long long clock;
+};
+
+int pageCacheOpen(struct PageCache *cache, int fd, size_t budget);
+
+const char *pageCacheGet(struct PageCache *cache, off_t offset, size_t *avail);
+
+size_t pageCacheRead(struct PageCache *cache, off_t offset, char *buf, size_t len);
+
+off_t pageCacheFindByte(struct PageCache *cache, off_t from, off_t limit, char c);
+
+off_t pageCacheFindByteBack(struct PageCache *cache, off_t to, off_t limit, char c);
+
+off_t pageCacheFind(struct PageCache *cache, off_t from, const char *needle, size_t len);
+
+void pageCacheClose(struct PageCache *cache);
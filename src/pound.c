@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -14,10 +15,29 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 
+#include "pound.h"
 #include "terminal.h"
 #include "row.h"
 #include "append_buffer.h"
+#include "utf8.h"
+#include "wrap.h"
+#include "stream.h"
+#include "follow.h"
+#include "watch.h"
+#include "pagecache.h"
+#include "lineindex.h"
+#include "trace.h"
+#include "memstats.h"
+#include "server.h"
+#include "filter.h"
+#include "bracket.h"
+#include "diff.h"
+#include "hlcache.h"
 
 /*** defines ***/
 
@@ -25,11 +45,33 @@
 #define TAB_STOP 8
 #define QUIT_TIMES 3
 
+//Minimum time between frames, so keys repeating faster than the display share a frame
+#define FRAME_INTERVAL_NS (1000000000LL / 60)
+//Longest a frame is put off while keys keep arriving
+#define FRAME_MAX_DELAY_NS (100 * 1000000LL)
+//How often the background work is checked on while no keys are pressed
+#define IDLE_INTERVAL_MS 100
+
+//Number of bytes of the file the viewer keeps in memory
+#define VIEW_CACHE_SIZE (64 * 1024 * 1024)
+//Number of rows of the file the viewer has in the buffer at once
+#define VIEW_WINDOW_ROWS 2048
+//Number of bytes of the file the viewer has in the buffer at once, however few rows they make
+#define VIEW_WINDOW_SIZE (64 * 1024 * 1024)
+//Lines longer than this are split into several rows by the viewer
+#define VIEW_MAX_LINE (4 * 1024 * 1024)
+
+//Number of pieces of the rows handed to writev at once when saving
+#define SAVE_PIECES 1024
+//Number of unchanged lines shown around each run of changes in a diff
+#define DIFF_CONTEXT 3
+
 #define CTRL_KEY(k) ((k) & 0x1f)
 
 enum editorKey {
     BACKSPACE = 127,
-    ARROW_LEFT = 1000,
+    //Past the last code point, so keys can't clash with typed characters
+    ARROW_LEFT = 0x110000,
     ARROW_RIGHT,
     ARROW_UP,
     ARROW_DOWN,
@@ -48,11 +90,16 @@ enum editorHighlight {
     HL_KEYWORD2,
     HL_STRING,
     HL_NUMBER,
-    HL_MATCH
+    HL_MATCH,
+    HL_ADDED,
+    HL_REMOVED,
+    HL_HUNK
 };
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+//Lines are colored by whether a diff adds or removes them, rather than by what's in them
+#define HL_HIGHLIGHT_DIFF (1<<2)
 
 /*** data ***/
 
@@ -66,24 +113,144 @@ struct EditorSyntax {
     int flags;
 };
 
-struct EditorConfig {
-    int cursorX, cursorY;
-    int rx;
+/*
+ * Run driven by a script of keys rather than the terminal, for benchmarks.
+ */
+struct Headless {
+    char *script;
+    size_t scriptLen;
+    size_t scriptPos;
+    //Time the key being handled was read, or 0 before the first key
+    long long keyStart;
+    //Time taken to handle each key and draw the frame after it, in nanoseconds
+    long long *latency;
+    size_t keys;
+    size_t capacity;
+    size_t frames;
+    size_t bytesEmitted;
+};
+
+/*
+ * A file open in the editor, with everything that's kept while another buffer is being shown.
+ */
+struct EditorBuffer {
+    //cx and rx are offsets into a row, which may be longer than an int can hold
+    int64_t cursorX;
+    int cursorY;
+    int64_t rx;
     int rowOffset;
-    int colOffset;
-    int screenRows;
-    int screenCols;
+    int64_t colOffset;
     int numRows;
+    int rowCapacity;
     struct EditorRow *row;
+    struct EditorRowRender *rrow;
+    bool *rowOpenComment;
+    //Display width of each row
+    int64_t *rowWidth;
+    //How the brackets of each row outside strings and comments change the nesting depth, set by highlighting
+    struct BracketDepth *rowBrackets;
+    struct BracketIndex brackets;
+    //Whether rows are wrapped onto several screen lines instead of scrolling horizontally
+    bool softWrap;
+    struct WrapLayout wrap;
+    //Screen line at the top of the screen when soft wrapping
+    int lineOffset;
+    //Whether rows are still being read from stream
+    bool streaming;
+    struct Stream stream;
+    //Number of bytes taken from the stream so far
+    size_t streamBytes;
+    //Whether rows appended to the file are being added to the end of the buffer
+    bool following;
+    struct Follow follow;
+    //Whether the last row wasn't ended by a newline, so appended text is added onto it
+    bool lastRowOpen;
     int dirty;
     char *filename;
+    //Watch for the file being changed by another process
+    struct FileWatch watch;
+    //Hash of each line of the file as it was when it was last read or written
+    uint64_t *diskHash;
+    int diskLines;
+    //Whether the file is being viewed read-only, with only a window of its lines in the rows
+    bool viewing;
+    struct PageCache cache;
+    struct LineIndex index;
+    //Offset in the file of each row in the window, followed by the offset of the end of the window
+    off_t *viewOffset;
+    //Line number of the first row in the window, or -1 if the index hasn't got that far yet
+    long long viewLine;
+    //Number of lines the index had found when the status bar was last updated
+    long long viewIndexed;
+    //Rows changed while a macro was playing, which are highlighted once it finishes, or -1 if none
+    int deferFrom, deferTo;
+    //Whether the mark is set, and where, the selection running from it to the cursor
+    bool markSet;
+    int64_t markX;
+    int markY;
+    //Buffer whose unsaved changes this buffer shows, so showing them again reuses it, or NULL
+    struct EditorBuffer *diffOf;
+    //Entry of HLDB the rows are highlighted with, which every buffer shares
+    struct EditorSyntax *syntax;
+};
+
+struct EditorConfig {
+    int screenRows;
+    int screenCols;
+    //Every open buffer, in the order they were opened
+    struct EditorBuffer **buffers;
+    int numBuffers;
+    //Index in buffers of the buffer being shown and edited
+    int currentBuffer;
+    struct EditorBuffer *buf;
+    //Frame being drawn, kept between frames so its memory is reused
+    struct AppendBuffer screen;
+    //Whether the terminal supports synchronized output, so frames are drawn all at once
+    bool syncUpdate;
+    //Whether the screen is out of date
+    bool framePending;
+    //Time the last frame was drawn, in nanoseconds
+    long long lastFrame;
+    //Whether keys are read from a script and frames are only measured, rather than using the terminal
+    bool headless;
+    struct Headless headlessRun;
+    //Whether buffers are served to clients attached over a socket, rather than using the terminal
+    bool serving;
+    struct Server server;
+    //Client whose keys are being handled, and whose size and buffer the editor is using
+    struct ServerClient *client;
+    //Lines of the frame which a client doesn't have yet
+    struct AppendBuffer clientFrame;
+    //Client which has a prompt open, the only one whose keys are handled until it's answered
+    struct ServerClient *promptClient;
+    //Whether that client went before answering, so the prompt is cancelled
+    bool promptGone;
+    //Keys recorded for a macro
+    int *macro;
+    int macroLen;
+    int macroCapacity;
+    bool macroRecording;
+    //Whether keys are being read from the macro, and the position of the next one
+    bool macroPlaying;
+    int macroPos;
+    //Lines of the text last copied or cut, which share the chars of the rows selected whole
+    char **clipboard;
+    size_t *clipboardLens;
+    int clipboardLines;
+    //Highlighting of recently lexed rows, which rows with the same render share
+    struct HlCache hlCache;
+    //Whether the status bar shows how long each part of the last frame took
+    bool hud;
+    //Whether the message bar shows how much memory the buffer is using
+    bool memHud;
     char statusMsg[80];
     time_t statusMsgTime;
-    struct EditorSyntax *syntax;
 };
 
 struct EditorConfig config;
 
+static volatile sig_atomic_t windowResized = 0;
+
 /*** filetypes ***/
 
 char *C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
@@ -94,6 +261,8 @@ char *C_HL_keywords[] = {
         "void|", NULL
 };
 
+char *DIFF_HL_extensions[] = {".diff", ".patch", NULL};
+
 struct EditorSyntax HLDB[] = {
         {
                 "c",
@@ -102,36 +271,176 @@ struct EditorSyntax HLDB[] = {
                 "//", "/*", "*/",
                 HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
         },
+        {
+                "diff",
+                DIFF_HL_extensions,
+                NULL,
+                NULL, NULL, NULL,
+                HL_HIGHLIGHT_DIFF
+        },
 };
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
 /*** prototypes ***/
 
-void editorSetStatusMessage(const char *fmt, ...);
-
 void editorRefreshScreen();
 
+void editorHeadlessNextKey();
+
+void editorHeadlessReport();
+
+void editorSwitchBuffer(int index);
+
+void editorServerWait();
+
+void editorServerSendFrame(struct AppendBuffer *frame, size_t linesStart, size_t linesEnd);
+
+void editorServerDetach();
+
+void editorFormatMemory(char *buf, size_t size);
+
+char *editorReadFile(const char *filename, size_t *len);
+
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
 
+char *editorPromptInput(char *prompt, void (*callback)(char *, int), bool allowEmpty);
+
+void editorSyncDisk();
+
+void editorViewLoad(off_t start);
+
+int editorViewFind(char *query);
+
+void editorRenderRowWindow(int at, int64_t rx);
+
+void editorHandleResize();
+
+bool editorIdle();
+
+int editorReadTerminalKey();
+
+void editorRecordKey(int c);
+
+void editorDeferHighlight(int at);
+
+void editorShiftDeferred(int at, int delta);
+
+void editorSpliceRows(int at, int delCount, char **lines, size_t *lens, int insCount, bool owned);
+
+void editorHighlightRange(int from, int to);
+
+bool editorGetSelection(int64_t *fromX, int *fromY, int64_t *toX, int *toY);
+
 /*** terminal ***/
 
+/**
+ * @return time from a monotonic clock, in nanoseconds
+ */
+long long editorNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Marks the screen as out of date, so it's redrawn the next time the editor waits for input.
+ */
+void editorScheduleRefresh() {
+    config.framePending = true;
+}
+
+/**
+ * Reads a byte of input from the terminal, from the script when running headless,
+ * or from the client whose keys are being handled when serving.
+ *
+ * @param c set to the byte read
+ * @return 1 if a byte was read, 0 if none arrived in time, -1 on error
+ */
+int editorReadInput(char *c) {
+    if (config.headless) {
+        if (config.headlessRun.scriptPos == config.headlessRun.scriptLen) return 0;
+        *c = config.headlessRun.script[config.headlessRun.scriptPos++];
+        return 1;
+    }
+    if (config.serving) {
+        if (config.promptGone) {
+            *c = '\x1b';
+            return 1;
+        }
+        return config.client ? serverRead(config.client, c) : 0;
+    }
+    return (int) read(STDIN_FILENO, c, 1);
+}
+
+/**
+ * Waits until there is input to read, drawing the screen if it's out of date in the meantime.
+ *
+ * Frames are drawn at most once every FRAME_INTERVAL_NS, and not while more keys are
+ * already waiting (unless the frame has been put off for FRAME_MAX_DELAY_NS), so keys
+ * arriving faster than the display refreshes are all handled before a single frame.
+ */
+void editorWaitForInput() {
+    traceEnd(TRACE_INPUT);
+    if (config.headless) {
+        editorHeadlessNextKey();
+        return;
+    }
+    if (config.serving) {
+        editorServerWait();
+        return;
+    }
+
+    while (1) {
+        int timeout = IDLE_INTERVAL_MS;
+        if (config.framePending) {
+            long long now = editorNow();
+            long long due = config.lastFrame + FRAME_INTERVAL_NS;
+            if (now >= due) {
+                if (now < due + FRAME_MAX_DELAY_NS && terminalInputPending(0)) return;
+                editorRefreshScreen();
+                continue;
+            }
+            timeout = (int) ((due - now + 999999) / 1000000);
+        }
+
+        if (terminalInputPending(timeout)) return;
+        if (editorIdle()) editorScheduleRefresh();
+    }
+}
+
+/**
+ * Reads a key from the macro while one is playing, or from the terminal otherwise,
+ * recording it if a macro is being recorded.
+ *
+ * @return the key
+ */
 int editorReadKey() {
+    if (config.macroPlaying && config.macroPos < config.macroLen) return config.macro[config.macroPos++];
+    int c = editorReadTerminalKey();
+    if (config.macroRecording) editorRecordKey(c);
+    return c;
+}
+
+int editorReadTerminalKey() {
     int nread;
     char c;
-    while ((nread = (int) read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) die("read");
-    }
+    do {
+        editorWaitForInput();
+        nread = editorReadInput(&c);
+        if (nread == -1 && errno != EAGAIN && errno != EINTR) die("read");
+    } while (nread != 1);
+    traceBegin(TRACE_INPUT);
 
     if (c == '\x1b') {
         char seq[3];
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if (editorReadInput(&seq[0]) != 1) return '\x1b';
+        if (editorReadInput(&seq[1]) != 1) return '\x1b';
 
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                if (editorReadInput(&seq[2]) != 1) return '\x1b';
                 if (seq[2] == '~') {
                     switch (seq[1]) {
                         case '1':
@@ -176,8 +485,19 @@ int editorReadKey() {
         }
 
         return '\x1b';
+    } else if ((unsigned char) c >= 0xc0) {
+        //Read the rest of a UTF-8 sequence, so it's returned as one code point
+        char seq[UTF8_MAX_LEN];
+        int want = (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : 4;
+        int len = 1;
+        seq[0] = c;
+        while (len < want && editorReadInput(&seq[len]) == 1) len++;
+
+        int codepoint;
+        utf8Decode(seq, len, &codepoint);
+        return codepoint;
     } else {
-        return c;
+        return (unsigned char) c;
     }
 }
 
@@ -187,17 +507,77 @@ bool isSeparator(int c) {
     return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-void editorUpdateRowSyntax(struct EditorRow *row) {
-    row->hl = realloc(row->hl, (size_t) row->rsize);
+/**
+ * Gets how a char changes the bracket nesting depth.
+ *
+ * @return 1 for an opening bracket, -1 for a closing bracket, 0 otherwise
+ */
+int editorBracketStep(int c) {
+    switch (c) {
+        case '(':
+        case '[':
+        case '{':
+            return 1;
+        case ')':
+        case ']':
+        case '}':
+            return -1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Sets how the brackets of a row change the nesting depth, updating the bracket index if it changed.
+ * Only a window of a long row is highlighted, so its brackets are left out and only match within the row.
+ */
+void editorSetRowBrackets(int at, struct BracketDepth depth) {
+    if (editorRowIsLong(&config.buf->row[at])) depth = (struct BracketDepth) {0, 0};
+    struct BracketDepth *old = &config.buf->rowBrackets[at];
+    if (old->delta == depth.delta && old->minPrefix == depth.minPrefix) return;
+    *old = depth;
+    bracketUpdate(&config.buf->brackets, at, depth);
+}
+
+/**
+ * Lexes a row into its own hl.
+ *
+ * @param at index of the row
+ * @param inComment whether the row starts inside a multi-line comment
+ * @param depth set to how the brackets of the row change the nesting depth
+ * @return whether the row ends inside a multi-line comment
+ */
+static bool editorLexRow(int at, bool inComment, struct BracketDepth *depth) {
+    struct EditorRowRender *row = &config.buf->rrow[at];
+    editorRowReserveHl(row);
     memset(row->hl, HL_NORMAL, (size_t) row->rsize);
 
-    if (config.syntax == NULL) return;
+    //Brackets are counted in the same pass, those in strings and comments never reaching the end of the loop
+    *depth = (struct BracketDepth) {0, 0};
+
+    bool diff = config.buf->syntax != NULL && (config.buf->syntax->flags & HL_HIGHLIGHT_DIFF);
+    if (config.buf->syntax == NULL || diff) {
+        struct EditorRow *text = &config.buf->row[at];
+        if (diff && text->size > 0) {
+            char first = text->chars[0];
+            if (first == '+') memset(row->hl, HL_ADDED, (size_t) row->rsize);
+            else if (first == '-') memset(row->hl, HL_REMOVED, (size_t) row->rsize);
+            else if (first == '@') memset(row->hl, HL_HUNK, (size_t) row->rsize);
+        }
+        for (int i = 0; i < row->rsize; i++) {
+            int step = editorBracketStep((unsigned char) row->render[i]);
+            if (step == 0) continue;
+            depth->delta += step;
+            if (depth->delta < depth->minPrefix) depth->minPrefix = depth->delta;
+        }
+        return false;
+    }
 
-    char **keywords = config.syntax->keywords;
+    char **keywords = config.buf->syntax->keywords;
 
-    char *scs = config.syntax->singleLineCommentStart;
-    char *mcs = config.syntax->multiLineCommentStart;
-    char *mce = config.syntax->multilineCommentEnd;
+    char *scs = config.buf->syntax->singleLineCommentStart;
+    char *mcs = config.buf->syntax->multiLineCommentStart;
+    char *mce = config.buf->syntax->multilineCommentEnd;
 
     int scsLen = (int) (scs ? strlen(scs) : 0);
     int mcsLen = (int) (mcs ? strlen(mcs) : 0);
@@ -205,11 +585,14 @@ void editorUpdateRowSyntax(struct EditorRow *row) {
 
     bool prevSeperator = 1;
     int inString = 0;
-    bool inComment = (row->idx > 0 && config.row[row->idx - 1].hlOpenComment);
+    //Only a window of a long row is rendered, so the state at the start of the window isn't known
+    bool entryComment = inComment;
+    bool isLong = editorRowIsLong(&config.buf->row[at]);
+    if (isLong && row->rstart > 0) inComment = false;
 
     int i = 0;
     while (i < row->rsize) {
-        char c = row->render[i];
+        unsigned char c = (unsigned char) row->render[i];
         unsigned char prevHl = i > 0 ? row->hl[i - 1] : HL_NORMAL;
 
         if (scsLen && !inString && !inComment) {
@@ -240,7 +623,7 @@ void editorUpdateRowSyntax(struct EditorRow *row) {
             }
         }
 
-        if (config.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+        if (config.buf->syntax->flags & HL_HIGHLIGHT_STRINGS) {
             if (inString) {
                 row->hl[i] = HL_STRING;
                 if (c == '\\' && i + 1 < row->rsize) {
@@ -262,7 +645,7 @@ void editorUpdateRowSyntax(struct EditorRow *row) {
             }
         }
 
-        if (config.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+        if (config.buf->syntax->flags & HL_HIGHLIGHT_NUMBERS) {
             if ((isdigit(c) && (prevSeperator || prevHl == HL_NUMBER)) ||
                 (c == '.' && prevHl == HL_NUMBER)) {
                 row->hl[i] = HL_NUMBER;
@@ -280,7 +663,7 @@ void editorUpdateRowSyntax(struct EditorRow *row) {
                 if (type) kwLen--;
 
                 if (!strncmp(&row->render[i], keywords[kw], (size_t) kwLen) &&
-                    isSeparator(row->render[i + kwLen])) {
+                    isSeparator((unsigned char) row->render[i + kwLen])) {
                     memset(&row->hl[i], type ? HL_KEYWORD2 : HL_KEYWORD1, (size_t) kwLen);
                     i += kwLen;
                     break;
@@ -292,14 +675,128 @@ void editorUpdateRowSyntax(struct EditorRow *row) {
             }
         }
 
+        int step = editorBracketStep(c);
+        if (step != 0) {
+            depth->delta += step;
+            if (depth->delta < depth->minPrefix) depth->minPrefix = depth->delta;
+        }
+
         prevSeperator = isSeparator(c);
         i++;
     }
 
-    int changed = (row->hlOpenComment != inComment);
-    row->hlOpenComment = inComment;
-    if (changed && row->idx + 1 < config.numRows)
-        editorUpdateRowSyntax(&config.row[row->idx + 1]);
+    //Long rows pass on the state they were entered with, rather than scanning the whole row
+    if (isLong) inComment = entryComment;
+    return inComment;
+}
+
+/**
+ * Highlights a single row. Rows with the same render, entered in the same state, share the hl
+ * of the first of them to be lexed while it's in the highlight cache, rather than being lexed again.
+ *
+ * @param at index of the row
+ * @return true if the multi-line comment state the row leaves off with changed,
+ * so the row after it has to be highlighted again too
+ */
+bool editorHighlightRow(int at) {
+    struct EditorRowRender *row = &config.buf->rrow[at];
+    bool entryComment = at > 0 && config.buf->rowOpenComment[at - 1];
+    //Only a window of a long row is rendered, so its highlighting depends on more than its render
+    bool cacheable = !editorRowIsLong(&config.buf->row[at]) && row->rsize <= HL_CACHE_MAX_RENDER;
+
+    struct HlCacheEntry *hit = NULL;
+    uint64_t hash = 0;
+    if (cacheable) {
+        hash = editorLineHash(row->render, (size_t) row->rsize);
+        hit = hlCacheFind(&config.hlCache, hash, row->render, row->rsize, config.buf->syntax, entryComment);
+    }
+
+    struct BracketDepth depth;
+    bool exitComment;
+    if (hit) {
+        editorReleaseRowHl(row->hl);
+        row->hl = editorRetainRowHl(hit->hl);
+        depth = hit->depth;
+        exitComment = hit->exitComment;
+    } else {
+        exitComment = editorLexRow(at, entryComment, &depth);
+        if (cacheable) {
+            struct HlCacheEntry entry = {hash, row->rsize, row->render, config.buf->syntax, entryComment, exitComment,
+                                         depth, row->hl};
+            hlCacheStore(&config.hlCache, &entry);
+        }
+    }
+    editorSetRowBrackets(at, depth);
+
+    bool changed = config.buf->rowOpenComment[at] != exitComment;
+    config.buf->rowOpenComment[at] = exitComment;
+    return changed;
+}
+
+/**
+ * Stops or starts sharing highlighting through the highlight cache. While it's bypassed every row highlighted is lexed.
+ */
+void editorBypassHighlightCache(bool bypass) {
+    config.hlCache.bypass = bypass;
+}
+
+/**
+ * Re-highlights rows after they were changed, and the rows after each of them which they affect.
+ * Each row is highlighted once, however many of the changed rows it's affected by.
+ *
+ * @param rows indexes of the changed rows, in ascending order
+ * @param count number of rows
+ */
+void editorHighlightRows(const int *rows, int count) {
+    traceBegin(TRACE_HIGHLIGHT);
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        //Already highlighted while following on from an earlier row
+        if (rows[i] < next) continue;
+        int at = rows[i];
+        //Iterative rather than recursive, as a comment opened at the top can run to the end of the file
+        while (at < config.buf->numRows && editorHighlightRow(at)) at++;
+        next = at + 1;
+    }
+    traceEnd(TRACE_HIGHLIGHT);
+}
+
+/**
+ * Re-highlights a range of rows, and the rows after it which it affects.
+ *
+ * @param from index of the first row
+ * @param to index of the last row
+ */
+void editorHighlightRange(int from, int to) {
+    traceBegin(TRACE_HIGHLIGHT);
+    for (int at = from; at < config.buf->numRows; at++) {
+        if (!editorHighlightRow(at) && at >= to) break;
+    }
+    traceEnd(TRACE_HIGHLIGHT);
+}
+
+/**
+ * Re-highlights rows after they were changed, and the rows after each of them which they affect.
+ * While a macro is playing this is put off until it has finished.
+ *
+ * @param rows indexes of the changed rows, in ascending order
+ * @param count number of rows
+ */
+void editorUpdateRowsSyntax(const int *rows, int count) {
+    if (config.macroPlaying) {
+        for (int i = 0; i < count; i++) editorDeferHighlight(rows[i]);
+        return;
+    }
+    editorHighlightRows(rows, count);
+}
+
+/**
+ * Re-highlights a row after it was changed, and the rows after it which it affects.
+ *
+ * @param at index of the row
+ */
+void editorUpdateRowSyntax(int at) {
+    editorUpdateRowsSyntax(&at, 1);
 }
 
 int editorSyntaxToColor(int hl) {
@@ -317,27 +814,33 @@ int editorSyntaxToColor(int hl) {
             return 31;
         case HL_MATCH:
             return 34;
+        case HL_ADDED:
+            return 32;
+        case HL_REMOVED:
+            return 31;
+        case HL_HUNK:
+            return 36;
         default:
             return 37;
     }
 }
 
 void editorSelectSyntaxHighlight() {
-    config.syntax = NULL;
-    if (config.filename == NULL) return;
+    config.buf->syntax = NULL;
+    if (config.buf->filename == NULL) return;
 
     for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
         struct EditorSyntax *syntax = &HLDB[j];
         unsigned int i = 0;
         while (syntax->fileMatch[i]) {
-            char *pattern = strstr(config.filename, syntax->fileMatch[i]);
+            char *pattern = strstr(config.buf->filename, syntax->fileMatch[i]);
             if (pattern != NULL) {
                 int patternLen = (int) strlen(syntax->fileMatch[i]);
                 if (syntax->fileMatch[i][0] != '.' || pattern[patternLen] == '\0') {
-                    config.syntax = syntax;
+                    config.buf->syntax = syntax;
 
-                    for (int row = 0; row < config.numRows; row++) {
-                        editorUpdateRowSyntax(&config.row[row]);
+                    for (int row = 0; row < config.buf->numRows; row++) {
+                        editorUpdateRowSyntax(row);
                     }
 
                     return;
@@ -350,115 +853,228 @@ void editorSelectSyntaxHighlight() {
 
 /*** row operations ***/
 
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > config.numRows) return;
+/**
+ * Grows each of the row arrays so they can hold at least the specified number of rows,
+ * doubling the capacity so appending rows one at a time is amortised O(1).
+ *
+ * @param rows to be able to hold
+ */
+void editorReserveRows(int rows) {
+    if (rows <= config.buf->rowCapacity) return;
+
+    int capacity = config.buf->rowCapacity ? config.buf->rowCapacity : 16;
+    while (capacity < rows) capacity *= 2;
+
+    config.buf->row = memRealloc(MEM_ROWS, config.buf->row, sizeof(struct EditorRow) * capacity);
+    config.buf->rrow = memRealloc(MEM_ROWS, config.buf->rrow, sizeof(struct EditorRowRender) * capacity);
+    config.buf->rowOpenComment = memRealloc(MEM_ROWS, config.buf->rowOpenComment, sizeof(bool) * capacity);
+    config.buf->rowWidth = memRealloc(MEM_ROWS, config.buf->rowWidth, sizeof(int64_t) * capacity);
+    config.buf->rowBrackets = memRealloc(MEM_ROWS, config.buf->rowBrackets, sizeof(struct BracketDepth) * capacity);
+    if (config.buf->row == NULL || config.buf->rrow == NULL || config.buf->rowOpenComment == NULL ||
+        config.buf->rowWidth == NULL || config.buf->rowBrackets == NULL)
+        die("realloc");
+    config.buf->rowCapacity = capacity;
+}
 
-    config.row = realloc(config.row, sizeof(struct EditorRow) * (config.numRows + 1));
-    memmove(&config.row[at + 1], &config.row[at], sizeof(struct EditorRow) * (config.numRows - at));
-    for (int j = at + 1; j <= config.numRows; j++) config.row[j].idx++;
+void editorInsertRow(int at, char *s, size_t len) {
+    if (at < 0 || at > config.buf->numRows) return;
+
+    editorReserveRows(config.buf->numRows + 1);
+    int moved = config.buf->numRows - at;
+    memmove(&config.buf->row[at + 1], &config.buf->row[at], sizeof(struct EditorRow) * moved);
+    memmove(&config.buf->rrow[at + 1], &config.buf->rrow[at], sizeof(struct EditorRowRender) * moved);
+    memmove(&config.buf->rowOpenComment[at + 1], &config.buf->rowOpenComment[at], sizeof(bool) * moved);
+    memmove(&config.buf->rowWidth[at + 1], &config.buf->rowWidth[at], sizeof(int64_t) * moved);
+    memmove(&config.buf->rowBrackets[at + 1], &config.buf->rowBrackets[at], sizeof(struct BracketDepth) * moved);
+
+    editorInitRow(&config.buf->row[at], &config.buf->rrow[at], s, len);
+    config.buf->rowOpenComment[at] = false;
+    config.buf->rowWidth[at] = editorRowCxToRx(&config.buf->row[at], config.buf->row[at].size);
+    config.buf->rowBrackets[at] = (struct BracketDepth) {0, 0};
+    wrapSplice(&config.buf->wrap, at, 0, &config.buf->rowWidth[at], 1);
+    bracketSplice(&config.buf->brackets, at, 0, &config.buf->rowBrackets[at], 1);
+
+    config.buf->numRows++;
+    editorShiftDeferred(at, 1);
+    editorUpdateRowSyntax(at);
+    config.buf->dirty++;
+}
 
-    struct EditorRow *row = &config.row[at];
+void editorDelRow(int at) {
+    if (at < 0 || at >= config.buf->numRows) return;
+    editorFreeRow(&config.buf->row[at], &config.buf->rrow[at]);
+    int moved = config.buf->numRows - at - 1;
+    memmove(&config.buf->row[at], &config.buf->row[at + 1], sizeof(struct EditorRow) * moved);
+    memmove(&config.buf->rrow[at], &config.buf->rrow[at + 1], sizeof(struct EditorRowRender) * moved);
+    memmove(&config.buf->rowOpenComment[at], &config.buf->rowOpenComment[at + 1], sizeof(bool) * moved);
+    memmove(&config.buf->rowWidth[at], &config.buf->rowWidth[at + 1], sizeof(int64_t) * moved);
+    memmove(&config.buf->rowBrackets[at], &config.buf->rowBrackets[at + 1], sizeof(struct BracketDepth) * moved);
+    wrapSplice(&config.buf->wrap, at, 1, NULL, 0);
+    bracketSplice(&config.buf->brackets, at, 1, NULL, 0);
+    config.buf->numRows--;
+    editorShiftDeferred(at + 1, -1);
+    config.buf->dirty++;
+}
 
-    row->idx = at;
+/**
+ * Replaces a range of rows with the specified lines, moving the rows after them only once.
+ *
+ * @param at index of the first row to replace
+ * @param delCount number of rows to remove
+ * @param lines text of each row to insert in their place
+ * @param lens number of bytes in each of lines
+ * @param insCount number of rows to insert
+ */
+void editorReplaceRows(int at, int delCount, char **lines, size_t *lens, int insCount) {
+    editorSpliceRows(at, delCount, lines, lens, insCount, false);
+}
 
-    row->size = (int) len;
-    row->chars = malloc(len + 1);
-    memcpy(config.row[at].chars, s, len);
-    row->chars[len] = '\0';
+/**
+ * Replaces a range of rows like editorReplaceRows, but with lines the rows take over rather than copy.
+ *
+ * @param lines text of each row, from editorAllocRowChars or editorRetainRowChars
+ */
+void editorReplaceRowsOwned(int at, int delCount, char **lines, size_t *lens, int insCount) {
+    editorSpliceRows(at, delCount, lines, lens, insCount, true);
+}
 
-    row->rsize = 0;
-    row->render = NULL;
-    row->hl = NULL;
-    row->hlOpenComment = false;
-    editorUpdateRowRender(row);
-    editorUpdateRowSyntax(row);
+void editorSpliceRows(int at, int delCount, char **lines, size_t *lens, int insCount, bool owned) {
+    if (at < 0 || delCount < 0 || at + delCount > config.buf->numRows) return;
+    for (int j = at; j < at + delCount; j++) editorFreeRow(&config.buf->row[j], &config.buf->rrow[j]);
+
+    editorReserveRows(config.buf->numRows - delCount + insCount);
+    int moved = config.buf->numRows - at - delCount;
+    memmove(&config.buf->row[at + insCount], &config.buf->row[at + delCount], sizeof(struct EditorRow) * moved);
+    memmove(&config.buf->rrow[at + insCount], &config.buf->rrow[at + delCount], sizeof(struct EditorRowRender) * moved);
+    memmove(&config.buf->rowOpenComment[at + insCount], &config.buf->rowOpenComment[at + delCount],
+            sizeof(bool) * moved);
+    memmove(&config.buf->rowWidth[at + insCount], &config.buf->rowWidth[at + delCount], sizeof(int64_t) * moved);
+    memmove(&config.buf->rowBrackets[at + insCount], &config.buf->rowBrackets[at + delCount],
+            sizeof(struct BracketDepth) * moved);
+    config.buf->numRows += insCount - delCount;
+    editorShiftDeferred(at + delCount, insCount - delCount);
+
+    for (int j = 0; j < insCount; j++) {
+        if (owned) editorInitRowOwned(&config.buf->row[at + j], &config.buf->rrow[at + j], lines[j], lens[j]);
+        else editorInitRow(&config.buf->row[at + j], &config.buf->rrow[at + j], lines[j], lens[j]);
+        config.buf->rowOpenComment[at + j] = false;
+        config.buf->rowWidth[at + j] = editorRowCxToRx(&config.buf->row[at + j], config.buf->row[at + j].size);
+        config.buf->rowBrackets[at + j] = (struct BracketDepth) {0, 0};
+    }
+    wrapSplice(&config.buf->wrap, at, delCount, &config.buf->rowWidth[at], insCount);
+    bracketSplice(&config.buf->brackets, at, delCount, &config.buf->rowBrackets[at], insCount);
+
+    //The row after the range may now be entered with a different comment state
+    int last = at + insCount < config.buf->numRows ? at + insCount : config.buf->numRows - 1;
+    if (config.macroPlaying) {
+        for (int j = at; j <= last; j++) editorDeferHighlight(j);
+    } else if (last >= at) {
+        editorHighlightRange(at, last);
+    }
+    config.buf->dirty++;
+}
 
-    config.numRows++;
-    config.dirty++;
+/**
+ * Removes every row from the buffer.
+ */
+void editorClearRows() {
+    for (int j = 0; j < config.buf->numRows; j++) editorFreeRow(&config.buf->row[j], &config.buf->rrow[j]);
+    config.buf->numRows = 0;
+    config.buf->lastRowOpen = false;
+    config.buf->deferFrom = config.buf->deferTo = -1;
+    wrapInvalidate(&config.buf->wrap);
+    bracketInvalidate(&config.buf->brackets);
 }
 
-void editorDelRow(int at) {
-    if (at < 0 || at >= config.numRows) return;
-    editorFreeRow(&config.row[at]);
-    memmove(&config.row[at], &config.row[at + 1], sizeof(struct EditorRow) * (config.numRows - at - 1));
-    for (int j = at; j < config.numRows - 1; j++) config.row[j].idx--;
-    config.numRows--;
-    config.dirty++;
+/**
+ * Re-renders and re-highlights a row after its text was changed.
+ *
+ * @param at index of the row
+ */
+void editorUpdateRow(int at) {
+    struct EditorRow *row = &config.buf->row[at];
+    editorUpdateRowRender(row, &config.buf->rrow[at]);
+
+    int64_t width = editorRowCxToRx(row, row->size);
+    wrapUpdate(&config.buf->wrap, at, config.buf->rowWidth[at], width);
+    config.buf->rowWidth[at] = width;
+
+    editorUpdateRowSyntax(at);
 }
 
 /*** editor operations ***/
 
 void editorInsertChar(int c) {
-    if (config.cursorY == config.numRows) {
-        editorInsertRow(config.numRows, "", 0);
+    if (config.buf->cursorY == config.buf->numRows) {
+        editorInsertRow(config.buf->numRows, "", 0);
     }
-    struct EditorRow *row = &config.row[config.cursorY];
+    struct EditorRow *row = &config.buf->row[config.buf->cursorY];
 
-    editorRowInsertChar(row, config.cursorX, c);
-    editorUpdateRowRender(row);
-    editorUpdateRowSyntax(row);
-    config.dirty++;
+    char buf[UTF8_MAX_LEN];
+    int len = utf8Encode(c, buf);
+    editorRowInsertString(row, config.buf->cursorX, buf, (size_t) len);
+    editorUpdateRow(config.buf->cursorY);
+    config.buf->dirty++;
 
-    config.cursorX++;
+    config.buf->cursorX += len;
 }
 
 void editorInsertNewline() {
-    if (config.cursorX == 0) {
-        editorInsertRow(config.cursorY, "", 0);
+    if (config.buf->cursorX == 0) {
+        editorInsertRow(config.buf->cursorY, "", 0);
     } else {
-        struct EditorRow *row = &config.row[config.cursorY];
-        editorInsertRow(config.cursorY + 1, &row->chars[config.cursorX], (size_t) (row->size - config.cursorX));
-        row = &config.row[config.cursorY];
-        row->size = config.cursorX;
-        row->chars[row->size] = '\0';
-        editorUpdateRowRender(row);
-        editorUpdateRowSyntax(row);
+        struct EditorRow *row = &config.buf->row[config.buf->cursorY];
+        editorInsertRow(config.buf->cursorY + 1, &row->chars[config.buf->cursorX],
+                        (size_t) (row->size - config.buf->cursorX));
+        row = &config.buf->row[config.buf->cursorY];
+        editorRowTruncate(row, config.buf->cursorX);
+        editorUpdateRow(config.buf->cursorY);
     }
-    config.cursorY++;
-    config.cursorX = 0;
+    config.buf->cursorY++;
+    config.buf->cursorX = 0;
 }
 
 void editorDelChar() {
-    if (config.cursorY == config.numRows) return;
-    if (config.cursorX == 0 && config.cursorY == 0) return;
-
-    struct EditorRow *row = &config.row[config.cursorY];
-    if (config.cursorX > 0) {
-        if (editorRowDelChar(row, config.cursorX - 1)) {
-            editorUpdateRowRender(row);
-            editorUpdateRowSyntax(row);
-            config.dirty++;
+    if (config.buf->cursorY == config.buf->numRows) return;
+    if (config.buf->cursorX == 0 && config.buf->cursorY == 0) return;
+
+    struct EditorRow *row = &config.buf->row[config.buf->cursorY];
+    if (config.buf->cursorX > 0) {
+        int64_t prev = editorRowPrevChar(row, config.buf->cursorX);
+        if (editorRowDelChar(row, prev)) {
+            editorUpdateRow(config.buf->cursorY);
+            config.buf->dirty++;
         }
 
-        config.cursorX--;
+        config.buf->cursorX = prev;
     } else {
-        struct EditorRow *prevRow = &config.row[config.cursorY - 1];
-        config.cursorX = prevRow->size;
+        struct EditorRow *prevRow = &config.buf->row[config.buf->cursorY - 1];
+        config.buf->cursorX = prevRow->size;
 
         editorRowAppendString(prevRow, row->chars, (size_t) row->size);
-        editorUpdateRowRender(prevRow);
-        editorUpdateRowSyntax(prevRow);
-        config.dirty++;
+        editorUpdateRow(config.buf->cursorY - 1);
+        config.buf->dirty++;
 
-        editorDelRow(config.cursorY);
-        config.cursorY--;
+        editorDelRow(config.buf->cursorY);
+        config.buf->cursorY--;
     }
 }
 
 /*** file i/o ***/
 
-char *editorRowsToString(int *bufLen) {
-    int totLen = 0;
+char *editorRowsToString(size_t *bufLen) {
+    size_t totLen = 0;
     int j;
-    for (j = 0; j < config.numRows; j++)
-        totLen += config.row[j].size + 1;
+    for (j = 0; j < config.buf->numRows; j++)
+        totLen += (size_t) config.buf->row[j].size + 1;
     *bufLen = totLen;
 
-    char *buf = malloc((size_t) totLen);
+    char *buf = malloc(totLen);
+    if (buf == NULL) return NULL;
     char *p = buf;
-    for (j = 0; j < config.numRows; j++) {
-        memcpy(p, config.row[j].chars, (size_t) config.row[j].size);
-        p += config.row[j].size;
+    for (j = 0; j < config.buf->numRows; j++) {
+        memcpy(p, config.buf->row[j].chars, (size_t) config.buf->row[j].size);
+        p += config.buf->row[j].size;
         *p = '\n';
         p++;
     }
@@ -466,248 +1082,2161 @@ char *editorRowsToString(int *bufLen) {
     return buf;
 }
 
-void editorOpen(char *filename) {
-    free(config.filename);
-    config.filename = strdup(filename);
+/*
+ * Position in a range of rows being written out, each followed by a newline.
+ */
+struct RowWriter {
+    //Next row to write, and how many of its chars have been written (its size once only the newline is left)
+    int row;
+    int64_t offset;
+    //Index of the row after the last one to write
+    int end;
+};
+
+static char rowNewline[] = "\n";
+
+/**
+ * Points iov at the rest of the rows, so they can be written straight from their chars.
+ *
+ * @param writer position in the rows
+ * @param iov to fill
+ * @param max number of pieces iov can hold
+ * @return number of pieces filled in, 0 once every row has been written
+ */
+int editorRowPieces(struct RowWriter *writer, struct iovec *iov, int max) {
+    int row = writer->row;
+    int64_t offset = writer->offset;
+    int n = 0;
+    while (n < max && row < writer->end) {
+        struct EditorRow *r = &config.buf->row[row];
+        if (offset < r->size) {
+            iov[n].iov_base = &r->chars[offset];
+            iov[n].iov_len = (size_t) (r->size - offset);
+            offset = r->size;
+        } else {
+            iov[n].iov_base = rowNewline;
+            iov[n].iov_len = 1;
+            row++;
+            offset = 0;
+        }
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Moves on past the specified number of bytes of the rows, which were written.
+ */
+void editorRowsWritten(struct RowWriter *writer, size_t len) {
+    while (len > 0) {
+        size_t left = (size_t) (config.buf->row[writer->row].size - writer->offset) + 1;
+        if (len < left) {
+            writer->offset += (int64_t) len;
+            return;
+        }
+        len -= left;
+        writer->row++;
+        writer->offset = 0;
+    }
+}
+
+/**
+ * Opens the specified file, reading all of it into the buffer
+ * (or starting to stream it in if it isn't a regular file).
+ *
+ * @param filename to open
+ * @return number of bytes read, or -1 if the file couldn't be read
+ */
+off_t editorOpen(char *filename) {
+    free(config.buf->filename);
+    config.buf->filename = strdup(filename);
 
     editorSelectSyntaxHighlight();
 
     FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+    if (!fp) {
+        if (errno == ENOENT) editorSetStatusMessage("New file");
+        else editorSetStatusMessage("Can't open! I/O error: %s", strerror(errno));
+        return -1;
+    }
+
+    //Pipes and devices are read as they are written to, rather than waiting for them to finish
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && !S_ISREG(st.st_mode)) {
+        editorOpenStream(dup(fileno(fp)));
+        fclose(fp);
+        return -1;
+    }
 
     //Below
     char *line = NULL;
     size_t lineCap = 0;
     ssize_t lineLen;
+    off_t bytesRead = 0;
     while ((lineLen = getline(&line, &lineCap, fp)) != -1) {
+        bytesRead += lineLen;
+        config.buf->lastRowOpen = line[lineLen - 1] != '\n';
         while (lineLen > 0 && (line[lineLen - 1] == '\n' ||
                                line[lineLen - 1] == '\r')) {
             lineLen--;
         }
 
-        editorInsertRow(config.numRows, line, (size_t) lineLen);
+        editorInsertRow(config.buf->numRows, line, (size_t) lineLen);
     }
 
     free(line);
     fclose(fp);
-    config.dirty = 0;
+    editorSyncDisk();
+    config.buf->dirty = 0;
+    return bytesRead;
 }
 
-void editorSave() {
-    if (config.filename == NULL) {
-        config.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (config.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-        editorSelectSyntaxHighlight();
+/*** streaming ***/
+
+/**
+ * Starts reading rows from the specified file descriptor in the background,
+ * adding them to the end of the buffer as they arrive.
+ *
+ * @param fd to read from, which is closed when the end is reached
+ */
+void editorOpenStream(int fd) {
+    if (fd == -1 || streamStart(&config.buf->stream, fd) == -1) {
+        editorSetStatusMessage("Can't read stream! I/O error: %s", strerror(errno));
+        if (fd != -1) close(fd);
+        return;
     }
+    config.buf->streaming = true;
+    config.buf->streamBytes = 0;
+}
 
-    int len;
-    char *buf = editorRowsToString(&len);
-
-    int fd = open(config.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, (size_t) len) == len) {
-                close(fd);
-                free(buf);
-                config.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
+/**
+ * Appends text to the end of the buffer, starting a new row after each newline.
+ * If the last row wasn't ended by a newline the text up to the first newline is added onto it.
+ *
+ * @param s text to append
+ * @param len number of bytes in s
+ */
+void editorAppendText(const char *s, size_t len) {
+    const char *end = s + len;
+    while (s < end) {
+        const char *newline = memchr(s, '\n', (size_t) (end - s));
+        size_t lineLen = (size_t) ((newline ? newline : end) - s);
+
+        if (config.buf->lastRowOpen) {
+            int at = config.buf->numRows - 1;
+            editorRowAppendString(&config.buf->row[at], (char *) s, lineLen);
+            struct EditorRow *last = &config.buf->row[at];
+            if (newline && last->size > 0 && last->chars[last->size - 1] == '\r')
+                editorRowTruncate(last, last->size - 1);
+            editorUpdateRow(at);
+        } else {
+            size_t rowLen = lineLen;
+            if (newline && rowLen > 0 && s[rowLen - 1] == '\r') rowLen--;
+            editorInsertRow(config.buf->numRows, (char *) s, rowLen);
         }
-        close(fd);
+
+        config.buf->lastRowOpen = newline == NULL;
+        s += lineLen + (newline ? 1 : 0);
     }
+}
 
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+/**
+ * Adds the rows which have been read from the stream since it was last polled.
+ *
+ * @return true if any rows were added or the stream ended
+ */
+bool editorPollStream() {
+    if (!config.buf->streaming) return false;
+
+    bool done;
+    int error;
+    struct StreamChunk *chunk = streamTake(&config.buf->stream, &done, &error);
+    if (chunk == NULL && !done) return false;
+
+    //Rows from the stream aren't edits
+    int dirty = config.buf->dirty;
+    while (chunk) {
+        editorAppendText(chunk->data, chunk->len);
+        config.buf->streamBytes += chunk->len;
+        struct StreamChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    if (done) {
+        streamStop(&config.buf->stream);
+        config.buf->streaming = false;
+
+        if (error) editorSetStatusMessage("Stream ended early! I/O error: %s", strerror(error));
+        else editorSetStatusMessage("%zu bytes read", config.buf->streamBytes);
+    }
+    config.buf->dirty = dirty;
+    return true;
 }
 
-/*** find ***/
+/*** follow ***/
+
+/**
+ * Keeps adding whatever is appended to the open file to the end of the buffer.
+ *
+ * @param offset number of bytes of the file which have already been read
+ */
+void editorFollow(off_t offset) {
+    if (config.buf->filename == NULL || followStart(&config.buf->follow, config.buf->filename, offset) == -1) {
+        editorSetStatusMessage("Can't follow file! I/O error: %s", strerror(errno));
+        followStop(&config.buf->follow);
+        return;
+    }
+    config.buf->following = true;
+    //The follow watches the file itself, so the watch for other processes' changes would only pile up events
+    watchStop(&config.buf->watch);
+}
 
-void editorFindCallback(char *query, int key) {
-    static int lastMatch = -1;
-    static int direction = 1;
+/**
+ * Adds the rows appended to the followed file since it was last polled,
+ * reading the whole file again if it was truncated or replaced. If that would throw away
+ * unsaved edits, the rows are kept and the file stops being followed instead.
+ *
+ * @return true if the buffer changed
+ */
+bool editorPollFollow() {
+    if (!config.buf->following) return false;
+
+    enum FollowEvent event = followPoll(&config.buf->follow);
+    if (event == FOLLOW_NONE) return false;
+
+    //Keep the cursor on the last row if it was there, like tail -f
+    bool atEnd = config.buf->cursorY >= config.buf->numRows - 1;
+    int dirty = config.buf->dirty;
+
+    if (event == FOLLOW_RESET && dirty) {
+        //Reading the file again would throw away the edits, so they're kept and the file is left alone
+        followStop(&config.buf->follow);
+        config.buf->following = false;
+        editorSetStatusMessage("File was truncated or replaced under unsaved edits, stopped following it");
+        return true;
+    }
+    if (event == FOLLOW_RESET) {
+        editorClearRows();
+        config.buf->cursorX = 0;
+        config.buf->cursorY = 0;
+        atEnd = true;
+        editorSetStatusMessage("File was truncated or replaced, reading it again");
+    }
 
-    static int savedHlLine;
-    static char *savedHl = NULL;
+    char buf[64 * 1024];
+    ssize_t nread;
+    while ((nread = followRead(&config.buf->follow, buf, sizeof(buf))) > 0)
+        editorAppendText(buf, (size_t) nread);
 
-    if (savedHl) {
-        memcpy(config.row[savedHlLine].hl, savedHl, (size_t) config.row[savedHlLine].rsize);
-        free(savedHl);
-        savedHl = NULL;
+    if (atEnd && config.buf->numRows > 0) {
+        config.buf->cursorY = config.buf->numRows - 1;
+        config.buf->cursorX = 0;
     }
+    config.buf->dirty = dirty;
+    return true;
+}
 
-    if (key == '\r' || key == '\x1b') {
-        lastMatch = -1;
-        direction = 1;
-        return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
+/*** reload ***/
+
+/**
+ * Records what the file is like on disk, after the buffer was read from or written to it,
+ * so changes made to it by other processes can be found and merged into the buffer.
+ */
+void editorSyncDisk() {
+    if (config.buf->following) {
+        //Changes are picked up by the follow instead
+        watchStop(&config.buf->watch);
+    } else if (config.buf->watch.path == NULL || strcmp(config.buf->watch.path, config.buf->filename) != 0) {
+        watchStop(&config.buf->watch);
+        watchStart(&config.buf->watch, config.buf->filename);
     } else {
-        lastMatch = -1;
-        direction = 1;
+        watchUpdate(&config.buf->watch);
     }
 
-    if (lastMatch == -1) direction = 1;
-    int current = lastMatch;
-    int i;
-    for (i = 0; i < config.numRows; i++) {
-        current += direction;
-        if (current == -1) current = config.numRows - 1;
-        else if (current == config.numRows) current = 0;
-
-        struct EditorRow *row = &config.row[current];
-        char *match = strstr(row->render, query);
-        if (match) {
-            lastMatch = current;
-            config.cursorY = current;
-            config.cursorX = editorRowRxToCx(row, (int) (match - row->render));
-            config.rowOffset = config.numRows;
+    config.buf->diskHash = realloc(config.buf->diskHash, sizeof(uint64_t) * (size_t) (config.buf->numRows + 1));
+    if (config.buf->diskHash == NULL) die("realloc");
+    for (int j = 0; j < config.buf->numRows; j++)
+        config.buf->diskHash[j] = editorRowHash(&config.buf->row[j]);
+    config.buf->diskLines = config.buf->numRows;
+}
 
-            savedHlLine = current;
-            savedHl = malloc((size_t) row->rsize);
-            memcpy(savedHl, row->hl, (size_t) row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
+/**
+ * Reads the whole of a file into memory.
+ *
+ * @param filename to read
+ * @param len set to the number of bytes read
+ * @return contents of the file, or NULL if it couldn't be read
+ */
+char *editorReadFile(const char *filename, size_t *len) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    size_t capacity = fstat(fd, &st) == 0 && st.st_size > 0 ? (size_t) st.st_size + 1 : 4096;
+    char *buf = malloc(capacity);
+    *len = 0;
+    ssize_t nread;
+    while (buf && (nread = read(fd, &buf[*len], capacity - *len)) != 0) {
+        if (nread == -1) {
+            if (errno == EINTR) continue;
+            free(buf);
+            buf = NULL;
             break;
         }
+        *len += (size_t) nread;
+        if (*len == capacity) {
+            char *grown = realloc(buf, capacity *= 2);
+            if (grown == NULL) free(buf);
+            buf = grown;
+        }
     }
+    //Callers report errno when the file couldn't be read, which closing it mustn't change
+    int error = errno;
+    close(fd);
+    errno = error;
+    return buf;
 }
 
-void editorFind() {
-    int savedCx = config.cursorX;
-    int savedCy = config.cursorY;
-    int savedColOff = config.colOffset;
-    int savedRowOff = config.rowOffset;
+/**
+ * Splits the contents of a file into lines the same way editorOpen does, hashing each of them.
+ *
+ * @param text contents of the file, which the lines point into
+ * @param len number of bytes in text
+ * @param lines set to the start of each line
+ * @param lens set to the length of each line, without its line ending
+ * @param hash set to the hash of each line
+ * @return number of lines
+ */
+int editorSplitLines(char *text, size_t len, char ***lines, size_t **lens, uint64_t **hash) {
+    int count = 0, capacity = 64;
+    *lines = malloc(sizeof(char *) * capacity);
+    *lens = malloc(sizeof(size_t) * capacity);
+    *hash = malloc(sizeof(uint64_t) * capacity);
+    if (*lines == NULL || *lens == NULL || *hash == NULL) die("malloc");
+    for (char *p = text, *end = text + len; p < end;) {
+        char *newline = memchr(p, '\n', (size_t) (end - p));
+        size_t lineLen = (size_t) ((newline ? newline : end) - p);
+        if (count == capacity) {
+            capacity *= 2;
+            *lines = realloc(*lines, sizeof(char *) * capacity);
+            *lens = realloc(*lens, sizeof(size_t) * capacity);
+            *hash = realloc(*hash, sizeof(uint64_t) * capacity);
+            if (*lines == NULL || *lens == NULL || *hash == NULL) die("realloc");
+        }
+        (*lines)[count] = p;
+        (*lens)[count] = lineLen;
+        while ((*lens)[count] > 0 && p[(*lens)[count] - 1] == '\r') (*lens)[count]--;
+        (*hash)[count] = editorLineHash(p, (*lens)[count]);
+        count++;
+        p += lineLen + 1;
+    }
+    return count;
+}
 
-    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)",
-                               editorFindCallback);
+/**
+ * Merges the changes another process made to the file into the buffer. Only the range of
+ * rows which changed on disk is replaced, so the rest keep their highlighting, and unsaved
+ * edits are kept as long as they are in different rows to the changes on disk.
+ */
+void editorReload() {
+    size_t len;
+    char *buf = editorReadFile(config.buf->filename, &len);
+    if (buf == NULL) {
+        watchUpdate(&config.buf->watch);
+        editorSetStatusMessage("File changed on disk, but can't be read! I/O error: %s", strerror(errno));
+        return;
+    }
 
-    if (query) {
-        free(query);
+    char **lines;
+    size_t *lens;
+    uint64_t *hash;
+    int count = editorSplitLines(buf, len, &lines, &lens, &hash);
+
+    //Lines which changed on disk: [prefix, diskLines - suffix) of the old file
+    uint64_t *disk = config.buf->diskHash;
+    int diskLines = config.buf->diskLines;
+    int prefix = 0, suffix = 0;
+    while (prefix < diskLines && prefix < count && disk[prefix] == hash[prefix]) prefix++;
+    while (suffix < diskLines - prefix && suffix < count - prefix &&
+           disk[diskLines - 1 - suffix] == hash[count - 1 - suffix])
+        suffix++;
+
+    //Lines which were edited in the buffer: [editPrefix, diskLines - editSuffix) of the old file
+    int editPrefix = 0, editSuffix = 0;
+    while (editPrefix < diskLines && editPrefix < config.buf->numRows &&
+           disk[editPrefix] == editorRowHash(&config.buf->row[editPrefix]))
+        editPrefix++;
+    while (editSuffix < diskLines - editPrefix && editSuffix < config.buf->numRows - editPrefix) {
+        struct EditorRow *row = &config.buf->row[config.buf->numRows - 1 - editSuffix];
+        if (disk[diskLines - 1 - editSuffix] != editorRowHash(row)) break;
+        editSuffix++;
+    }
+    bool edited = editPrefix < diskLines || editPrefix < config.buf->numRows;
+
+    watchUpdate(&config.buf->watch);
+    int delCount = diskLines - prefix - suffix;
+    int insCount = count - prefix - suffix;
+    if (delCount == 0 && insCount == 0) {
+        //Only touched, or changed back to what is in the buffer
+    } else if (edited && diskLines - suffix >= editPrefix && prefix <= diskLines - editSuffix) {
+        editorSetStatusMessage("File changed on disk under unsaved edits, Ctrl-S overwrites it");
     } else {
-        config.cursorX = savedCx;
-        config.cursorY = savedCy;
-        config.colOffset = savedColOff;
-        config.rowOffset = savedRowOff;
+        //Rows after the edits have moved by the number of rows the edits added
+        int at = edited && prefix > diskLines - editSuffix ? prefix + config.buf->numRows - diskLines : prefix;
+        int dirty = config.buf->dirty;
+        editorReplaceRows(at, delCount, &lines[prefix], &lens[prefix], insCount);
+        config.buf->dirty = dirty;
+
+        if (config.buf->cursorY >= at + delCount) {
+            config.buf->cursorY += insCount - delCount;
+        } else if (config.buf->cursorY >= at && config.buf->cursorY - at >= insCount) {
+            config.buf->cursorY = insCount > 0 ? at + insCount - 1 : at;
+        }
+        if (config.buf->cursorY > config.buf->numRows) config.buf->cursorY = config.buf->numRows;
+        if (config.buf->cursorY < config.buf->numRows) {
+            struct EditorRow *row = &config.buf->row[config.buf->cursorY];
+            if (config.buf->cursorX > row->size) config.buf->cursorX = row->size;
+            config.buf->cursorX = editorRowCharStart(row, config.buf->cursorX);
+        } else {
+            config.buf->cursorX = 0;
+        }
+
+        free(config.buf->diskHash);
+        config.buf->diskHash = hash;
+        config.buf->diskLines = count;
+        hash = NULL;
+        editorSetStatusMessage("Reloaded %d changed lines from disk", insCount);
     }
+
+    free(hash);
+    free(lens);
+    free(lines);
+    free(buf);
 }
 
-/*** output ***/
+/**
+ * Merges the file into the buffer if another process changed it since it was last polled.
+ *
+ * @return true if the file changed
+ */
+bool editorPollDisk() {
+    if (config.buf->streaming || config.buf->following || !watchChanged(&config.buf->watch)) return false;
+    editorReload();
+    return true;
+}
 
-void editorScroll() {
-    config.rx = 0;
-    if (config.cursorY < config.numRows) {
-        config.rx = editorRowCxToRx(&config.row[config.cursorY], config.cursorX);
-    }
+/*** viewer ***/
+
+/**
+ * Finds the start of the line which contains an offset in the file being viewed.
+ *
+ * @param offset in the file
+ * @return offset of the start of the line
+ */
+off_t editorViewLineStart(off_t offset) {
+    if (offset <= 0) return 0;
+    off_t newline = pageCacheFindByteBack(&config.buf->cache, offset, VIEW_MAX_LINE, '\n');
+    if (newline != -1) return newline + 1;
+    return offset > VIEW_MAX_LINE ? offset - VIEW_MAX_LINE : 0;
+}
 
-    if (config.cursorY < config.rowOffset) {
-        config.rowOffset = config.cursorY;
-    }
-    if (config.cursorY >= config.rowOffset + config.screenRows) {
-        config.rowOffset = config.cursorY - config.screenRows + 1;
-    }
-    if (config.rx < config.colOffset) {
-        config.colOffset = config.rx;
-    }
-    if (config.rx >= config.colOffset + config.screenCols) {
-        config.colOffset = config.rx - config.screenCols + 1;
+/**
+ * Works out the line number of the first row in the window, if the index has got that far.
+ */
+void editorViewUpdateLine() {
+    if (config.buf->viewLine != -1) return;
+
+    off_t start = config.buf->viewOffset[0];
+    off_t offset;
+    long long line;
+    if (!lineIndexCheckpoint(&config.buf->index, start, &offset, &line)) return;
+    while (offset < start) {
+        size_t avail;
+        const char *p = pageCacheGet(&config.buf->cache, offset, &avail);
+        if (p == NULL) break;
+        if ((off_t) avail > start - offset) avail = (size_t) (start - offset);
+        line += (long long) lineIndexCountNewlines(p, avail);
+        offset += (off_t) avail;
     }
+    config.buf->viewLine = line;
 }
 
-void editorDrawRows(struct AppendBuffer *ab) {
-    int y;
-    for (y = 0; y < config.screenRows; y++) {
-        int fileRow = y + config.rowOffset;
-        if (fileRow >= config.numRows) {
-            if (config.numRows == 0 && y == config.screenRows / 3) {
-                char welcome[80];
-                int welcomeLen = snprintf(welcome, sizeof(welcome),
-                                          "Pound editor -- version %s", POUND_VERSION);
-                if (welcomeLen > config.screenCols) welcomeLen = config.screenCols;
-                int padding = (config.screenCols - welcomeLen) / 2;
-                if (padding) {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while (padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomeLen);
-            } else {
-                abAppend(ab, "~", 1);
-            }
-        } else {
-            int len = config.row[fileRow].rsize - config.colOffset;
-            if (len < 0) len = 0;
-            if (len > config.screenCols) len = config.screenCols;
-            char *c = &config.row[fileRow].render[config.colOffset];
-            unsigned char *hl = &config.row[fileRow].hl[config.colOffset];
-            int currentColor = -1;
-
-            for (int i = 0; i < len; i++) {
-                if (iscntrl(c[i])) {
-                    char sym = (char) ((c[i] <= 26) ? '@' + c[i] : '?');
-                    abAppend(ab, INVERT_COLOR_CMD);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, RESET_RENDITION_CMD);
-                    if (currentColor != -1) {
-                        char cmdBuf[16];
-                        int cmdLen = getSetColorCmd(cmdBuf, currentColor);
-                        abAppend(ab, cmdBuf, cmdLen);
-                    }
-                } else if (hl[i] == HL_NORMAL) {
-                    if (currentColor != -1) {
-                        abAppend(ab, RESET_COLOR_CMD);
-                        currentColor = -1;
-                    }
-                    abAppend(ab, &c[i], 1);
-                } else {
-                    int color = editorSyntaxToColor(hl[i]);
-                    if (color != currentColor) {
-                        currentColor = color;
-                        char cmdBuf[16];
-                        int cmdLen = getSetColorCmd(cmdBuf, color);
-                        abAppend(ab, cmdBuf, cmdLen);
-                    }
-                    abAppend(ab, &c[i], 1);
-                }
-            }
+/**
+ * Replaces the rows with the window of the file which starts at an offset. Rows stop being added once
+ * there are VIEW_WINDOW_ROWS of them or VIEW_WINDOW_SIZE bytes have been read, so the window never
+ * holds more than VIEW_WINDOW_SIZE + VIEW_MAX_LINE bytes of the file, however long its lines are.
+ *
+ * @param start offset of the first line in the window
+ */
+void editorViewLoad(off_t start) {
+    editorClearRows();
+    config.buf->viewOffset = realloc(config.buf->viewOffset, sizeof(off_t) * (VIEW_WINDOW_ROWS + 1));
+    if (config.buf->viewOffset == NULL) die("realloc");
 
-            abAppend(ab, RESET_COLOR_CMD);
+    char *line = NULL;
+    size_t lineCap = 0;
+    off_t offset = start;
+    while (config.buf->numRows < VIEW_WINDOW_ROWS && offset - start < VIEW_WINDOW_SIZE &&
+           offset < config.buf->cache.size) {
+        off_t newline = pageCacheFindByte(&config.buf->cache, offset, VIEW_MAX_LINE, '\n');
+        off_t end = newline != -1 ? newline :
+                    (offset + VIEW_MAX_LINE < config.buf->cache.size ? offset + VIEW_MAX_LINE : config.buf->cache.size);
+
+        size_t len = (size_t) (end - offset);
+        if (len + 1 > lineCap) {
+            lineCap = len + 1;
+            line = realloc(line, lineCap);
+            if (line == NULL) die("realloc");
         }
+        len = pageCacheRead(&config.buf->cache, offset, line, len);
+        while (len > 0 && line[len - 1] == '\r') len--;
 
-        abAppend(ab, ERASE_PAST_CURSOR_CMD);
-        abAppend(ab, "\r\n", 2);
+        config.buf->viewOffset[config.buf->numRows] = offset;
+        editorInsertRow(config.buf->numRows, line, len);
+        offset = newline != -1 ? newline + 1 : end;
     }
+    config.buf->viewOffset[config.buf->numRows] = offset;
+    free(line);
+
+    config.buf->dirty = 0;
+    config.buf->lineOffset = INT_MAX;
+    config.buf->viewLine = -1;
+    editorViewUpdateLine();
 }
 
-void editorDrawStatusBar(struct AppendBuffer *ab) {
-    abAppend(ab, INVERT_COLOR_CMD);
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       config.filename ? config.filename : "[No Name]", config.numRows,
-                       config.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-                        config.syntax ? config.syntax->filetype : "no ft", config.cursorY + 1, config.numRows);
-    if (len > config.screenCols) len = config.screenCols;
-    abAppend(ab, status, len);
-    while (len < config.screenCols) {
-        if (config.screenCols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-        } else {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+/**
+ * Loads the window so that the line at an offset is in the middle of it.
+ *
+ * @param line offset of the start of the line
+ * @return index of the line's row in the new window
+ */
+int editorViewLoadAround(off_t line) {
+    off_t start = line;
+    for (int i = 0; i < VIEW_WINDOW_ROWS / 2 && line - start < VIEW_WINDOW_SIZE / 2 && start > 0; i++)
+        start = editorViewLineStart(start - 1);
+    editorViewLoad(start);
+
+    int lo = 0, hi = config.buf->numRows;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (config.buf->viewOffset[mid] <= line) lo = mid;
+        else hi = mid - 1;
     }
-    abAppend(ab, RESET_RENDITION_CMD);
-    abAppend(ab, "\r\n", 2);
+    return lo;
+}
+
+/**
+ * Stops the line index of a buffer being viewed and closes its file, leaving its rows as they are.
+ */
+void editorViewClose(struct EditorBuffer *buf) {
+    lineIndexStop(&buf->index);
+    pageCacheClose(&buf->cache);
+    buf->viewing = false;
+}
+
+/**
+ * Stops the line index thread of every buffer being viewed. Registered with atexit,
+ * so the threads aren't still reading the files while the process exits.
+ */
+void editorViewCloseAll() {
+    for (int i = 0; i < config.numBuffers; i++) {
+        if (config.buffers[i]->viewing) editorViewClose(config.buffers[i]);
+    }
+}
+
+/**
+ * Opens a file to be viewed read-only. Only a window of its lines is kept in the rows,
+ * read through a fixed size page cache, so files bigger than memory can be viewed.
+ *
+ * @param filename to view
+ */
+void editorView(char *filename) {
+    if (config.buf->viewing) editorViewClose(config.buf);
+    free(config.buf->filename);
+    config.buf->filename = strdup(filename);
+    editorSelectSyntaxHighlight();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1 || pageCacheOpen(&config.buf->cache, fd, VIEW_CACHE_SIZE) == -1) {
+        editorSetStatusMessage("Can't open! I/O error: %s", strerror(errno));
+        if (fd != -1) close(fd);
+        return;
+    }
+
+    //The index reads the file on its own descriptor, so it doesn't evict the pages being viewed
+    int indexFd = open(filename, O_RDONLY);
+    if (indexFd == -1 || lineIndexStart(&config.buf->index, indexFd) == -1) {
+        editorSetStatusMessage("Can't index! I/O error: %s", strerror(errno));
+        if (indexFd != -1) close(indexFd);
+        pageCacheClose(&config.buf->cache);
+        return;
+    }
+
+    config.buf->viewing = true;
+    editorViewLoad(0);
+}
+
+/**
+ * Moves the window when the cursor gets near one of its ends, keeping the cursor
+ * on the same line and the same line of the screen.
+ */
+void editorViewScroll() {
+    bool nearStart = config.buf->cursorY < config.screenRows && config.buf->viewOffset[0] > 0;
+    bool nearEnd = config.buf->cursorY + config.screenRows >= config.buf->numRows &&
+                   config.buf->viewOffset[config.buf->numRows] < config.buf->cache.size;
+    if (!nearStart && !nearEnd) return;
+
+    int screenY = config.buf->cursorY - config.buf->rowOffset;
+    config.buf->cursorY = editorViewLoadAround(config.buf->viewOffset[config.buf->cursorY]);
+    config.buf->rowOffset = config.buf->cursorY - screenY > 0 ? config.buf->cursorY - screenY : 0;
+    if (config.buf->cursorY < config.buf->numRows && config.buf->cursorX > config.buf->row[config.buf->cursorY].size)
+        config.buf->cursorX = config.buf->row[config.buf->cursorY].size;
+}
+
+/**
+ * Searches the file after the window for a string, wrapping around to the start of the file,
+ * and loads the window around the match.
+ *
+ * @param query to find
+ * @return index of the row with the match in the new window, or -1 if there are no other matches
+ */
+int editorViewFind(char *query) {
+    size_t len = strlen(query);
+    off_t match = pageCacheFind(&config.buf->cache, config.buf->viewOffset[config.buf->numRows], query, len);
+    if (match == -1) match = pageCacheFind(&config.buf->cache, 0, query, len);
+    if (match == -1) return -1;
+    if (match >= config.buf->viewOffset[0] && match < config.buf->viewOffset[config.buf->numRows]) return -1;
+    return editorViewLoadAround(editorViewLineStart(match));
+}
+
+/**
+ * Formats the number of lines in the file being viewed. Until the whole file has been
+ * indexed it is estimated from the number of lines in the part which has been.
+ */
+void editorViewLineCount(char *buf, size_t size) {
+    long long lines;
+    off_t scanned;
+    bool done;
+    lineIndexProgress(&config.buf->index, &lines, &scanned, &done);
+
+    if (done) {
+        size_t avail;
+        const char *last = pageCacheGet(&config.buf->cache, config.buf->cache.size - 1, &avail);
+        if (last && *last != '\n') lines++;
+        snprintf(buf, size, "%lld", lines);
+    } else if (scanned > 0) {
+        snprintf(buf, size, "~%lld", (long long) ((double) lines * (double) config.buf->cache.size / (double) scanned));
+    } else {
+        snprintf(buf, size, "?");
+    }
+}
+
+/**
+ * Moves the window to a line of the file being viewed: the nearest indexed line is
+ * looked up directly, then at most LINE_INDEX_STRIDE lines are scanned from it.
+ *
+ * @param line number of the line, counting from 0
+ * @return false if the index hasn't got to the line yet
+ */
+bool editorViewGotoLine(long long line) {
+    off_t offset;
+    long long at;
+    if (!lineIndexFind(&config.buf->index, line, &offset, &at)) return false;
+    for (; at < line; at++) {
+        off_t newline = pageCacheFindByte(&config.buf->cache, offset, config.buf->cache.size - offset, '\n');
+        if (newline == -1) break;
+        offset = newline + 1;
+    }
+    if (offset == config.buf->cache.size && offset > 0) offset = editorViewLineStart(offset - 1);
+
+    config.buf->cursorY = editorViewLoadAround(offset);
+    config.buf->cursorX = 0;
+    return true;
+}
+
+/**
+ * Handles the keys which act differently in the viewer, as its rows can't be edited.
+ *
+ * @param c key pressed
+ * @return true if the key was handled
+ */
+bool editorViewProcessKeypress(int c) {
+    switch (c) {
+        case 'g':
+            editorViewLoad(0);
+            config.buf->cursorX = 0;
+            config.buf->cursorY = 0;
+            config.buf->rowOffset = 0;
+            return true;
+
+        case 'G':
+            editorViewLoadAround(editorViewLineStart(config.buf->cache.size - 1));
+            config.buf->cursorX = 0;
+            config.buf->cursorY = config.buf->numRows > 0 ? config.buf->numRows - 1 : 0;
+            config.buf->rowOffset = 0;
+            return true;
+
+        //Keys which don't change the rows are handled as usual, anything else is refused
+        case ARROW_LEFT:
+        case ARROW_RIGHT:
+        case ARROW_UP:
+        case ARROW_DOWN:
+        case HOME_KEY:
+        case END_KEY:
+        case PAGE_UP:
+        case PAGE_DOWN:
+        case CTRL_KEY('q'):
+        case CTRL_KEY('f'):
+        case CTRL_KEY('g'):
+        case CTRL_KEY(']'):
+        case CTRL_KEY('o'):
+        case CTRL_KEY('n'):
+        case CTRL_KEY('p'):
+        case CTRL_KEY('w'):
+        case CTRL_KEY('t'):
+        case CTRL_KEY('e'):
+        case CTRL_KEY('k'):
+        case CTRL_KEY('y'):
+        case CTRL_KEY('l'):
+        case '\x1b':
+            return false;
+
+        default:
+            editorSetStatusMessage("File is open read-only");
+            return true;
+    }
+}
+
+/**
+ * Picks up how far the line index has got.
+ *
+ * @return true if the status bar needs to be redrawn
+ */
+bool editorPollView() {
+    if (!config.buf->viewing) return false;
+
+    long long lines;
+    off_t scanned;
+    bool done;
+    lineIndexProgress(&config.buf->index, &lines, &scanned, &done);
+    if (lines == config.buf->viewIndexed) return false;
+    config.buf->viewIndexed = lines;
+    editorViewUpdateLine();
+    return true;
+}
+
+/**
+ * Does the background work which is waiting while no keys are being pressed.
+ *
+ * @return true if the screen needs to be redrawn
+ */
+bool editorIdle() {
+    bool changed = false;
+    if (windowResized) {
+        editorHandleResize();
+        changed = true;
+    }
+
+    //Buffers in the background keep taking in what's streamed, appended or changed on disk
+    struct EditorBuffer *shown = config.buf;
+    for (int i = 0; i < config.numBuffers; i++) {
+        config.buf = config.buffers[i];
+        bool polled = false;
+        if (editorPollStream()) polled = true;
+        if (editorPollFollow()) polled = true;
+        if (editorPollDisk()) polled = true;
+        if (editorPollView()) polled = true;
+        if (polled && config.buf == shown) changed = true;
+    }
+    config.buf = shown;
+    return changed;
+}
+
+/**
+ * Writes every row to a file straight from their chars, rather than copying the
+ * whole buffer into one string first, which would double the memory a large file takes.
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int editorWriteRows(int fd) {
+    struct RowWriter writer = {0, 0, config.buf->numRows};
+    struct iovec iov[SAVE_PIECES];
+    int n;
+    while ((n = editorRowPieces(&writer, iov, SAVE_PIECES)) > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        editorRowsWritten(&writer, (size_t) written);
+    }
+    return 0;
+}
+
+void editorSave() {
+    if (config.buf->filename == NULL) {
+        config.buf->filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (config.buf->filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    size_t len = 0;
+    for (int j = 0; j < config.buf->numRows; j++) len += (size_t) config.buf->row[j].size + 1;
+
+    int fd = open(config.buf->filename, O_RDWR | O_CREAT, 0644);
+    if (fd != -1) {
+        if (ftruncate(fd, (off_t) len) != -1 && editorWriteRows(fd) != -1) {
+            close(fd);
+            editorSyncDisk();
+            config.buf->dirty = 0;
+            editorSetStatusMessage("%zu bytes written to disk", len);
+            return;
+        }
+        close(fd);
+    }
+
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
+/*** find ***/
+
+void editorFindCallback(char *query, int key) {
+    static int lastMatch = -1;
+    static int direction = 1;
+
+    static int savedHlLine;
+    static int savedHlLen;
+    static char *savedHl = NULL;
+
+    if (savedHl) {
+        if (savedHlLine < config.buf->numRows && config.buf->rrow[savedHlLine].rsize == savedHlLen) {
+            editorRowUnshareHl(&config.buf->rrow[savedHlLine]);
+            memcpy(config.buf->rrow[savedHlLine].hl, savedHl, (size_t) savedHlLen);
+        }
+        free(savedHl);
+        savedHl = NULL;
+    }
+
+    if (key == '\r' || key == '\x1b') {
+        lastMatch = -1;
+        direction = 1;
+        return;
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        direction = 1;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        direction = -1;
+    } else {
+        lastMatch = -1;
+        direction = 1;
+    }
+
+    if (lastMatch == -1) direction = 1;
+    int current = lastMatch;
+    int i;
+    for (i = 0; i < config.buf->numRows; i++) {
+        current += direction;
+        if (current == -1) current = config.buf->numRows - 1;
+        else if (current == config.buf->numRows) current = 0;
+
+        struct EditorRowRender *row = &config.buf->rrow[current];
+        int hlStart;
+        if (editorRowIsLong(&config.buf->row[current])) {
+            //Only a window of a long row is rendered, so search its chars and render around the match
+            char *match = strstr(config.buf->row[current].chars, query);
+            if (!match) continue;
+            config.buf->cursorX = match - config.buf->row[current].chars;
+            int64_t matchRx = editorRowCxToRx(&config.buf->row[current], config.buf->cursorX);
+            editorRenderRowWindow(current, matchRx);
+
+            int pad;
+            hlStart = utf8ColumnOffset(row->render, row->rsize, (int) (matchRx - row->rstart), &pad);
+        } else {
+            char *match = strstr(row->render, query);
+            if (!match) continue;
+            hlStart = (int) (match - row->render);
+            config.buf->cursorX = editorRowRxToCx(&config.buf->row[current], utf8StringWidth(row->render, hlStart));
+        }
+
+        lastMatch = current;
+        config.buf->cursorY = current;
+        config.buf->rowOffset = config.buf->numRows;
+        config.buf->lineOffset = INT_MAX;
+
+        int hlLen = (int) strlen(query);
+        if (hlLen > row->rsize - hlStart) hlLen = row->rsize - hlStart;
+        if (hlLen < 0) hlLen = 0;
+
+        savedHlLine = current;
+        savedHlLen = row->rsize;
+        savedHl = malloc((size_t) row->rsize);
+        memcpy(savedHl, row->hl, (size_t) row->rsize);
+        //The hl may be shared with other rows with the same render
+        editorRowUnshareHl(row);
+        memset(&row->hl[hlStart], HL_MATCH, (size_t) hlLen);
+        break;
+    }
+
+    //The viewer only has a window of the file in its rows, so carry on through the rest of the file
+    if (i == config.buf->numRows && config.buf->viewing && direction == 1) {
+        int at = editorViewFind(query);
+        if (at != -1) {
+            lastMatch = at - 1;
+            editorFindCallback(query, ARROW_DOWN);
+        }
+    }
+}
+
+void editorFind() {
+    int64_t savedCx = config.buf->cursorX;
+    int savedCy = config.buf->cursorY;
+    int64_t savedColOff = config.buf->colOffset;
+    int savedRowOff = config.buf->rowOffset;
+    int savedLineOff = config.buf->lineOffset;
+    off_t savedView = config.buf->viewing ? config.buf->viewOffset[0] : 0;
+
+    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)",
+                               editorFindCallback);
+
+    if (query) {
+        free(query);
+    } else {
+        if (config.buf->viewing && config.buf->viewOffset[0] != savedView) editorViewLoad(savedView);
+        config.buf->cursorX = savedCx;
+        config.buf->cursorY = savedCy;
+        config.buf->colOffset = savedColOff;
+        config.buf->rowOffset = savedRowOff;
+        config.buf->lineOffset = savedLineOff;
+    }
+}
+
+/*** replace ***/
+
+/**
+ * Replaces every occurrence of a string in the buffer in one pass: each row is rebuilt
+ * and re-rendered at most once, and highlighting is only redone for the changed rows
+ * (and the rows they affect) once they've all been replaced, or once the macro replacing them has finished.
+ *
+ * @param query string to look for
+ * @param replacement string to put in its place
+ * @return number of occurrences replaced
+ */
+long long editorReplaceAll(const char *query, const char *replacement) {
+    size_t queryLen = strlen(query), replacementLen = strlen(replacement);
+    if (queryLen == 0) return 0;
+
+    long long count = 0;
+    int *changed = NULL;
+    int numChanged = 0, capacity = 0;
+    for (int j = 0; j < config.buf->numRows; j++) {
+        struct EditorRow *row = &config.buf->row[j];
+        long long n = editorRowReplaceAll(row, query, queryLen, replacement, replacementLen);
+        if (n == 0) continue;
+        count += n;
+
+        editorUpdateRowRender(row, &config.buf->rrow[j]);
+        config.buf->rowWidth[j] = editorRowCxToRx(row, row->size);
+        if (numChanged == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            changed = realloc(changed, sizeof(int) * (size_t) capacity);
+            if (changed == NULL) die("realloc");
+        }
+        changed[numChanged++] = j;
+    }
+    if (count == 0) return 0;
+
+    //The wrap layout is rebuilt from the row widths once, rather than updated for each row
+    wrapInvalidate(&config.buf->wrap);
+    editorUpdateRowsSyntax(changed, numChanged);
+    free(changed);
+    config.buf->dirty++;
+
+    //The cursor may have been left past the end of its row, or in the middle of a char
+    if (config.buf->cursorY < config.buf->numRows) {
+        struct EditorRow *row = &config.buf->row[config.buf->cursorY];
+        if (config.buf->cursorX > row->size) config.buf->cursorX = row->size;
+        config.buf->cursorX = editorRowCharStart(row, config.buf->cursorX);
+    }
+    return count;
+}
+
+void editorPromptReplace() {
+    if (config.buf->viewing) {
+        editorSetStatusMessage("File is open read-only");
+        return;
+    }
+
+    char *query = editorPrompt("Replace: %s (ESC to cancel)", NULL);
+    if (query == NULL) return;
+    //Replacing with nothing deletes every occurrence
+    char *replacement = editorPromptInput("Replace with: %s (ESC to cancel)", NULL, true);
+    if (replacement == NULL) {
+        free(query);
+        return;
+    }
+
+    long long count = editorReplaceAll(query, replacement);
+    editorSetStatusMessage("Replaced %lld occurrence%s", count, count == 1 ? "" : "s");
+    free(query);
+    free(replacement);
+}
+
+/*** brackets ***/
+
+/**
+ * Gets how the char at the specified position of a rendered row changes the bracket
+ * nesting depth, brackets in strings and comments not counting.
+ */
+static int editorRenderBracketStep(struct EditorRowRender *rrow, int i) {
+    unsigned char hl = rrow->hl[i];
+    if (hl == HL_STRING || hl == HL_COMMENT || hl == HL_MLCOMMENT) return 0;
+    return editorBracketStep((unsigned char) rrow->render[i]);
+}
+
+/**
+ * Scans a rendered row forwards until the depth drops to 0.
+ *
+ * @param depth number of brackets open at from, updated as the row is read
+ * @return position in the render of the bracket closing them, or -1 if it isn't in the row
+ */
+static int editorScanClose(struct EditorRowRender *rrow, int from, int *depth) {
+    for (int i = from; i < rrow->rsize; i++) {
+        int step = editorRenderBracketStep(rrow, i);
+        if (step == 0) continue;
+        *depth += step;
+        if (*depth == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Scans a rendered row backwards until the depth read backwards rises to 0.
+ *
+ * @param depth number of closing brackets to be matched after from, updated as the row is read
+ * @return position in the render of the bracket opening them, or -1 if it isn't in the row
+ */
+static int editorScanOpen(struct EditorRowRender *rrow, int from, int *depth) {
+    for (int i = from; i >= 0; i--) {
+        int step = editorRenderBracketStep(rrow, i);
+        if (step == 0) continue;
+        *depth -= step;
+        if (*depth == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Finds the bracket matching the one at the specified position. Within the row it's scanned for,
+ * and any other row is found in O(log n) with the bracket index before that row is scanned.
+ *
+ * @param at index of the row
+ * @param cx of the bracket
+ * @param matchY set to the row of the matching bracket
+ * @param matchX set to the cx of the matching bracket
+ * @return true if there's a bracket at the position and it has a match of the same kind
+ */
+bool editorFindMatchingBracket(int at, int64_t cx, int *matchY, int64_t *matchX) {
+    if (at >= config.buf->numRows || cx >= config.buf->row[at].size) return false;
+    struct EditorRow *row = &config.buf->row[at];
+    int64_t rx = editorRowCxToRx(row, cx);
+    editorRenderRowWindow(at, rx);
+    struct EditorRowRender *rrow = &config.buf->rrow[at];
+    int pad;
+    int start = utf8ColumnOffset(rrow->render, rrow->rsize, (int) (rx - rrow->rstart), &pad);
+    if (start >= rrow->rsize) return false;
+    int step = editorRenderBracketStep(rrow, start);
+    if (step == 0) return false;
+
+    int y = at;
+    int depth = 0;
+    int found = step > 0 ? editorScanClose(rrow, start, &depth) : editorScanOpen(rrow, start, &depth);
+    if (found == -1) {
+        //Long rows are left out of the index, so their brackets only match within the rendered window
+        if (editorRowIsLong(row)) return false;
+        if (!config.buf->brackets.valid || config.buf->brackets.tree.numRows != config.buf->numRows)
+            bracketBuild(&config.buf->brackets, config.buf->rowBrackets, config.buf->numRows);
+
+        if (step > 0) {
+            y = bracketFindClose(&config.buf->brackets, at + 1, depth, &depth);
+            if (y == -1) return false;
+            found = editorScanClose(&config.buf->rrow[y], 0, &depth);
+        } else {
+            y = bracketFindOpen(&config.buf->brackets, at - 1, depth, &depth);
+            if (y == -1) return false;
+            found = editorScanOpen(&config.buf->rrow[y], config.buf->rrow[y].rsize - 1, &depth);
+        }
+        if (found == -1) return false;
+    }
+
+    struct EditorRowRender *match = &config.buf->rrow[y];
+    char open = step > 0 ? rrow->render[start] : match->render[found];
+    char close = step > 0 ? match->render[found] : rrow->render[start];
+    if (!((open == '(' && close == ')') || (open == '[' && close == ']') || (open == '{' && close == '}')))
+        return false;
+
+    *matchY = y;
+    *matchX = editorRowRxToCx(&config.buf->row[y], match->rstart + utf8StringWidth(match->render, found));
+    return true;
+}
+
+/**
+ * Moves the cursor to the bracket matching the one it's on.
+ */
+void editorJumpToBracket() {
+    int y;
+    int64_t x;
+    if (!editorFindMatchingBracket(config.buf->cursorY, config.buf->cursorX, &y, &x)) {
+        editorSetStatusMessage("No matching bracket");
+        return;
+    }
+    config.buf->cursorY = y;
+    config.buf->cursorX = x;
+}
+
+/*** clipboard ***/
+
+/**
+ * Sets the mark where the cursor is, selecting the text from it to wherever the cursor moves.
+ */
+void editorSetMark() {
+    config.buf->markSet = true;
+    config.buf->markX = config.buf->cursorX;
+    config.buf->markY = config.buf->cursorY;
+    editorSetStatusMessage("Mark set");
+}
+
+/**
+ * Gets the ends of the selection in the order they appear in the buffer. The mark isn't moved
+ * by edits, so it's kept within the rows which are there now.
+ *
+ * @return false if the mark isn't set
+ */
+bool editorGetSelection(int64_t *fromX, int *fromY, int64_t *toX, int *toY) {
+    if (!config.buf->markSet) return false;
+
+    int markY = config.buf->markY < config.buf->numRows ? config.buf->markY : config.buf->numRows;
+    int64_t markX = 0;
+    if (markY < config.buf->numRows) {
+        struct EditorRow *row = &config.buf->row[markY];
+        markX = config.buf->markX < row->size ? editorRowCharStart(row, config.buf->markX) : row->size;
+    }
+
+    if (markY < config.buf->cursorY || (markY == config.buf->cursorY && markX <= config.buf->cursorX)) {
+        *fromX = markX;
+        *fromY = markY;
+        *toX = config.buf->cursorX;
+        *toY = config.buf->cursorY;
+    } else {
+        *fromX = config.buf->cursorX;
+        *fromY = config.buf->cursorY;
+        *toX = markX;
+        *toY = markY;
+    }
+
+    //Past the last row the selection takes in the newline ending it, unless the start of the row is kept,
+    //as every row is saved with a newline
+    if (*toY == config.buf->numRows && *fromX > 0) {
+        *toY = config.buf->numRows - 1;
+        *toX = config.buf->row[*toY].size;
+    }
+    return true;
+}
+
+/**
+ * Gets the chars of a row from one cx up to another, sharing the row's chars if that's all of them.
+ *
+ * @param at index of the row, or the number of rows for the empty line after the last one
+ */
+static char *editorSliceRow(int at, int64_t from, int64_t to) {
+    if (at == config.buf->numRows) return editorAllocRowChars(0);
+    struct EditorRow *row = &config.buf->row[at];
+    if (from == 0 && to == row->size) return editorRetainRowChars(row->chars);
+
+    char *chars = editorAllocRowChars((size_t) (to - from));
+    memcpy(chars, &row->chars[from], (size_t) (to - from));
+    return chars;
+}
+
+/**
+ * Joins two pieces of text into the chars of a row. If one of them is empty and the other is
+ * the whole of some chars, those chars are shared rather than copied.
+ *
+ * @param aWhole whether a is the whole of some row's (or clipboard line's) chars
+ * @param bWhole whether b is the whole of some row's (or clipboard line's) chars
+ */
+static char *editorJoinChars(char *a, size_t aLen, bool aWhole, char *b, size_t bLen, bool bWhole) {
+    if (bLen == 0 && aWhole) return editorRetainRowChars(a);
+    if (aLen == 0 && bWhole) return editorRetainRowChars(b);
+
+    char *chars = editorAllocRowChars(aLen + bLen);
+    memcpy(chars, a, aLen);
+    memcpy(&chars[aLen], b, bLen);
+    return chars;
+}
+
+void editorClearClipboard() {
+    for (int j = 0; j < config.clipboardLines; j++) editorReleaseRowChars(config.clipboard[j]);
+    free(config.clipboard);
+    free(config.clipboardLens);
+    config.clipboard = NULL;
+    config.clipboardLens = NULL;
+    config.clipboardLines = 0;
+}
+
+/**
+ * Deletes the text between two positions, joining what's left of the first and last rows into one.
+ */
+void editorDeleteRange(int64_t fromX, int fromY, int64_t toX, int toY) {
+    int last = toY < config.buf->numRows ? toY : config.buf->numRows - 1;
+    if (fromY > last || (fromY == toY && fromX == toX)) return;
+
+    struct EditorRow *first = &config.buf->row[fromY];
+    char *joined = NULL;
+    size_t len = 0;
+    if (toY < config.buf->numRows) {
+        struct EditorRow *end = &config.buf->row[toY];
+        len = (size_t) (fromX + end->size - toX);
+        joined = editorJoinChars(first->chars, (size_t) fromX, fromX == first->size,
+                                 &end->chars[toX], (size_t) (end->size - toX), toX == 0);
+    } else if (fromX > 0) {
+        //The selection runs to the end of the buffer, so only the start of the first row is left
+        len = (size_t) fromX;
+        joined = editorSliceRow(fromY, 0, fromX);
+    }
+    editorReplaceRowsOwned(fromY, last - fromY + 1, &joined, &len, joined ? 1 : 0);
+
+    config.buf->cursorX = fromX;
+    config.buf->cursorY = fromY;
+}
+
+/**
+ * Copies the selection to the clipboard. Lines which are selected whole share the chars of
+ * their rows rather than being copied, so copying a large range takes a pointer per line.
+ *
+ * @param cut whether to delete the selection as well
+ */
+void editorCopySelection(bool cut) {
+    int64_t fromX, toX;
+    int fromY, toY;
+    if (!editorGetSelection(&fromX, &fromY, &toX, &toY)) {
+        editorSetStatusMessage("No selection, Ctrl-B sets the mark");
+        return;
+    }
+
+    editorClearClipboard();
+    int lines = toY - fromY + 1;
+    config.clipboard = malloc(sizeof(char *) * (size_t) lines);
+    config.clipboardLens = malloc(sizeof(size_t) * (size_t) lines);
+    if (config.clipboard == NULL || config.clipboardLens == NULL) die("malloc");
+    for (int j = 0; j < lines; j++) {
+        int at = fromY + j;
+        int64_t from = j == 0 ? fromX : 0;
+        int64_t to = at == toY ? toX : config.buf->row[at].size;
+        config.clipboard[j] = editorSliceRow(at, from, to);
+        config.clipboardLens[j] = (size_t) (to - from);
+    }
+    config.clipboardLines = lines;
+
+    config.buf->markSet = false;
+    if (cut) editorDeleteRange(fromX, fromY, toX, toY);
+    //The empty line after the last newline doesn't count
+    int shown = config.clipboardLens[lines - 1] > 0 ? lines : lines - 1;
+    editorSetStatusMessage("%s %d lines", cut ? "Cut" : "Copied", shown);
+}
+
+/**
+ * Inserts the clipboard at the cursor. Rows for the lines in the middle share the clipboard's
+ * chars, and every row is inserted and highlighted in one go.
+ */
+void editorPaste() {
+    if (config.clipboardLines == 0) {
+        editorSetStatusMessage("Nothing to paste, Ctrl-C copies the selection");
+        return;
+    }
+
+    int at = config.buf->cursorY;
+    int64_t cx = config.buf->cursorX;
+    int lines = config.clipboardLines;
+    char **clip = config.clipboard;
+    size_t *lens = config.clipboardLens;
+    //Past the last row there's no text around the cursor, and no row to replace
+    bool atEnd = at == config.buf->numRows;
+    struct EditorRow *row = atEnd ? NULL : &config.buf->row[at];
+
+    if (lines == 1) {
+        if (lens[0] == 0) return;
+        if (atEnd) {
+            char *chars = editorRetainRowChars(clip[0]);
+            editorReplaceRowsOwned(at, 0, &chars, &lens[0], 1);
+        } else {
+            editorRowInsertString(row, cx, clip[0], lens[0]);
+            editorUpdateRow(at);
+            config.buf->dirty++;
+        }
+        config.buf->cursorX = cx + (int64_t) lens[0];
+        config.buf->markSet = false;
+        return;
+    }
+
+    char **texts = malloc(sizeof(char *) * (size_t) lines);
+    size_t *textLens = malloc(sizeof(size_t) * (size_t) lines);
+    if (texts == NULL || textLens == NULL) die("malloc");
+
+    //The first line goes after what's before the cursor, and the last before what's after it
+    size_t before = atEnd ? 0 : (size_t) cx;
+    size_t after = atEnd ? 0 : (size_t) (row->size - cx);
+    texts[0] = atEnd ? editorRetainRowChars(clip[0])
+                     : editorJoinChars(row->chars, before, cx == row->size, clip[0], lens[0], true);
+    textLens[0] = before + lens[0];
+    for (int j = 1; j < lines - 1; j++) {
+        texts[j] = editorRetainRowChars(clip[j]);
+        textLens[j] = lens[j];
+    }
+    int count = lines;
+    if (atEnd && lens[lines - 1] == 0) {
+        //It would be the empty line after the last newline, which isn't a row
+        count--;
+    } else {
+        texts[lines - 1] = atEnd ? editorRetainRowChars(clip[lines - 1])
+                                 : editorJoinChars(clip[lines - 1], lens[lines - 1], true,
+                                                   &row->chars[cx], after, cx == 0);
+        textLens[lines - 1] = lens[lines - 1] + after;
+    }
+    editorReplaceRowsOwned(at, atEnd ? 0 : 1, texts, textLens, count);
+    free(texts);
+    free(textLens);
+
+    config.buf->cursorY = at + lines - 1;
+    config.buf->cursorX = (int64_t) lens[lines - 1];
+    config.buf->markSet = false;
+    editorSetStatusMessage("Pasted %d lines", lens[lines - 1] > 0 ? lines : lines - 1);
+}
+
+/*** macros ***/
+
+void editorRecordKey(int c) {
+    if (config.macroLen == config.macroCapacity) {
+        config.macroCapacity = config.macroCapacity ? config.macroCapacity * 2 : 64;
+        config.macro = realloc(config.macro, sizeof(int) * (size_t) config.macroCapacity);
+        if (config.macro == NULL) die("realloc");
+    }
+    config.macro[config.macroLen++] = c;
+}
+
+/**
+ * Starts recording the keys pressed into a new macro, or stops recording it.
+ */
+void editorToggleRecording() {
+    if (config.macroRecording) {
+        config.macroRecording = false;
+        //Leave out the key which stopped the recording
+        config.macroLen--;
+        editorSetStatusMessage("Recorded macro of %d keys", config.macroLen);
+    } else {
+        config.macroRecording = true;
+        config.macroLen = 0;
+        editorSetStatusMessage("Recording macro, Ctrl-K to stop");
+    }
+}
+
+/**
+ * Notes that a row has to be highlighted once the macro which changed it has finished.
+ * Its highlighting is cleared in the meantime, so it still covers the whole render
+ * if a frame is drawn to show how far the macro has got.
+ *
+ * @param at index of the row
+ */
+void editorDeferHighlight(int at) {
+    struct EditorRowRender *rrow = &config.buf->rrow[at];
+    editorRowReserveHl(rrow);
+    memset(rrow->hl, HL_NORMAL, (size_t) rrow->rsize);
+
+    if (config.buf->deferFrom == -1 || at < config.buf->deferFrom) config.buf->deferFrom = at;
+    if (at > config.buf->deferTo) config.buf->deferTo = at;
+}
+
+/**
+ * Keeps the range of rows waiting to be highlighted in place when rows are inserted or deleted.
+ *
+ * @param at index of the first row which moved
+ * @param delta number of rows it moved by
+ */
+void editorShiftDeferred(int at, int delta) {
+    if (config.buf->deferFrom == -1) return;
+    if (config.buf->deferFrom >= at) config.buf->deferFrom += delta;
+    if (config.buf->deferTo >= at) config.buf->deferTo += delta;
+}
+
+/**
+ * Highlights the rows every buffer put off highlighting while a macro was playing.
+ */
+void editorFlushDeferred() {
+    struct EditorBuffer *shown = config.buf;
+    for (int i = 0; i < config.numBuffers; i++) {
+        config.buf = config.buffers[i];
+        if (config.buf->deferFrom == -1) continue;
+        int to = config.buf->deferTo < config.buf->numRows ? config.buf->deferTo : config.buf->numRows - 1;
+        editorHighlightRange(config.buf->deferFrom, to);
+        config.buf->deferFrom = config.buf->deferTo = -1;
+    }
+    config.buf = shown;
+}
+
+/**
+ * Plays the macro back without drawing between keys, and highlights the rows it changed once at the end.
+ * A frame is only drawn every FRAME_MAX_DELAY_NS, to show how far it has got.
+ *
+ * @param times number of times to play it, or -1 to play it until the cursor reaches the end of the
+ * file (or stops moving down)
+ */
+void editorPlayMacro(int times) {
+    config.macroPlaying = true;
+    int played = 0;
+    while (times == -1 || played < times) {
+        int startY = config.buf->cursorY;
+        if (times == -1 && startY >= config.buf->numRows) break;
+
+        config.macroPos = 0;
+        while (config.macroPos < config.macroLen) editorProcessKeypress();
+        played++;
+        if (times == -1 && config.buf->cursorY <= startY) break;
+
+        if (editorNow() - config.lastFrame >= FRAME_MAX_DELAY_NS) {
+            if (times == -1) {
+                editorSetStatusMessage("Playing macro: %d times, line %d/%d", played,
+                                       config.buf->cursorY + 1, config.buf->numRows);
+            } else {
+                editorSetStatusMessage("Playing macro: %d/%d", played, times);
+            }
+            editorRefreshScreen();
+        }
+    }
+    config.macroPlaying = false;
+    editorFlushDeferred();
+    editorSetStatusMessage("Played macro %d time%s", played, played == 1 ? "" : "s");
+}
+
+void editorPromptPlayMacro() {
+    if (config.macroRecording) {
+        editorSetStatusMessage("Can't play a macro while recording one");
+        return;
+    }
+    if (config.macroLen == 0) {
+        editorSetStatusMessage("No macro recorded, Ctrl-K to record one");
+        return;
+    }
+
+    char *input = editorPromptInput("Play macro how many times: %s (Enter = to end of file, ESC to cancel)",
+                                    NULL, true);
+    if (input == NULL) return;
+    int times = input[0] ? atoi(input) : -1;
+    free(input);
+    if (times == 0) return;
+    editorPlayMacro(times);
+}
+
+/*** filter ***/
+
+/*
+ * Rows being written to a command, and the lines it has written back.
+ */
+struct FilterRows {
+    struct RowWriter rows;
+    char **lines;
+    size_t *lens;
+    int count;
+    int capacity;
+    //Output after the last newline
+    char *partial;
+    size_t partialLen;
+    size_t partialCapacity;
+};
+
+static int editorFilterPieces(void *ctx, struct iovec *iov, int max) {
+    struct FilterRows *f = ctx;
+    return editorRowPieces(&f->rows, iov, max);
+}
+
+static void editorFilterConsumed(void *ctx, size_t len) {
+    struct FilterRows *f = ctx;
+    editorRowsWritten(&f->rows, len);
+}
+
+static void editorFilterAddLine(struct FilterRows *f, const char *s, size_t len) {
+    if (len > 0 && s[len - 1] == '\r') len--;
+    if (f->count == f->capacity) {
+        f->capacity = f->capacity ? f->capacity * 2 : 1024;
+        f->lines = realloc(f->lines, sizeof(char *) * (size_t) f->capacity);
+        f->lens = realloc(f->lens, sizeof(size_t) * (size_t) f->capacity);
+        if (f->lines == NULL || f->lens == NULL) die("realloc");
+    }
+    //Allocated as the row's chars, so the row takes it over rather than copying it again
+    char *line = editorAllocRowChars(len);
+    if (line == NULL) die("malloc");
+    memcpy(line, s, len);
+    f->lines[f->count] = line;
+    f->lens[f->count] = len;
+    f->count++;
+}
+
+static void editorFilterOutput(void *ctx, const char *data, size_t len) {
+    struct FilterRows *f = ctx;
+    const char *end = data + len;
+    while (data < end) {
+        const char *newline = memchr(data, '\n', (size_t) (end - data));
+        size_t lineLen = (size_t) ((newline ? newline : end) - data);
+
+        if (newline && f->partialLen == 0) {
+            editorFilterAddLine(f, data, lineLen);
+        } else {
+            if (f->partialLen + lineLen > f->partialCapacity) {
+                f->partialCapacity = (f->partialLen + lineLen) * 2;
+                f->partial = realloc(f->partial, f->partialCapacity);
+                if (f->partial == NULL) die("realloc");
+            }
+            memcpy(&f->partial[f->partialLen], data, lineLen);
+            f->partialLen += lineLen;
+            if (newline) {
+                editorFilterAddLine(f, f->partial, f->partialLen);
+                f->partialLen = 0;
+            }
+        }
+        data += lineLen + (newline ? 1 : 0);
+    }
+}
+
+/**
+ * Replaces a range of rows with the output of a shell command they're written to.
+ * The rows are written straight from their chars and the output is split into rows as it
+ * arrives, so the text is never gathered into one string in either direction.
+ * The rows are left alone if the command fails.
+ *
+ * @param at index of the first row
+ * @param count number of rows
+ * @param command to run with /bin/sh
+ */
+void editorFilterRows(int at, int count, const char *command) {
+    struct FilterRows f = {.rows = {at, 0, at + count}};
+    struct FilterIo io = {editorFilterPieces, editorFilterConsumed, editorFilterOutput, &f};
+    char error[128];
+    int status = filterRun(command, &io, error, sizeof(error));
+    if (f.partialLen > 0) editorFilterAddLine(&f, f.partial, f.partialLen);
+    free(f.partial);
+
+    if (status != 0) {
+        for (int j = 0; j < f.count; j++) editorReleaseRowChars(f.lines[j]);
+        error[strcspn(error, "\n")] = '\0';
+        if (status == -1) editorSetStatusMessage("Can't run command: %s", strerror(errno));
+        else editorSetStatusMessage("Command failed (%d): %s", status, error);
+    } else {
+        editorReplaceRowsOwned(at, count, f.lines, f.lens, f.count);
+        editorSetStatusMessage("Filtered %d lines into %d", count, f.count);
+
+        if (config.buf->cursorY > config.buf->numRows) config.buf->cursorY = config.buf->numRows;
+        if (config.buf->cursorY < config.buf->numRows) {
+            struct EditorRow *row = &config.buf->row[config.buf->cursorY];
+            if (config.buf->cursorX > row->size) config.buf->cursorX = row->size;
+            config.buf->cursorX = editorRowCharStart(row, config.buf->cursorX);
+        } else {
+            config.buf->cursorX = 0;
+        }
+    }
+    free(f.lines);
+    free(f.lens);
+}
+
+/**
+ * Asks for a command to filter the buffer through, optionally after a range of lines
+ * like "10,20 sort", otherwise the whole buffer is filtered.
+ */
+void editorPromptFilter() {
+    if (config.buf->viewing) {
+        editorSetStatusMessage("File is open read-only");
+        return;
+    }
+
+    char *input = editorPrompt("Filter through: %s ([FROM,TO] COMMAND, ESC to cancel)", NULL);
+    if (input == NULL) return;
+
+    int from = 1, to = config.buf->numRows, n = 0;
+    char *command = input;
+    if (sscanf(input, "%d,%d %n", &from, &to, &n) == 2 && n > 0) command = &input[n];
+    if (from < 1 || to > config.buf->numRows || from > to + 1) {
+        editorSetStatusMessage("Invalid range: %d,%d", from, to);
+    } else if (command[0] == '\0') {
+        editorSetStatusMessage("No command given");
+    } else {
+        editorFilterRows(from - 1, to - from + 1, command);
+    }
+    free(input);
+}
+
+/*** goto line ***/
+
+/**
+ * Prompts for a line number and moves the cursor to the start of that line.
+ */
+void editorGotoLine() {
+    char *input = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+    if (input == NULL) return;
+
+    char *end;
+    long long line = strtoll(input, &end, 10) - 1;
+    bool valid = end != input && *end == '\0' && line >= 0;
+    free(input);
+    if (!valid) {
+        editorSetStatusMessage("Not a line number");
+        return;
+    }
+
+    if (config.buf->viewing) {
+        if (!editorViewGotoLine(line)) editorSetStatusMessage("Line %lld hasn't been indexed yet", line + 1);
+    } else {
+        config.buf->cursorY = line < config.buf->numRows ? (int) line : config.buf->numRows;
+        config.buf->cursorX = 0;
+    }
+    config.buf->lineOffset = INT_MAX;
+}
+
+/*** buffers ***/
+
+/**
+ * Opens a new, empty buffer and switches to it.
+ */
+void editorNewBuffer() {
+    struct EditorBuffer *buf = malloc(sizeof(struct EditorBuffer));
+    if (buf == NULL) die("malloc");
+    buf->cursorX = 0;
+    buf->cursorY = 0;
+    buf->rx = 0;
+    buf->rowOffset = 0;
+    buf->colOffset = 0;
+    buf->numRows = 0;
+    buf->rowCapacity = 0;
+    buf->row = NULL;
+    buf->rrow = NULL;
+    buf->rowOpenComment = NULL;
+    buf->rowWidth = NULL;
+    buf->rowBrackets = NULL;
+    buf->softWrap = false;
+    wrapInit(&buf->wrap);
+    bracketInit(&buf->brackets);
+    buf->lineOffset = 0;
+    buf->streaming = false;
+    buf->streamBytes = 0;
+    buf->following = false;
+    buf->lastRowOpen = false;
+    buf->dirty = 0;
+    buf->filename = NULL;
+    buf->watch.path = NULL;
+    buf->diskHash = NULL;
+    buf->diskLines = 0;
+    buf->viewing = false;
+    buf->viewOffset = NULL;
+    buf->viewIndexed = -1;
+    buf->deferFrom = -1;
+    buf->deferTo = -1;
+    buf->markSet = false;
+    buf->diffOf = NULL;
+    buf->syntax = NULL;
+
+    config.buffers = realloc(config.buffers, sizeof(struct EditorBuffer *) * (size_t) (config.numBuffers + 1));
+    if (config.buffers == NULL) die("realloc");
+    config.buffers[config.numBuffers++] = buf;
+    editorSwitchBuffer(config.numBuffers - 1);
+}
+
+/**
+ * Shows another buffer. Its rows keep their render and highlighting,
+ * so all switching costs is drawing the next frame.
+ *
+ * @param index of the buffer, in the order the buffers were opened
+ */
+void editorSwitchBuffer(int index) {
+    config.currentBuffer = index;
+    config.buf = config.buffers[index];
+    editorScheduleRefresh();
+}
+
+/**
+ * Moves through the open buffers, wrapping around at either end.
+ *
+ * @param step 1 for the next buffer, -1 for the previous one
+ */
+void editorCycleBuffer(int step) {
+    if (config.numBuffers == 1) {
+        editorSetStatusMessage("No other buffers");
+        return;
+    }
+    editorSwitchBuffer((config.currentBuffer + step + config.numBuffers) % config.numBuffers);
+    editorSetStatusMessage("Buffer %d/%d: %s", config.currentBuffer + 1, config.numBuffers,
+                           config.buf->filename ? config.buf->filename : "[No Name]");
+}
+
+/**
+ * Asks for a file and opens it in a new buffer, or switches to it if it's already open.
+ */
+void editorPromptOpen() {
+    char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (filename == NULL) return;
+
+    for (int i = 0; i < config.numBuffers; i++) {
+        if (config.buffers[i]->filename && strcmp(config.buffers[i]->filename, filename) == 0) {
+            editorSwitchBuffer(i);
+            free(filename);
+            return;
+        }
+    }
+
+    editorNewBuffer();
+    editorOpen(filename);
+    free(filename);
+}
+
+/**
+ * @return number of buffers with unsaved changes
+ */
+int editorDirtyBuffers() {
+    int dirty = 0;
+    for (int i = 0; i < config.numBuffers; i++) {
+        if (config.buffers[i]->dirty) dirty++;
+    }
+    return dirty;
+}
+
+/*** diff ***/
+
+/*
+ * Lines of a diff being built, each allocated as the chars of a row.
+ */
+struct DiffLines {
+    char **lines;
+    size_t *lens;
+    int count;
+    int capacity;
+};
+
+static void editorDiffAddLine(struct DiffLines *out, const char *prefix, const char *s, size_t len) {
+    if (out->count == out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 256;
+        out->lines = realloc(out->lines, sizeof(char *) * (size_t) out->capacity);
+        out->lens = realloc(out->lens, sizeof(size_t) * (size_t) out->capacity);
+        if (out->lines == NULL || out->lens == NULL) die("realloc");
+    }
+    size_t prefixLen = strlen(prefix);
+    char *line = editorAllocRowChars(prefixLen + len);
+    if (line == NULL) die("malloc");
+    memcpy(line, prefix, prefixLen);
+    memcpy(&line[prefixLen], s, len);
+    out->lines[out->count] = line;
+    out->lens[out->count] = prefixLen + len;
+    out->count++;
+}
+
+/**
+ * Writes the changes as a unified diff, with DIFF_CONTEXT unchanged lines around each run of changes.
+ * Changes whose context would touch are put in the same hunk.
+ *
+ * @param out lines to add the diff to
+ * @param script changes from the lines on disk to the rows
+ * @param lines lines of the file on disk
+ * @param lens length of each line
+ * @param count number of lines
+ * @param source buffer holding the rows
+ */
+static void editorDiffHunks(struct DiffLines *out, struct DiffScript *script, char **lines, size_t *lens, int count,
+                            struct EditorBuffer *source) {
+    struct DiffChange *changes = script->changes;
+    for (int i = 0; i < script->count;) {
+        int k = i;
+        while (k + 1 < script->count &&
+               changes[k + 1].oldFrom - (changes[k].oldFrom + changes[k].oldCount) <= 2 * DIFF_CONTEXT)
+            k++;
+
+        struct DiffChange *first = &changes[i], *last = &changes[k];
+        int oldStart = first->oldFrom > DIFF_CONTEXT ? first->oldFrom - DIFF_CONTEXT : 0;
+        int oldEnd = last->oldFrom + last->oldCount + DIFF_CONTEXT;
+        if (oldEnd > count) oldEnd = count;
+        int newStart = first->newFrom - (first->oldFrom - oldStart);
+        int newEnd = last->newFrom + last->newCount + (oldEnd - last->oldFrom - last->oldCount);
+
+        //An empty range is numbered by the line before it
+        char header[80];
+        int headerLen = snprintf(header, sizeof(header), "@@ -%d,%d +%d,%d @@",
+                                 oldEnd > oldStart ? oldStart + 1 : oldStart, oldEnd - oldStart,
+                                 newEnd > newStart ? newStart + 1 : newStart, newEnd - newStart);
+        editorDiffAddLine(out, "", header, (size_t) headerLen);
+
+        int at = oldStart;
+        for (int j = i; j <= k; j++) {
+            struct DiffChange *change = &changes[j];
+            for (; at < change->oldFrom; at++) editorDiffAddLine(out, " ", lines[at], lens[at]);
+            for (; at < change->oldFrom + change->oldCount; at++) editorDiffAddLine(out, "-", lines[at], lens[at]);
+            for (int y = change->newFrom; y < change->newFrom + change->newCount; y++)
+                editorDiffAddLine(out, "+", source->row[y].chars, (size_t) source->row[y].size);
+        }
+        for (; at < oldEnd; at++) editorDiffAddLine(out, " ", lines[at], lens[at]);
+        i = k + 1;
+    }
+}
+
+/**
+ * Shows the changes made to the buffer since it was saved, as a unified diff of the file on disk
+ * against the rows in a buffer of its own. The rows are compared by their hashes, which are kept
+ * with their chars, so only rows changed since the last diff (or save) are hashed again.
+ * Showing the changes to a buffer again, or from its diff, updates the same diff buffer.
+ */
+void editorShowDiff() {
+    struct EditorBuffer *source = config.buf->diffOf ? config.buf->diffOf : config.buf;
+    if (source->viewing || source->streaming) {
+        editorSetStatusMessage("File is open read-only");
+        return;
+    }
+    if (source->filename == NULL) {
+        editorSetStatusMessage("Buffer has no file to diff against");
+        return;
+    }
+
+    size_t len = 0;
+    char *text = editorReadFile(source->filename, &len);
+    //A file which isn't on disk yet is diffed as empty
+    if (text == NULL && errno != ENOENT) {
+        editorSetStatusMessage("Can't read %s! I/O error: %s", source->filename, strerror(errno));
+        return;
+    }
+    char **lines;
+    size_t *lens;
+    uint64_t *hash;
+    int count = editorSplitLines(text, len, &lines, &lens, &hash);
+
+    uint64_t *rowHash = malloc(sizeof(uint64_t) * (size_t) (source->numRows + 1));
+    if (rowHash == NULL) die("malloc");
+    for (int j = 0; j < source->numRows; j++) rowHash[j] = editorRowHash(&source->row[j]);
+
+    struct DiffScript script;
+    if (!diffLines(hash, count, rowHash, source->numRows, &script)) die("malloc");
+    int added = 0, removed = 0;
+    for (int j = 0; j < script.count; j++) {
+        added += script.changes[j].newCount;
+        removed += script.changes[j].oldCount;
+    }
+
+    struct DiffLines out = {NULL, NULL, 0, 0};
+    if (script.count > 0) {
+        editorDiffAddLine(&out, "--- ", source->filename, strlen(source->filename));
+        editorDiffAddLine(&out, "+++ ", source->filename, strlen(source->filename));
+        editorDiffHunks(&out, &script, lines, lens, count, source);
+    }
+    diffFree(&script);
+    free(rowHash);
+    free(hash);
+    free(lens);
+    free(lines);
+    free(text);
+
+    if (out.count == 0) {
+        editorSetStatusMessage("No changes to %s since it was saved", source->filename);
+        return;
+    }
+
+    int index = -1;
+    for (int i = 0; i < config.numBuffers; i++) {
+        if (config.buffers[i]->diffOf == source) index = i;
+    }
+    if (index == -1) {
+        editorNewBuffer();
+        config.buf->diffOf = source;
+    } else {
+        editorSwitchBuffer(index);
+    }
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        if (HLDB[j].flags & HL_HIGHLIGHT_DIFF) config.buf->syntax = &HLDB[j];
+    }
+
+    editorClearRows();
+    editorReplaceRowsOwned(0, 0, out.lines, out.lens, out.count);
+    free(out.lines);
+    free(out.lens);
+    config.buf->dirty = 0;
+    config.buf->cursorX = 0;
+    config.buf->cursorY = 0;
+    config.buf->rowOffset = 0;
+    config.buf->colOffset = 0;
+    config.buf->markSet = false;
+    editorSetStatusMessage("%d lines added, %d removed since %s was saved", added, removed, source->filename);
+}
+
+/*** output ***/
+
+/**
+ * Makes sure the columns from rx up to the width of the screen are rendered and
+ * highlighted, which for long rows means moving the rendered window.
+ *
+ * @param at index of the row
+ * @param rx first column that will be drawn
+ */
+void editorRenderRowWindow(int at, int64_t rx) {
+    struct EditorRow *row = &config.buf->row[at];
+    struct EditorRowRender *rrow = &config.buf->rrow[at];
+    if (!editorRowIsLong(row) || editorRowRenderCovers(row, rrow, rx, config.screenCols)) return;
+
+    editorUpdateRowRenderWindow(row, rrow, rx);
+    editorUpdateRowSyntax(at);
+}
+
+/**
+ * Makes sure the wrap layout matches the rows and the width of the screen.
+ */
+void editorUpdateWrapLayout() {
+    if (config.buf->wrap.cols != config.screenCols || config.buf->wrap.tree.numRows != config.buf->numRows)
+        wrapBuild(&config.buf->wrap, config.buf->rowWidth, config.buf->numRows, config.screenCols);
+}
+
+/**
+ * Gets the screen line the cursor is on when soft wrapping.
+ */
+int editorCursorLine() {
+    return wrapLinesBefore(&config.buf->wrap, config.buf->cursorY) + (int) (config.buf->rx / config.screenCols);
+}
+
+void editorScroll() {
+    if (config.buf->viewing) editorViewScroll();
+
+    config.buf->rx = 0;
+    if (config.buf->cursorY < config.buf->numRows) {
+        config.buf->rx = editorRowCxToRx(&config.buf->row[config.buf->cursorY], config.buf->cursorX);
+    }
+
+    if (config.buf->softWrap) {
+        editorUpdateWrapLayout();
+        int cursorLine = editorCursorLine();
+        if (cursorLine < config.buf->lineOffset) {
+            config.buf->lineOffset = cursorLine;
+        }
+        if (cursorLine >= config.buf->lineOffset + config.screenRows) {
+            config.buf->lineOffset = cursorLine - config.screenRows + 1;
+        }
+        int lineInRow;
+        config.buf->rowOffset = wrapFindRow(&config.buf->wrap, config.buf->lineOffset, &lineInRow);
+        config.buf->colOffset = 0;
+        return;
+    }
+
+    if (config.buf->cursorY < config.buf->rowOffset) {
+        config.buf->rowOffset = config.buf->cursorY;
+    }
+    if (config.buf->cursorY >= config.buf->rowOffset + config.screenRows) {
+        config.buf->rowOffset = config.buf->cursorY - config.screenRows + 1;
+    }
+    if (config.buf->rx < config.buf->colOffset) {
+        config.buf->colOffset = config.buf->rx;
+    }
+    if (config.buf->rx >= config.buf->colOffset + config.screenCols) {
+        config.buf->colOffset = config.buf->rx - config.screenCols + 1;
+    }
+}
+
+/**
+ * Draws the screen columns of a row starting at the specified column.
+ *
+ * @param ab buffer to draw into
+ * @param at index of the row
+ * @param colOffset first column to draw
+ * @param bracketRx column of the bracket matching the one under the cursor, drawn inverted, or -1
+ */
+void editorDrawRow(struct AppendBuffer *ab, int at, int64_t colOffset, int64_t bracketRx) {
+    editorRenderRowWindow(at, colOffset);
+    struct EditorRowRender *rrow = &config.buf->rrow[at];
+    int width;
+    //The window was just rendered to cover colOffset, so the column within it fits in an int
+    int start = utf8ColumnOffset(rrow->render, rrow->rsize, (int) (colOffset - rrow->rstart), &width);
+    int len = rrow->rsize - start;
+    char *c = &rrow->render[start];
+    unsigned char *hl = &rrow->hl[start];
+    int currentColor = -1;
+
+    //Columns of the row which are selected, selEnd being past the end if its newline is selected too
+    int64_t selStart = -1, selEnd = -1;
+    int64_t fromX, toX;
+    int fromY, toY;
+    if (editorGetSelection(&fromX, &fromY, &toX, &toY) && at >= fromY && at <= toY) {
+        selStart = at == fromY ? editorRowCxToRx(&config.buf->row[at], fromX) : 0;
+        selEnd = at == toY ? editorRowCxToRx(&config.buf->row[at], toX) : INT64_MAX;
+    }
+    bool inverted = false;
+
+    //Part of a wide char is scrolled off the left of the screen
+    for (int i = 0; i < width; i++) abAppend(ab, " ", 1);
+
+    for (int i = 0, charLen = 1; i < len && width < config.screenCols; i += charLen) {
+        int charWidth = 1;
+        charLen = 1;
+        if ((unsigned char) c[i] >= 0x80) {
+            int codepoint;
+            charLen = utf8Decode(&c[i], len - i, &codepoint);
+            charWidth = utf8Width(codepoint);
+            if (width + charWidth > config.screenCols) break;
+        }
+        int64_t col = colOffset + width;
+        width += charWidth;
+
+        bool selected = (col >= selStart && col < selEnd) || col == bracketRx;
+        if (selected != inverted) {
+            if (selected) abAppend(ab, INVERT_COLOR_CMD);
+            else abAppend(ab, NO_INVERT_COLOR_CMD);
+            inverted = selected;
+        }
+
+        if (iscntrl((unsigned char) c[i])) {
+            char sym = (char) ((c[i] <= 26) ? '@' + c[i] : '?');
+            abAppend(ab, INVERT_COLOR_CMD);
+            abAppend(ab, &sym, 1);
+            abAppend(ab, RESET_RENDITION_CMD);
+            if (inverted) abAppend(ab, INVERT_COLOR_CMD);
+            if (currentColor != -1) {
+                char cmdBuf[16];
+                int cmdLen = getSetColorCmd(cmdBuf, currentColor);
+                abAppend(ab, cmdBuf, cmdLen);
+            }
+        } else if (hl[i] == HL_NORMAL) {
+            if (currentColor != -1) {
+                abAppend(ab, RESET_COLOR_CMD);
+                currentColor = -1;
+            }
+            abAppend(ab, &c[i], charLen);
+        } else {
+            int color = editorSyntaxToColor(hl[i]);
+            if (color != currentColor) {
+                currentColor = color;
+                char cmdBuf[16];
+                int cmdLen = getSetColorCmd(cmdBuf, color);
+                abAppend(ab, cmdBuf, cmdLen);
+            }
+            abAppend(ab, &c[i], charLen);
+        }
+    }
+
+    //Show that the newline is selected with a space after the end of the row
+    if (selEnd == INT64_MAX && width < config.screenCols && colOffset + width >= config.buf->rowWidth[at]) {
+        if (!inverted) abAppend(ab, INVERT_COLOR_CMD);
+        abAppend(ab, " ", 1);
+        inverted = true;
+    }
+    if (inverted) abAppend(ab, NO_INVERT_COLOR_CMD);
+    abAppend(ab, RESET_COLOR_CMD);
+}
+
+void editorDrawRows(struct AppendBuffer *ab) {
+    int y;
+    int fileRow = config.buf->rowOffset;
+    int lineInRow = 0;
+    if (config.buf->softWrap) fileRow = wrapFindRow(&config.buf->wrap, config.buf->lineOffset, &lineInRow);
+
+    //The bracket matching the one under the cursor
+    int matchY = -1;
+    int64_t matchX, matchRx = -1;
+    if (editorFindMatchingBracket(config.buf->cursorY, config.buf->cursorX, &matchY, &matchX))
+        matchRx = editorRowCxToRx(&config.buf->row[matchY], matchX);
+
+    for (y = 0; y < config.screenRows; y++) {
+        if (fileRow >= config.buf->numRows) {
+            if (config.buf->numRows == 0 && y == config.screenRows / 3) {
+                char welcome[80];
+                int welcomeLen = snprintf(welcome, sizeof(welcome),
+                                          "Pound editor -- version %s", POUND_VERSION);
+                if (welcomeLen > config.screenCols) welcomeLen = config.screenCols;
+                int padding = (config.screenCols - welcomeLen) / 2;
+                if (padding) {
+                    abAppend(ab, "~", 1);
+                    padding--;
+                }
+                while (padding--) abAppend(ab, " ", 1);
+                abAppend(ab, welcome, welcomeLen);
+            } else {
+                abAppend(ab, "~", 1);
+            }
+        } else if (config.buf->softWrap) {
+            editorDrawRow(ab, fileRow, (int64_t) lineInRow * config.screenCols, fileRow == matchY ? matchRx : -1);
+            if (++lineInRow == wrapLineCount(config.buf->rowWidth[fileRow], config.screenCols)) {
+                fileRow++;
+                lineInRow = 0;
+            }
+        } else {
+            editorDrawRow(ab, fileRow, config.buf->colOffset, fileRow == matchY ? matchRx : -1);
+            fileRow++;
+        }
+
+        abAppend(ab, ERASE_PAST_CURSOR_CMD);
+        abAppend(ab, "\r\n", 2);
+    }
+}
+
+void editorDrawStatusBar(struct AppendBuffer *ab) {
+    abAppend(ab, INVERT_COLOR_CMD);
+    //Big enough for the longest of each part, so only the screen width cuts the status short
+    char status[128], rstatus[80];
+    char received[32] = "";
+    if (config.buf->streaming) {
+        snprintf(received, sizeof(received), "(%.1f MB received) ", (double) config.buf->streamBytes / (1024 * 1024));
+    }
+    if (config.buf->following) snprintf(received, sizeof(received), "(following) ");
+    if (config.macroRecording) snprintf(received, sizeof(received), "(recording) ");
+    char which[32] = "";
+    if (config.numBuffers > 1) snprintf(which, sizeof(which), "[%d/%d] ", config.currentBuffer + 1, config.numBuffers);
+    int len, rlen;
+    if (config.hud) {
+        len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s%s", which,
+                       config.buf->filename ? config.buf->filename : "[No Name]", config.buf->numRows,
+                       received, config.buf->dirty ? "(modified)" : "");
+        traceFormat(rstatus, sizeof(rstatus));
+        rlen = (int) strlen(rstatus);
+    } else if (config.buf->viewing) {
+        char lines[32], line[32] = "?";
+        editorViewLineCount(lines, sizeof(lines));
+        if (config.buf->viewLine != -1)
+            snprintf(line, sizeof(line), "%lld", config.buf->viewLine + config.buf->cursorY + 1);
+        len = snprintf(status, sizeof(status), "%s%.20s - %s lines (read-only)", which,
+                       config.buf->filename, lines);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %s/%s",
+                        config.buf->syntax ? config.buf->syntax->filetype : "no ft", line, lines);
+    } else {
+        len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s%s", which,
+                       config.buf->filename ? config.buf->filename : "[No Name]", config.buf->numRows,
+                       received, config.buf->dirty ? "(modified)" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+                        config.buf->syntax ? config.buf->syntax->filetype : "no ft",
+                        config.buf->cursorY + 1, config.buf->numRows);
+    }
+    //snprintf returns the length it wanted to write, which may be more than it did
+    if (len >= (int) sizeof(status)) len = sizeof(status) - 1;
+    if (rlen >= (int) sizeof(rstatus)) rlen = sizeof(rstatus) - 1;
+    if (len > config.screenCols) len = config.screenCols;
+    abAppend(ab, status, len);
+    while (len < config.screenCols) {
+        if (config.screenCols - len == rlen) {
+            abAppend(ab, rstatus, rlen);
+            break;
+        } else {
+            abAppend(ab, " ", 1);
+            len++;
+        }
+    }
+    abAppend(ab, RESET_RENDITION_CMD);
+    abAppend(ab, "\r\n", 2);
 }
 
 void editorDrawMessageBar(struct AppendBuffer *ab) {
     abAppend(ab, ERASE_PAST_CURSOR_CMD);
+    if (config.memHud) {
+        char mem[128];
+        editorFormatMemory(mem, sizeof(mem));
+        int memLen = (int) strlen(mem);
+        abAppend(ab, mem, memLen > config.screenCols ? config.screenCols : memLen);
+        return;
+    }
     int msgLen = (int) strlen(config.statusMsg);
     if (msgLen > config.screenCols) msgLen = config.screenCols;
     if (msgLen && time(NULL) - config.statusMsgTime < 5)
@@ -715,33 +3244,58 @@ void editorDrawMessageBar(struct AppendBuffer *ab) {
 }
 
 void editorRefreshScreen() {
+    traceEnd(TRACE_INPUT);
+    config.framePending = false;
+    config.lastFrame = editorNow();
     editorScroll();
 
-    struct AppendBuffer screenText = ABUF_INIT;
+    struct AppendBuffer *screenText = &config.screen;
+    abClear(screenText);
 
-    abAppend(&screenText, CURSOR_HIDE_CMD);
+    if (config.syncUpdate) abAppend(screenText, SYNC_UPDATE_BEGIN_CMD);
+    abAppend(screenText, CURSOR_HIDE_CMD);
 
     {
         char cmdBuf[16];
         int cmdLen = getCursorSetPositionCmd(cmdBuf, 1, 1);
-        abAppend(&screenText, cmdBuf, cmdLen);
+        abAppend(screenText, cmdBuf, cmdLen);
     }
 
-    editorDrawRows(&screenText);
-    editorDrawStatusBar(&screenText);
-    editorDrawMessageBar(&screenText);
+    size_t linesStart = screenText->len;
+    traceBegin(TRACE_DRAW);
+    editorDrawRows(screenText);
+    traceEnd(TRACE_DRAW);
+    editorDrawStatusBar(screenText);
+    editorDrawMessageBar(screenText);
+    size_t linesEnd = screenText->len;
 
     {
+        int y = config.buf->cursorY - config.buf->rowOffset;
+        int x = (int) (config.buf->rx - config.buf->colOffset);
+        if (config.buf->softWrap) {
+            y = editorCursorLine() - config.buf->lineOffset;
+            x = (int) (config.buf->rx % config.screenCols);
+        }
+
         char cmdBuf[16];
-        int cmdLen = getCursorSetPositionCmd(cmdBuf, (config.cursorY - config.rowOffset) + 1,
-                                             (config.rx - config.colOffset) + 1);
-        abAppend(&screenText, cmdBuf, cmdLen);
+        int cmdLen = getCursorSetPositionCmd(cmdBuf, y + 1, x + 1);
+        abAppend(screenText, cmdBuf, cmdLen);
     }
 
-    abAppend(&screenText, CURSOR_SHOW_CMD);
+    abAppend(screenText, CURSOR_SHOW_CMD);
+    if (config.syncUpdate) abAppend(screenText, SYNC_UPDATE_END_CMD);
 
-    write(STDOUT_FILENO, screenText.data, (size_t) screenText.len);
-    abFree(&screenText);
+    if (config.headless) {
+        config.headlessRun.frames++;
+        config.headlessRun.bytesEmitted += (size_t) screenText->len;
+    } else if (config.serving) {
+        editorServerSendFrame(screenText, linesStart, linesEnd);
+    } else {
+        traceBegin(TRACE_WRITE);
+        write(STDOUT_FILENO, screenText->data, (size_t) screenText->len);
+        traceEnd(TRACE_WRITE);
+    }
+    traceFrame();
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -755,86 +3309,116 @@ void editorSetStatusMessage(const char *fmt, ...) {
 /*** input ***/
 
 char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+    return editorPromptInput(prompt, callback, false);
+}
+
+/**
+ * Asks for some text in the message bar.
+ *
+ * @param prompt format of the message, with %s where the text typed so far goes
+ * @param callback called after each key with the text and the key, or NULL
+ * @param allowEmpty whether Enter is accepted before anything has been typed
+ * @return the text, which the caller must free, or NULL if ESC was pressed
+ */
+char *editorPromptInput(char *prompt, void (*callback)(char *, int), bool allowEmpty) {
     size_t bufSize = 128;
     char *buf = malloc(bufSize);
 
     size_t bufLen = 0;
     buf[0] = '\0';
 
+    //While serving, the prompt is answered by the client which opened it
+    if (config.serving) config.promptClient = config.client;
+
+    char *result = NULL;
     while (1) {
         editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
+        editorScheduleRefresh();
 
         int c = editorReadKey();
         if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
-            if (bufLen != 0) buf[--bufLen] = '\0';
+            //Delete the whole of the last char, not just the last byte of it
+            while (bufLen != 0 && ((unsigned char) buf[--bufLen] & 0xc0) == 0x80) {}
+            buf[bufLen] = '\0';
         } else if (c == '\x1b') {
             editorSetStatusMessage("");
             if (callback) callback(buf, c);
             free(buf);
-            return NULL;
+            break;
         } else if (c == '\r') {
-            if (bufLen != 0) {
+            if (bufLen != 0 || allowEmpty) {
                 editorSetStatusMessage("");
                 if (callback) callback(buf, c);
-                return buf;
+                result = buf;
+                break;
             }
-        } else if (!iscntrl(c) && c < 128) {
-            if (bufLen == bufSize - 1) {
+        } else if (c < ARROW_LEFT && (c >= 0x80 || !iscntrl(c))) {
+            //Keys past ASCII are code points, which are typed into the text as UTF-8 like they are into rows
+            char encoded[UTF8_MAX_LEN];
+            int len = utf8Encode(c, encoded);
+            if (bufLen + (size_t) len >= bufSize) {
                 bufSize *= 2;
                 buf = realloc(buf, bufSize);
+                if (buf == NULL) die("realloc");
             }
-            buf[bufLen++] = (char) c;
+            memcpy(&buf[bufLen], encoded, (size_t) len);
+            bufLen += (size_t) len;
             buf[bufLen] = '\0';
         }
 
         if (callback) callback(buf, c);
     }
+
+    config.promptClient = NULL;
+    config.promptGone = false;
+    return result;
 }
 
 void editorMoveCursor(int key) {
-    struct EditorRow *row = (config.cursorY >= config.numRows) ? NULL : &config.row[config.cursorY];
+    struct EditorRow *row = (config.buf->cursorY >= config.buf->numRows) ? NULL : &config.buf->row[config.buf->cursorY];
 
     switch (key) {
         case ARROW_LEFT:
-            if (config.cursorX != 0) {
-                config.cursorX--;
-            } else if (config.cursorY > 0) {
-                config.cursorY--;
-                config.cursorX = config.row[config.cursorY].size;
+            if (config.buf->cursorX != 0) {
+                config.buf->cursorX = editorRowPrevChar(row, config.buf->cursorX);
+            } else if (config.buf->cursorY > 0) {
+                config.buf->cursorY--;
+                config.buf->cursorX = config.buf->row[config.buf->cursorY].size;
             }
             break;
         case ARROW_RIGHT:
-            if (row && config.cursorX < row->size) {
-                config.cursorX++;
-            } else if (row && config.cursorX == row->size) {
-                config.cursorY++;
-                config.cursorX = 0;
+            if (row && config.buf->cursorX < row->size) {
+                config.buf->cursorX = editorRowNextChar(row, config.buf->cursorX);
+            } else if (row && config.buf->cursorX == row->size) {
+                config.buf->cursorY++;
+                config.buf->cursorX = 0;
             }
             break;
         case ARROW_UP:
-            if (config.cursorY != 0) {
-                config.cursorY--;
+            if (config.buf->cursorY != 0) {
+                config.buf->cursorY--;
             }
             break;
         case ARROW_DOWN:
-            if (config.cursorY < config.numRows) {
-                config.cursorY++;
+            if (config.buf->cursorY < config.buf->numRows) {
+                config.buf->cursorY++;
             }
             break;
     }
 
-    row = (config.cursorY >= config.numRows) ? NULL : &config.row[config.cursorY];
-    int rowLen = row ? row->size : 0;
-    if (config.cursorX > rowLen) {
-        config.cursorX = rowLen;
+    row = (config.buf->cursorY >= config.buf->numRows) ? NULL : &config.buf->row[config.buf->cursorY];
+    int64_t rowLen = row ? row->size : 0;
+    if (config.buf->cursorX > rowLen) {
+        config.buf->cursorX = rowLen;
     }
+    if (row) config.buf->cursorX = editorRowCharStart(row, config.buf->cursorX);
 }
 
 void editorProcessKeypress() {
     static int quitTimes = QUIT_TIMES;
 
     int c = editorReadKey();
+    if (config.buf->viewing && editorViewProcessKeypress(c)) return;
 
     switch (c) {
         case '\r':
@@ -842,13 +3426,20 @@ void editorProcessKeypress() {
             break;
 
         case CTRL_KEY('q'):
-            if (config.dirty && quitTimes > 0) {
-                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
-                                               "Press Ctrl-Q %d more times to quit.", quitTimes);
+            //Detaching leaves the buffers open in the server, so there's nothing to lose
+            if (config.serving) {
+                editorServerDetach();
+                break;
+            }
+            if (editorDirtyBuffers() > 0 && quitTimes > 0) {
+                editorSetStatusMessage("WARNING!!! %d file(s) have unsaved changes. "
+                                               "Press Ctrl-Q %d more times to quit.", editorDirtyBuffers(), quitTimes);
                 quitTimes--;
                 return;
             }
 
+            if (config.headless) editorHeadlessReport();
+
             char cmdBuf[16];
             int cmdLen = getCursorSetPositionCmd(cmdBuf, 1, 1);
             terminalWrite(cmdBuf, cmdLen);
@@ -860,18 +3451,22 @@ void editorProcessKeypress() {
             break;
 
         case HOME_KEY:
-            config.cursorX = 0;
+            config.buf->cursorX = 0;
             break;
 
         case END_KEY:
-            if (config.cursorY < config.numRows)
-                config.cursorX = config.row[config.cursorY].size;
+            if (config.buf->cursorY < config.buf->numRows)
+                config.buf->cursorX = config.buf->row[config.buf->cursorY].size;
             break;
 
         case CTRL_KEY('f'):
             editorFind();
             break;
 
+        case CTRL_KEY('g'):
+            editorGotoLine();
+            break;
+
         case BACKSPACE:
         case CTRL_KEY('h'):
         case DEL_KEY:
@@ -881,11 +3476,23 @@ void editorProcessKeypress() {
 
         case PAGE_UP:
         case PAGE_DOWN: {
+            if (config.buf->softWrap) {
+                //Scroll by screen lines, putting the cursor on the row at the top of the new page
+                editorUpdateWrapLayout();
+                int line = config.buf->lineOffset + (c == PAGE_UP ? -config.screenRows : config.screenRows);
+                if (line < 0) line = 0;
+                int lineInRow;
+                config.buf->cursorY = wrapFindRow(&config.buf->wrap, line, &lineInRow);
+                config.buf->cursorX = 0;
+                config.buf->lineOffset = line;
+                break;
+            }
+
             if (c == PAGE_UP) {
-                config.cursorY = config.rowOffset;
+                config.buf->cursorY = config.buf->rowOffset;
             } else if (c == PAGE_DOWN) {
-                config.cursorY = config.rowOffset + config.screenRows - 1;
-                if (config.cursorY > config.numRows) config.cursorY = config.numRows;
+                config.buf->cursorY = config.buf->rowOffset + config.screenRows - 1;
+                if (config.buf->cursorY > config.buf->numRows) config.buf->cursorY = config.buf->numRows;
             }
 
             int times = config.screenRows;
@@ -901,6 +3508,73 @@ void editorProcessKeypress() {
             editorMoveCursor(c);
             break;
 
+        case CTRL_KEY('t'):
+            editorSetHud(!config.hud);
+            break;
+
+        case CTRL_KEY('e'):
+            config.memHud = !config.memHud;
+            break;
+
+        case CTRL_KEY('o'):
+            editorPromptOpen();
+            break;
+
+        case CTRL_KEY('r'):
+            editorPromptReplace();
+            break;
+
+        case CTRL_KEY('u'):
+            editorPromptFilter();
+            break;
+
+        case CTRL_KEY('b'):
+            editorSetMark();
+            break;
+
+        case CTRL_KEY(']'):
+            editorJumpToBracket();
+            break;
+
+        case CTRL_KEY('d'):
+            editorShowDiff();
+            break;
+
+        case CTRL_KEY('c'):
+            editorCopySelection(false);
+            break;
+
+        case CTRL_KEY('x'):
+            editorCopySelection(true);
+            break;
+
+        case CTRL_KEY('v'):
+            editorPaste();
+            break;
+
+        case CTRL_KEY('k'):
+            //Keys of a macro which is playing can't start or stop a recording, or play it again
+            if (!config.macroPlaying) editorToggleRecording();
+            break;
+
+        case CTRL_KEY('y'):
+            if (!config.macroPlaying) editorPromptPlayMacro();
+            break;
+
+        case CTRL_KEY('n'):
+            editorCycleBuffer(1);
+            break;
+
+        case CTRL_KEY('p'):
+            editorCycleBuffer(-1);
+            break;
+
+        case CTRL_KEY('w'):
+            config.buf->softWrap = !config.buf->softWrap;
+            config.buf->colOffset = 0;
+            config.buf->lineOffset = config.buf->softWrap ? INT_MAX : 0;
+            break;
+
         case CTRL_KEY('l'):
         case '\x1b':
             break;
@@ -913,39 +3587,455 @@ void editorProcessKeypress() {
     quitTimes = QUIT_TIMES;
 }
 
-/*** init ***/
+/**
+ * Shows or hides the timings of the last frame in the status bar.
+ *
+ * @param enabled whether to show them
+ */
+void editorSetHud(bool enabled) {
+    config.hud = enabled;
+    traceSetEnabled(enabled);
+}
 
-void initEditor() {
-    config.cursorX = 0;
-    config.cursorY = 0;
-    config.rx = 0;
-    config.rowOffset = 0;
-    config.colOffset = 0;
-    config.numRows = 0;
-    config.row = NULL;
-    config.dirty = 0;
-    config.filename = NULL;
-    config.statusMsg[0] = '\0';
-    config.statusMsgTime = 0;
-    config.syntax = NULL;
+/*** memory ***/
+
+#define MB(bytes) ((double) (bytes) / (1024 * 1024))
+
+/**
+ * Counts the lines held by every buffer, as the memory stats are for the whole editor.
+ *
+ * @param chars set to the number of bytes of text in them, if not NULL
+ * @return number of lines
+ */
+static int editorTotalLines(size_t *chars) {
+    int lines = 0;
+    if (chars) *chars = 0;
+    for (int i = 0; i < config.numBuffers; i++) {
+        struct EditorBuffer *buf = config.buffers[i];
+        lines += buf->numRows;
+        if (chars) {
+            for (int j = 0; j < buf->numRows; j++) *chars += (size_t) buf->row[j].size;
+        }
+    }
+    return lines;
+}
 
-    if (getWindowSize(&config.screenRows, &config.screenCols) == -1) die("getWindowSize");
-    config.screenRows -= 2;
+/**
+ * Formats how much memory the editor is using, in total and for each category.
+ */
+void editorFormatMemory(char *buf, size_t size) {
+    size_t total = memTotalBytes();
+    int lines = editorTotalLines(NULL);
+    int len = snprintf(buf, size, "mem %.1f MB, %zu B/line:", MB(total), lines ? total / (size_t) lines : 0);
+    for (int i = 0; i < MEM_CATEGORIES && len > 0 && (size_t) len < size; i++) {
+        len += snprintf(&buf[len], size - (size_t) len, " %s %.1f", memCategoryNames[i],
+                        MB(memGetStats(i)->bytes));
+    }
+}
+
+/**
+ * Prints the peak resident set size and what was allocated for each category, to stderr.
+ * Registered with atexit by --stats, before raw mode so it runs once the terminal is restored.
+ */
+void editorPrintStats() {
+    if (!config.headless) {
+        char cmdBuf[16];
+        int cmdLen = getCursorSetPositionCmd(cmdBuf, 1, 1);
+        terminalWrite(CLEAR_DISPLAY_CMD, 4);
+        terminalWrite(cmdBuf, cmdLen);
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        //ru_maxrss is in kilobytes on Linux
+        fprintf(stderr, "peak rss: %.1f MB\n", (double) usage.ru_maxrss / 1024);
+    }
+
+    size_t total = 0, peak = 0, allocations = 0;
+    fprintf(stderr, "%-8s %12s %12s %10s %12s\n", "memory", "bytes", "peak", "blocks", "allocations");
+    for (int i = 0; i < MEM_CATEGORIES; i++) {
+        const struct MemStats *stats = memGetStats(i);
+        fprintf(stderr, "%-8s %12zu %12zu %10zu %12zu\n", memCategoryNames[i],
+                stats->bytes, stats->peak, stats->blocks, stats->allocations);
+        total += stats->bytes;
+        peak += stats->peak;
+        allocations += stats->allocations;
+    }
+    fprintf(stderr, "%-8s %12zu %12zu %10s %12zu\n", "total", total, peak, "", allocations);
+
+    fprintf(stderr, "hl cache: %zu hits, %zu misses\n", config.hlCache.hits, config.hlCache.misses);
+    size_t chars;
+    int lines = editorTotalLines(&chars);
+    fprintf(stderr, "lines: %d\n", lines);
+    if (lines > 0) {
+        fprintf(stderr, "bytes per line: %.1f (%.1f of text)\n",
+                (double) total / lines, (double) chars / lines);
+    }
+}
+
+/*** headless ***/
+
+static int compareLatency(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
 }
 
-int main(int argc, char *argv[]) {
-    enableRawMode();
-    initEditor();
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+/**
+ * Prints how long the keys in the script took to handle and how much was drawn, then exits.
+ */
+void editorHeadlessReport() {
+    struct Headless *run = &config.headlessRun;
+    qsort(run->latency, run->keys, sizeof(long long), compareLatency);
+
+    printf("keys: %zu\n", run->keys);
+    printf("frames: %zu\n", run->frames);
+    printf("bytes emitted: %zu\n", run->bytesEmitted);
+    if (run->keys > 0) {
+        static const double percentiles[] = {50, 90, 99, 100};
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            size_t at = (size_t) (percentiles[i] / 100 * (double) (run->keys - 1) + 0.5);
+            printf("latency p%g: %.1f us\n", percentiles[i], (double) run->latency[at] / 1000);
+        }
     }
+    exit(0);
+}
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+/**
+ * Records how long the last key took, including drawing the frame after it,
+ * then carries on with the next key in the script (or reports once they've all run).
+ */
+void editorHeadlessNextKey() {
+    struct Headless *run = &config.headlessRun;
+    if (config.framePending) editorRefreshScreen();
+    editorIdle();
+
+    if (run->keyStart) {
+        if (run->keys == run->capacity) {
+            run->capacity = run->capacity ? run->capacity * 2 : 1024;
+            run->latency = realloc(run->latency, sizeof(long long) * run->capacity);
+            if (run->latency == NULL) die("realloc");
+        }
+        run->latency[run->keys++] = editorNow() - run->keyStart;
+    }
 
-    while (1) {
+    if (run->scriptPos == run->scriptLen) editorHeadlessReport();
+    run->keyStart = editorNow();
+}
+
+/**
+ * Sets the editor up to draw frames into memory instead of the terminal. Must be called before initEditor.
+ *
+ * @param rows number of rows the screen has
+ * @param cols number of columns the screen has
+ */
+void editorInitHeadless(int rows, int cols) {
+    config.headless = true;
+    config.screenRows = rows;
+    config.screenCols = cols;
+}
+
+/**
+ * Sets the editor up to run the keys in a script without a terminal.
+ *
+ * @param path of the script, which holds the bytes the keys would send
+ * @param size of the screen to draw, as ROWSxCOLS
+ */
+void editorStartHeadless(char *path, char *size) {
+    int rows, cols;
+    if (sscanf(size, "%dx%d", &rows, &cols) != 2 || rows < 3 || cols < 1) {
+        fprintf(stderr, "Invalid size: %s (expected ROWSxCOLS)\n", size);
+        exit(1);
+    }
+
+    config.headlessRun.script = editorReadFile(path, &config.headlessRun.scriptLen);
+    if (config.headlessRun.script == NULL) {
+        perror(path);
+        exit(1);
+    }
+    editorInitHeadless(rows, cols);
+}
+
+/*** server ***/
+
+static volatile sig_atomic_t serverStopping = 0;
+
+static void editorServerSignal(int sig) {
+    (void) sig;
+    serverStopping = 1;
+}
+
+static void editorStopServer() {
+    serverStop(&config.server);
+}
+
+/**
+ * Serves the buffers to clients attached with --attach, instead of using the terminal.
+ *
+ * @param path of the socket to listen on
+ */
+void editorStartServer(char *path) {
+    if (serverListen(&config.server, path) == -1) {
+        perror(path);
+        exit(1);
+    }
+    atexit(editorStopServer);
+
+    //Exiting normally removes the socket, so the next server doesn't find it in the way
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorServerSignal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    config.serving = true;
+    config.client = NULL;
+    config.clientFrame = (struct AppendBuffer) ABUF_INIT;
+    config.promptClient = NULL;
+    config.promptGone = false;
+    //Until a client attaches and gives its size
+    config.screenRows = 24;
+    config.screenCols = 80;
+}
+
+/**
+ * Makes the editor use a client's screen size, buffer and status message, so its keys are handled
+ * and its frames are drawn as if it were the terminal.
+ */
+void editorServerEnter(struct ServerClient *client) {
+    if (config.client) {
+        config.client->buffer = config.currentBuffer;
+        snprintf(config.client->statusMsg, sizeof(config.client->statusMsg), "%s", config.statusMsg);
+        config.client->statusMsgTime = config.statusMsgTime;
+    }
+    config.client = client;
+    snprintf(config.statusMsg, sizeof(config.statusMsg), "%s", client->statusMsg);
+    config.statusMsgTime = client->statusMsgTime;
+    config.currentBuffer = client->buffer;
+    config.buf = config.buffers[client->buffer];
+    config.screenRows = client->rows > 2 ? client->rows - 2 : 1;
+    config.screenCols = client->cols > 0 ? client->cols : 1;
+    config.syncUpdate = (client->flags & HELLO_SYNC_UPDATE) != 0;
+}
+
+/**
+ * Shows the file a client asked for, which is opened in a new buffer unless it's already open,
+ * so only the first client to ask for a file waits for it to be read and highlighted.
+ */
+void editorServerAttach(struct ServerClient *client) {
+    client->attached = true;
+    editorServerEnter(client);
+    editorScheduleRefresh();
+    if (client->path[0] == '\0') return;
+
+    char *path = realpath(client->path, NULL);
+    for (int i = 0; i < config.numBuffers; i++) {
+        char *filename = config.buffers[i]->filename;
+        char *open = filename ? realpath(filename, NULL) : NULL;
+        bool same = open && path ? strcmp(open, path) == 0 : filename && strcmp(filename, client->path) == 0;
+        free(open);
+        if (same) {
+            free(path);
+            editorSwitchBuffer(i);
+            return;
+        }
+    }
+    free(path);
+
+    //The empty buffer a server starts with is used for the first file asked for
+    struct EditorBuffer *buf = config.buf;
+    if (buf->filename || buf->numRows > 0 || buf->dirty || buf->streaming) editorNewBuffer();
+    if (client->flags & HELLO_VIEW) editorView(client->path);
+    else editorOpen(client->path);
+}
+
+void editorServerDrop(struct ServerClient *client) {
+    if (config.client == client) config.client = NULL;
+    if (config.promptClient == client) {
+        config.promptClient = NULL;
+        config.promptGone = true;
+    }
+    serverClose(&config.server, client);
+}
+
+/**
+ * Detaches the client whose keys are being handled, leaving its buffers open.
+ */
+void editorServerDetach() {
+    serverSend(config.client, MSG_EXIT, NULL, 0);
+    editorServerDrop(config.client);
+}
+
+/**
+ * Draws a frame for every attached client.
+ */
+void editorServerRefresh() {
+    struct ServerClient *active = config.client;
+    for (int i = 0; i < config.server.numClients; i++) {
+        struct ServerClient *client = config.server.clients[i];
+        if (!client->attached || client->closed) continue;
+        editorServerEnter(client);
         editorRefreshScreen();
-        editorProcessKeypress();
+    }
+    if (active) editorServerEnter(active);
+    config.framePending = false;
+    config.lastFrame = editorNow();
+}
+
+/**
+ * Sends the frame just drawn to the client, leaving out the screen lines it already has.
+ *
+ * @param frame drawn for the client
+ * @param linesStart offset in frame of the first screen line
+ * @param linesEnd offset in frame of the end of the last screen line
+ */
+void editorServerSendFrame(struct AppendBuffer *frame, size_t linesStart, size_t linesEnd) {
+    struct ServerClient *client = config.client;
+    struct AppendBuffer *out = &config.clientFrame;
+    abClear(out);
+    abAppend(out, frame->data, linesStart);
+
+    //A new client, or one which has resized, is sent the whole screen
+    int numLines = config.screenRows + 2;
+    bool whole = client->lineHash == NULL || client->numLines != numLines;
+    if (whole) {
+        free(client->lineHash);
+        client->lineHash = malloc(sizeof(uint64_t) * (size_t) numLines);
+        if (client->lineHash == NULL) die("malloc");
+        client->numLines = numLines;
+        abAppend(out, CLEAR_DISPLAY_CMD, 4);
     }
 
-    return 0;
+    //Lines are separated by \r\n, which never appears inside one as control characters are drawn as symbols
+    bool changed = whole;
+    size_t pos = linesStart;
+    for (int line = 0; line < numLines && pos < linesEnd; line++) {
+        char *eol = memmem(&frame->data[pos], linesEnd - pos, "\r\n", 2);
+        size_t end = eol ? (size_t) (eol - frame->data) : linesEnd;
+        uint64_t hash = editorLineHash(&frame->data[pos], end - pos);
+        if (whole || hash != client->lineHash[line]) {
+            client->lineHash[line] = hash;
+            changed = true;
+
+            char cmdBuf[16];
+            int cmdLen = getCursorSetPositionCmd(cmdBuf, line + 1, 1);
+            abAppend(out, cmdBuf, cmdLen);
+            abAppend(out, &frame->data[pos], end - pos);
+        }
+        pos = eol ? end + 2 : linesEnd;
+    }
+
+    uint64_t tailHash = editorLineHash(&frame->data[linesEnd], frame->len - linesEnd);
+    if (!changed && tailHash == client->tailHash) return;
+    client->tailHash = tailHash;
+    abAppend(out, &frame->data[linesEnd], frame->len - linesEnd);
+    serverSend(client, MSG_OUTPUT, out->data, out->len);
+}
+
+/**
+ * @return the first attached client with keys waiting to be read, or NULL.
+ * While a prompt is open only the client which opened it is considered.
+ */
+struct ServerClient *editorServerInput() {
+    if (config.promptClient) {
+        struct ServerClient *client = config.promptClient;
+        return client->inputPos < client->inputLen ? client : NULL;
+    }
+    if (config.client && config.client->inputPos < config.client->inputLen) return config.client;
+    for (int i = 0; i < config.server.numClients; i++) {
+        struct ServerClient *client = config.server.clients[i];
+        if (client->attached && !client->closed && client->inputPos < client->inputLen) return client;
+    }
+    return NULL;
+}
+
+/**
+ * Waits until a client has typed something, picking up clients attaching and leaving
+ * and drawing their screens when they're out of date in the meantime, paced like the terminal.
+ */
+void editorServerWait() {
+    while (1) {
+        if (serverStopping) exit(0);
+        for (int i = 0; i < config.server.numClients; i++) {
+            struct ServerClient *client = config.server.clients[i];
+            if (client->closed) {
+                editorServerDrop(client);
+                i--;
+            } else if (client->hello && !client->attached) {
+                editorServerAttach(client);
+            }
+        }
+
+        int timeout = IDLE_INTERVAL_MS;
+        long long due = config.lastFrame + FRAME_INTERVAL_NS;
+        long long now = editorNow();
+        if (config.framePending && now >= due + FRAME_MAX_DELAY_NS) {
+            editorServerRefresh();
+            continue;
+        }
+
+        //The prompt is read on to its end, as if the client had pressed ESC
+        if (config.promptGone) return;
+        struct ServerClient *client = editorServerInput();
+        if (client) {
+            if (client != config.client) editorServerEnter(client);
+            return;
+        }
+
+        if (config.framePending) {
+            if (now >= due) {
+                editorServerRefresh();
+                continue;
+            }
+            timeout = (int) ((due - now + 999999) / 1000000);
+        }
+
+        if (serverPoll(&config.server, timeout)) editorScheduleRefresh();
+        if (editorIdle()) editorScheduleRefresh();
+    }
+}
+
+/*** init ***/
+
+void editorWindowResized(int sig) {
+    (void) sig;
+    windowResized = 1;
+}
+
+/**
+ * Picks up the new size of the terminal, the wrap layout is rebuilt
+ * from the cached row widths the next time it's used.
+ */
+void editorHandleResize() {
+    windowResized = 0;
+    if (getWindowSize(&config.screenRows, &config.screenCols) == -1) die("getWindowSize");
+    config.screenRows -= 2;
+}
+
+void initEditor() {
+    config.buffers = NULL;
+    config.numBuffers = 0;
+    config.currentBuffer = 0;
+    config.screen = (struct AppendBuffer) ABUF_INIT;
+    config.framePending = true;
+    config.lastFrame = 0;
+    config.statusMsg[0] = '\0';
+    config.statusMsgTime = 0;
+    editorNewBuffer();
+    atexit(editorViewCloseAll);
+
+    if (config.headless || config.serving) {
+        config.screenRows -= 2;
+        return;
+    }
+
+    if (getWindowSize(&config.screenRows, &config.screenCols) == -1) die("getWindowSize");
+    config.screenRows -= 2;
+    config.syncUpdate = terminalSupportsSyncUpdate();
+
+    //Not restarting read() lets editorReadKey notice the resize straight away
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorWindowResized;
+    sigaction(SIGWINCH, &sa, NULL);
 }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Editor operations used outside of pound.c, by main and the benchmarks.
+ */
+
+void initEditor();
+
+void editorInitHeadless(int rows, int cols);
+
+void editorStartHeadless(char *path, char *size);
+
+void editorStartServer(char *path);
+
+void editorSetStatusMessage(const char *fmt, ...);
+
+void editorScheduleRefresh();
+
+void editorSetHud(bool enabled);
+
+void editorPrintStats();
+
+void editorProcessKeypress();
+
+void editorNewBuffer();
+
+void editorSwitchBuffer(int index);
+
+off_t editorOpen(char *filename);
+
+void editorOpenStream(int fd);
+
+void editorView(char *filename);
+
+void editorFollow(off_t offset);
+
+void editorInsertRow(int at, char *s, size_t len);
+
+void editorClearRows();
+
+void editorUpdateRowsSyntax(const int *rows, int count);
+
+void editorUpdateRowSyntax(int at);
+
+void editorBypassHighlightCache(bool bypass);
+
+char *editorRowsToString(size_t *bufLen);
+
+void editorSave();
@@ -1,78 +1,660 @@
+#define _GNU_SOURCE
+
+#include <stddef.h>
 #include <stdlib.h>
 #include <memory.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "row.h"
+#include "utf8.h"
+#include "memstats.h"
+
+bool editorRowIsLong(struct EditorRow *row) {
+    return row->size > LONG_LINE_THRESHOLD;
+}
+
+/*** text ***/
+
+/*
+ * The chars of a row are kept just after a count of the rows (and clipboard entries)
+ * sharing them, so rows can be copied without copying their text. A row makes its own
+ * copy of its chars before changing them if anything else still refers to them.
+ * The hash of the chars is kept with them once it's worked out, until they're changed.
+ */
+struct EditorText {
+    int refs;
+    bool hashed;
+    uint64_t hash;
+    char chars[];
+};
+
+static struct EditorText *editorTextOf(char *chars) {
+    return (struct EditorText *) (chars - offsetof(struct EditorText, chars));
+}
+
+/**
+ * Allocates the chars for a row, with room for the null terminator which is set.
+ *
+ * @param len number of chars
+ * @return chars which aren't shared with anything yet
+ */
+char *editorAllocRowChars(size_t len) {
+    struct EditorText *text = memAlloc(MEM_TEXT, sizeof(struct EditorText) + len + 1);
+    if (text == NULL) return NULL;
+    text->refs = 1;
+    text->hashed = false;
+    text->chars[len] = '\0';
+    return text->chars;
+}
+
+/**
+ * Takes another reference to the chars of a row, which are kept until every reference is released.
+ *
+ * @return chars
+ */
+char *editorRetainRowChars(char *chars) {
+    editorTextOf(chars)->refs++;
+    return chars;
+}
+
+void editorReleaseRowChars(char *chars) {
+    if (chars == NULL) return;
+    struct EditorText *text = editorTextOf(chars);
+    if (--text->refs == 0) memFree(MEM_TEXT, text);
+}
 
-int editorRowCxToRx(struct EditorRow *row, int cx) {
-    int rx = 0;
-    int j;
-    for (j = 0; j < cx; j++) {
-        if (row->chars[j] == '\t')
-            rx += (TAB_STOP - 1) - (rx % TAB_STOP);
-        rx++;
+/**
+ * Gives a row its own copy of its chars if they're shared, so they can be changed.
+ */
+static void editorRowUnshare(struct EditorRow *row) {
+    struct EditorText *text = editorTextOf(row->chars);
+    if (text->refs == 1) {
+        text->hashed = false;
+        return;
     }
-    return rx;
+    char *chars = editorAllocRowChars((size_t) row->size);
+    memcpy(chars, row->chars, (size_t) row->size);
+    editorReleaseRowChars(row->chars);
+    row->chars = chars;
+    row->capacity = row->size + 1;
 }
 
-int editorRowRxToCx(struct EditorRow *row, int rx) {
-    int curRx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t')
-            curRx += (TAB_STOP - 1) - (curRx % TAB_STOP);
-        curRx++;
+/*
+ * The hl of a rendered row is kept just after a count of the rows (and highlight cache
+ * entries) sharing it, so rows with the same render can share one. A row gets its own
+ * hl before changing it if anything else still refers to it.
+ */
+struct EditorHl {
+    int refs;
+    //Number of bytes in hl, which is the rsize of the render it was made for
+    int len;
+    unsigned char hl[];
+};
 
-        if (curRx > rx) return cx;
+static struct EditorHl *editorHlOf(unsigned char *hl) {
+    return (struct EditorHl *) (hl - offsetof(struct EditorHl, hl));
+}
+
+/**
+ * Takes another reference to the hl of a row, which is kept until every reference is released.
+ *
+ * @return hl
+ */
+unsigned char *editorRetainRowHl(unsigned char *hl) {
+    editorHlOf(hl)->refs++;
+    return hl;
+}
+
+void editorReleaseRowHl(unsigned char *hl) {
+    if (hl == NULL) return;
+    struct EditorHl *block = editorHlOf(hl);
+    if (--block->refs == 0) memFree(MEM_HIGHLIGHT, block);
+}
+
+/**
+ * Gives a rendered row an hl of its own covering its whole render, which is about to be overwritten.
+ * An hl which isn't shared is resized in place, keeping what's in it.
+ */
+void editorRowReserveHl(struct EditorRowRender *rrow) {
+    struct EditorHl *block = rrow->hl ? editorHlOf(rrow->hl) : NULL;
+    if (block == NULL || block->refs > 1) {
+        editorReleaseRowHl(rrow->hl);
+        block = NULL;
+    } else if (block->len == rrow->rsize) {
+        return;
     }
-    return cx;
+    block = memRealloc(MEM_HIGHLIGHT, block, sizeof(struct EditorHl) + (size_t) rrow->rsize);
+    block->refs = 1;
+    block->len = rrow->rsize;
+    rrow->hl = block->hl;
 }
 
-void editorUpdateRowRender(struct EditorRow *row) {
-    int tabs = 0;
-    int j;
-    for (j = 0; j < row->size; j++)
-        if (row->chars[j] == '\t') tabs++;
+/**
+ * Gives a rendered row its own copy of its hl if it's shared, so it can be changed.
+ */
+void editorRowUnshareHl(struct EditorRowRender *rrow) {
+    if (rrow->hl == NULL || editorHlOf(rrow->hl)->refs == 1) return;
+    struct EditorHl *shared = editorHlOf(rrow->hl);
+    struct EditorHl *block = memAlloc(MEM_HIGHLIGHT, sizeof(struct EditorHl) + (size_t) shared->len);
+    block->refs = 1;
+    block->len = shared->len;
+    memcpy(block->hl, shared->hl, (size_t) shared->len);
+    editorReleaseRowHl(rrow->hl);
+    rrow->hl = block->hl;
+}
+
+/*** column index ***/
 
-    free(row->render);
-    row->render = malloc((size_t) (row->size + tabs * (TAB_STOP - 1) + 1));
+/**
+ * Finds the first indexed char at or after the specified cx.
+ *
+ * @param cols index to search
+ * @param cx to search for
+ * @return position in the index, which is also the number of indexed chars before cx
+ */
+static int64_t editorColumnIndexFind(struct EditorColumnIndex *cols, int64_t cx) {
+    int64_t lo = 0, hi = cols->count;
+    while (lo < hi) {
+        int64_t mid = (lo + hi) / 2;
+        if (cols->cx[mid] < cx) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void editorColumnIndexInsert(struct EditorColumnIndex *cols, int64_t k, int64_t cx, int len) {
+    if (cols->count == cols->capacity) {
+        cols->capacity = cols->capacity ? cols->capacity * 2 : 8;
+        cols->cx = memRealloc(MEM_COLUMNS, cols->cx, sizeof(int64_t) * (size_t) cols->capacity);
+        cols->len = memRealloc(MEM_COLUMNS, cols->len, (size_t) cols->capacity);
+        cols->rx = memRealloc(MEM_COLUMNS, cols->rx, sizeof(int64_t) * (size_t) cols->capacity);
+    }
+    memmove(&cols->cx[k + 1], &cols->cx[k], sizeof(int64_t) * (size_t) (cols->count - k));
+    memmove(&cols->len[k + 1], &cols->len[k], (size_t) (cols->count - k));
+    cols->cx[k] = cx;
+    cols->len[k] = (unsigned char) len;
+    cols->count++;
+    if (cols->validRx > k) cols->validRx = k;
+}
 
+/**
+ * Removes the indexed chars from position k up to (but not including) end.
+ */
+static void editorColumnIndexRemove(struct EditorColumnIndex *cols, int64_t k, int64_t end) {
+    if (end <= k) return;
+    memmove(&cols->cx[k], &cols->cx[end], sizeof(int64_t) * (size_t) (cols->count - end));
+    memmove(&cols->len[k], &cols->len[end], (size_t) (cols->count - end));
+    cols->count -= end - k;
+    if (cols->validRx > k) cols->validRx = k;
+}
+
+/**
+ * Moves the indexed chars from position k onwards by the specified number of chars.
+ */
+static void editorColumnIndexShift(struct EditorColumnIndex *cols, int64_t k, int64_t delta) {
+    for (int64_t j = k; j < cols->count; j++) cols->cx[j] += delta;
+    if (cols->validRx > k) cols->validRx = k;
+}
+
+/**
+ * Gets the rx at which the indexed char at position j starts,
+ * the rx values before it must be up to date.
+ */
+static int64_t editorColumnIndexStartRx(struct EditorColumnIndex *cols, int64_t j) {
+    if (j == 0) return cols->cx[0];
+    return cols->rx[j - 1] + (cols->cx[j] - (cols->cx[j - 1] + cols->len[j - 1]));
+}
+
+/**
+ * Makes sure the rx values of the first k indexed chars of a row are up to date.
+ */
+static void editorColumnIndexExtendRx(struct EditorRow *row, int64_t k) {
+    struct EditorColumnIndex *cols = &row->cols;
+    for (int64_t j = cols->validRx; j < k; j++) {
+        int64_t rx = editorColumnIndexStartRx(cols, j);
+        if (row->chars[cols->cx[j]] == '\t') {
+            cols->rx[j] = rx + TAB_STOP - (rx % TAB_STOP);
+        } else {
+            int cp;
+            utf8Decode(&row->chars[cols->cx[j]], cols->len[j], &cp);
+            cols->rx[j] = rx + utf8Width(cp);
+        }
+    }
+    if (cols->validRx < k) cols->validRx = k;
+}
+
+/**
+ * Indexes every tab and multi-byte UTF-8 sequence which starts in the specified range of a row.
+ *
+ * Runs of plain ASCII are skipped 16 chars at a time where SSE2 is available, by
+ * looking for bytes which are either tabs or have their top bit set.
+ *
+ * @param row to index
+ * @param from cx to start from, no indexed char may start before it and end after it
+ * @param to cx to stop at
+ * @param k position in the index to insert the chars found at
+ */
+static void editorRowScanColumns(struct EditorRow *row, int64_t from, int64_t to, int64_t k) {
+    struct EditorColumnIndex *cols = &row->cols;
+    int64_t j = from;
+#ifdef __SSE2__
+    const __m128i tab = _mm_set1_epi8('\t');
+#endif
+    while (j < to) {
+#ifdef __SSE2__
+        if (j + 16 <= row->size) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *) &row->chars[j]);
+            unsigned int mask = (unsigned int) (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tab)) |
+                                                _mm_movemask_epi8(chunk));
+            if (mask == 0) {
+                j += 16;
+                continue;
+            }
+            j += __builtin_ctz(mask);
+            if (j >= to) break;
+        }
+#endif
+        unsigned char c = (unsigned char) row->chars[j];
+        if (c == '\t') {
+            editorColumnIndexInsert(cols, k++, j, 1);
+            j++;
+        } else if (c >= 0x80) {
+            int cp;
+            int left = row->size - j < UTF8_MAX_LEN ? (int) (row->size - j) : UTF8_MAX_LEN;
+            int len = utf8Decode(&row->chars[j], left, &cp);
+            if (len > 1) editorColumnIndexInsert(cols, k++, j, len);
+            j += len;
+        } else {
+            j++;
+        }
+    }
+}
+
+/**
+ * Re-indexes the chars around a range of a row whose bytes were changed, including the
+ * bytes either side which could have been joined into, or split from, a UTF-8 sequence.
+ *
+ * @param row to re-index
+ * @param from cx of the first changed char
+ * @param to cx after the last changed char
+ */
+static void editorRowReindexColumns(struct EditorRow *row, int64_t from, int64_t to) {
+    struct EditorColumnIndex *cols = &row->cols;
+    from = from > UTF8_MAX_LEN - 1 ? from - (UTF8_MAX_LEN - 1) : 0;
+    to = to + UTF8_MAX_LEN - 1 < row->size ? to + UTF8_MAX_LEN - 1 : row->size;
+
+    int64_t k = editorColumnIndexFind(cols, from);
+    if (k > 0 && cols->cx[k - 1] + cols->len[k - 1] > from) from = cols->cx[k - 1] + cols->len[k - 1];
+
+    editorColumnIndexRemove(cols, k, editorColumnIndexFind(cols, to));
+    editorRowScanColumns(row, from, to, k);
+}
+
+/*** conversion ***/
+
+int64_t editorRowCxToRx(struct EditorRow *row, int64_t cx) {
+    struct EditorColumnIndex *cols = &row->cols;
+    int64_t k = editorColumnIndexFind(cols, cx);
+    if (k == 0) return cx;
+
+    editorColumnIndexExtendRx(row, k);
+    int64_t end = cols->cx[k - 1] + cols->len[k - 1];
+    //cx is in the middle of a UTF-8 sequence
+    if (cx < end) return editorColumnIndexStartRx(cols, k - 1);
+    return cols->rx[k - 1] + (cx - end);
+}
+
+int64_t editorRowRxToCx(struct EditorRow *row, int64_t rx) {
+    struct EditorColumnIndex *cols = &row->cols;
+
+    //Bring the rx values up to date until one lies past rx, doubling the amount each time
+    while (cols->validRx < cols->count && (cols->validRx == 0 || cols->rx[cols->validRx - 1] <= rx)) {
+        int64_t k = cols->validRx * 2 + 1;
+        editorColumnIndexExtendRx(row, k < cols->count ? k : cols->count);
+    }
+
+    //Find the last indexed char which ends at or before rx
+    int64_t lo = -1, hi = cols->validRx - 1;
+    while (lo < hi) {
+        int64_t mid = (lo + hi + 1) / 2;
+        if (cols->rx[mid] <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+
+    int64_t baseCx = lo >= 0 ? cols->cx[lo] + cols->len[lo] : 0;
+    int64_t baseRx = lo >= 0 ? cols->rx[lo] : 0;
+    if (lo + 1 < cols->count && rx >= baseRx + (cols->cx[lo + 1] - baseCx))
+        return cols->cx[lo + 1];
+
+    int64_t cx = baseCx + (rx - baseRx);
+    return cx < row->size ? cx : row->size;
+}
+
+/**
+ * Gets the cx of the char after the one at the specified cx.
+ */
+int64_t editorRowNextChar(struct EditorRow *row, int64_t cx) {
+    if (cx >= row->size) return row->size;
+    int64_t k = editorColumnIndexFind(&row->cols, cx);
+    if (k < row->cols.count && row->cols.cx[k] == cx) return cx + row->cols.len[k];
+    return cx + 1;
+}
+
+/**
+ * Gets the cx of the char before the one at the specified cx.
+ */
+int64_t editorRowPrevChar(struct EditorRow *row, int64_t cx) {
+    if (cx <= 0) return 0;
+    return editorRowCharStart(row, cx - 1);
+}
+
+/**
+ * Gets the cx at which the char containing the specified cx starts,
+ * which is only different to cx in the middle of a UTF-8 sequence.
+ */
+int64_t editorRowCharStart(struct EditorRow *row, int64_t cx) {
+    struct EditorColumnIndex *cols = &row->cols;
+    int64_t k = editorColumnIndexFind(cols, cx + 1);
+    if (k > 0 && cols->cx[k - 1] + cols->len[k - 1] > cx) return cols->cx[k - 1];
+    return cx;
+}
+
+/*** rendering ***/
+
+/**
+ * Renders the chars of a row starting at the specified cx, copying the runs
+ * between indexed chars in one go. Bytes which aren't valid UTF-8 are rendered as '?'.
+ * Zero-width chars just after the last column are rendered along with it.
+ *
+ * @param row to render
+ * @param cx of the first char to render
+ * @param rx of the first char to render
+ * @param out to render into
+ * @param maxWidth number of columns after which rendering stops
+ * @param maxBytes number of bytes out has room for, after which rendering stops
+ * @param width set to the number of columns rendered
+ * @return number of bytes rendered
+ */
+static int editorRowRenderRange(struct EditorRow *row, int64_t cx, int64_t rx, char *out, int maxWidth, int maxBytes,
+                                int *width) {
+    struct EditorColumnIndex *cols = &row->cols;
+    int64_t k = editorColumnIndexFind(cols, cx);
     int idx = 0;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % TAB_STOP != 0) row->render[idx++] = ' ';
+    int w = 0;
+
+    while (cx < row->size) {
+        int64_t next = k < cols->count ? cols->cx[k] : row->size;
+        int run = next - cx < maxWidth - w ? (int) (next - cx) : maxWidth - w;
+        if (run > maxBytes - idx) run = maxBytes - idx;
+        //A wide char can take the width past maxWidth
+        if (run < 0) run = 0;
+        memcpy(&out[idx], &row->chars[cx], (size_t) run);
+        for (int i = utf8AsciiPrefix(&out[idx], run); i < run; i += 1 + utf8AsciiPrefix(&out[idx + i + 1], run - i - 1))
+            out[idx + i] = '?';
+        idx += run;
+        w += run;
+        cx += run;
+        //Stopped by the width or the room left, or at the end of the row
+        if (cx < next || k == cols->count) break;
+
+        if (row->chars[cx] == '\t') {
+            int tabWidth = (int) (TAB_STOP - (rx + w) % TAB_STOP);
+            if (w >= maxWidth || idx + tabWidth > maxBytes) break;
+            memset(&out[idx], ' ', (size_t) tabWidth);
+            idx += tabWidth;
+            w += tabWidth;
         } else {
-            row->render[idx++] = row->chars[j];
+            int cp;
+            utf8Decode(&row->chars[cx], cols->len[k], &cp);
+            int cpWidth = utf8Width(cp);
+            if ((w >= maxWidth && cpWidth > 0) || idx + cols->len[k] > maxBytes) break;
+            memcpy(&out[idx], &row->chars[cx], cols->len[k]);
+            idx += cols->len[k];
+            w += cpWidth;
         }
+        cx += cols->len[k];
+        k++;
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    *width = w;
+    return idx;
+}
+
+void editorInitRow(struct EditorRow *row, struct EditorRowRender *rrow, const char *s, size_t len) {
+    char *chars = editorAllocRowChars(len);
+    memcpy(chars, s, len);
+    editorInitRowOwned(row, rrow, chars, len);
+}
+
+/**
+ * Initializes a row with chars which were already allocated for it, rather than copying them.
+ *
+ * @param row to initialize
+ * @param rrow to initialize
+ * @param chars from editorAllocRowChars or editorRetainRowChars, whose reference the row takes over
+ * @param len number of chars
+ */
+void editorInitRowOwned(struct EditorRow *row, struct EditorRowRender *rrow, char *chars, size_t len) {
+    row->size = (int64_t) len;
+    row->capacity = (int64_t) len + 1;
+    row->chars = chars;
+    memset(&row->cols, 0, sizeof(row->cols));
+    editorRowScanColumns(row, 0, row->size, 0);
+
+    rrow->rstart = 0;
+    rrow->rsize = 0;
+    rrow->rwidth = 0;
+    rrow->render = NULL;
+    rrow->hl = NULL;
+    editorUpdateRowRender(row, rrow);
+}
+
+void editorUpdateRowRender(struct EditorRow *row, struct EditorRowRender *rrow) {
+    if (editorRowIsLong(row)) {
+        //Only re-render the window which is already on screen
+        editorUpdateRowRenderWindow(row, rrow, rrow->rstart + LONG_LINE_MARGIN);
+        return;
+    }
+
+    int width = (int) editorRowCxToRx(row, row->size);
+
+    int bytes = (int) (row->size + row->cols.count * (TAB_STOP - 1));
+    memFree(MEM_RENDER, rrow->render);
+    rrow->render = memAlloc(MEM_RENDER, (size_t) bytes + 1);
+    rrow->rsize = editorRowRenderRange(row, 0, 0, rrow->render, width, bytes, &rrow->rwidth);
+    rrow->render[rrow->rsize] = '\0';
+    rrow->rstart = 0;
+}
+
+/**
+ * Renders the window of a long row which starts LONG_LINE_MARGIN columns before
+ * the specified rx, so the columns around rx can be drawn without rendering the whole row.
+ *
+ * @param row to render
+ * @param rrow to set the rendered window of
+ * @param rx column the window should contain
+ */
+void editorUpdateRowRenderWindow(struct EditorRow *row, struct EditorRowRender *rrow, int64_t rx) {
+    int64_t start = rx - LONG_LINE_MARGIN;
+    if (start < 0) start = 0;
+
+    int64_t cx = editorRowRxToCx(row, start);
+    int64_t rstart = editorRowCxToRx(row, cx);
+
+    //Zero-width chars take up bytes without taking up columns, so the window is bounded by both
+    int bytes = LONG_LINE_WINDOW * UTF8_MAX_LEN + TAB_STOP;
+    memFree(MEM_RENDER, rrow->render);
+    rrow->render = memAlloc(MEM_RENDER, (size_t) bytes + 1);
+    rrow->rsize = editorRowRenderRange(row, cx, rstart, rrow->render, LONG_LINE_WINDOW, bytes, &rrow->rwidth);
+    rrow->render[rrow->rsize] = '\0';
+    rrow->rstart = rstart;
+}
+
+/**
+ * Checks whether the rendered chars of a row contain all of the specified columns.
+ *
+ * @param row which was rendered
+ * @param rrow rendered chars
+ * @param rx first column which should be rendered
+ * @param width number of columns which should be rendered
+ * @return true if rx up to rx + width (or the end of the row) is rendered
+ */
+bool editorRowRenderCovers(struct EditorRow *row, struct EditorRowRender *rrow, int64_t rx, int width) {
+    if (rrow->render == NULL || rx < rrow->rstart) return false;
+    if (rx + width <= rrow->rstart + rrow->rwidth) return true;
+    return rrow->rstart + rrow->rwidth >= editorRowCxToRx(row, row->size);
+}
+
+/*** editing ***/
+
+/**
+ * Makes sure chars can hold the specified number of chars plus the null terminator,
+ * growing it geometrically so repeated inserts into a long row don't copy it every time.
+ *
+ * @param row to grow
+ * @param size number of chars
+ */
+static void editorRowReserve(struct EditorRow *row, int64_t size) {
+    editorRowUnshare(row);
+    if (size + 1 <= row->capacity) return;
+    int64_t capacity = row->capacity * 2;
+    if (capacity < size + 1) capacity = size + 1;
+    size_t bytes = sizeof(struct EditorText) + (size_t) capacity;
+    struct EditorText *text = memRealloc(MEM_TEXT, editorTextOf(row->chars), bytes);
+    row->chars = text->chars;
+    row->capacity = capacity;
+}
+
+void editorRowInsertChar(struct EditorRow *row, int64_t at, int c) {
+    char ch = (char) c;
+    editorRowInsertString(row, at, &ch, 1);
 }
 
-void editorRowInsertChar(struct EditorRow *row, int at, int c) {
+void editorRowInsertString(struct EditorRow *row, int64_t at, const char *s, size_t len) {
     if (at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, (size_t) (row->size + 2));
-    memmove(&row->chars[at + 1], &row->chars[at], (size_t) (row->size - at + 1));
-    row->size++;
-    row->chars[at] = (char) c;
+    editorRowReserve(row, row->size + (int64_t) len);
+    memmove(&row->chars[at + len], &row->chars[at], (size_t) (row->size - at + 1));
+    memcpy(&row->chars[at], s, len);
+    row->size += (int64_t) len;
+
+    editorColumnIndexShift(&row->cols, editorColumnIndexFind(&row->cols, at), (int64_t) len);
+    editorRowReindexColumns(row, at, at + (int64_t) len);
 }
 
 void editorRowAppendString(struct EditorRow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
+    editorRowInsertString(row, row->size, s, len);
 }
 
-bool editorRowDelChar(struct EditorRow *row, int at) {
+/**
+ * Deletes the char (which may be a UTF-8 sequence) at the specified cx.
+ *
+ * @param row to delete from
+ * @param at cx of the char
+ * @return true if a char was deleted
+ */
+bool editorRowDelChar(struct EditorRow *row, int64_t at) {
     if (at < 0 || at >= row->size) return false;
-    memmove(&row->chars[at], &row->chars[at + 1], (size_t) (row->size - at));
-    row->size--;
+    editorRowUnshare(row);
+    int64_t len = editorRowNextChar(row, at) - at;
+    memmove(&row->chars[at], &row->chars[at + len], (size_t) (row->size - at - len + 1));
+    row->size -= len;
+
+    struct EditorColumnIndex *cols = &row->cols;
+    int64_t k = editorColumnIndexFind(cols, at);
+    editorColumnIndexRemove(cols, k, editorColumnIndexFind(cols, at + len));
+    editorColumnIndexShift(cols, k, -len);
+    editorRowReindexColumns(row, at, at);
     return true;
 }
 
-void editorFreeRow(struct EditorRow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+void editorRowTruncate(struct EditorRow *row, int64_t at) {
+    if (at < 0 || at >= row->size) return;
+    editorRowUnshare(row);
+    row->size = at;
+    row->chars[at] = '\0';
+
+    struct EditorColumnIndex *cols = &row->cols;
+    editorColumnIndexRemove(cols, editorColumnIndexFind(cols, at), cols->count);
+    editorRowReindexColumns(row, at, at);
+}
+
+/**
+ * Replaces every occurrence of a string in a row, building the new chars in a single
+ * allocation and re-indexing the row's columns once, rather than editing it in place.
+ *
+ * @param row to replace in
+ * @param needle string to look for, which must not be empty
+ * @param needleLen number of bytes in needle
+ * @param replacement string to put in place of each occurrence
+ * @param replacementLen number of bytes in replacement
+ * @return number of occurrences replaced
+ */
+long long editorRowReplaceAll(struct EditorRow *row, const char *needle, size_t needleLen,
+                              const char *replacement, size_t replacementLen) {
+    const char *end = row->chars + row->size;
+    long long count = 0;
+    for (const char *p = row->chars; (p = memmem(p, (size_t) (end - p), needle, needleLen)); p += needleLen) count++;
+    if (count == 0) return 0;
+
+    size_t size = (size_t) row->size - (size_t) count * needleLen + (size_t) count * replacementLen;
+    char *chars = editorAllocRowChars(size);
+    char *out = chars;
+    const char *from = row->chars;
+    for (const char *p; (p = memmem(from, (size_t) (end - from), needle, needleLen)); from = p + needleLen) {
+        memcpy(out, from, (size_t) (p - from));
+        out += p - from;
+        memcpy(out, replacement, replacementLen);
+        out += replacementLen;
+    }
+    memcpy(out, from, (size_t) (end - from));
+
+    editorReleaseRowChars(row->chars);
+    row->chars = chars;
+    row->size = (int64_t) size;
+    row->capacity = (int64_t) size + 1;
+
+    row->cols.count = 0;
+    row->cols.validRx = 0;
+    editorRowScanColumns(row, 0, row->size, 0);
+    return count;
+}
+
+/**
+ * Hashes a line of text (64-bit FNV-1a), so lines can be compared without keeping a copy of them.
+ *
+ * @param s text of the line
+ * @param len number of bytes in s
+ * @return hash of the line
+ */
+uint64_t editorLineHash(const char *s, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) s[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * Gets the hash of a row's chars, only hashing them the first time it's asked for
+ * after they were changed. Rows sharing their chars share the hash too.
+ */
+uint64_t editorRowHash(struct EditorRow *row) {
+    struct EditorText *text = editorTextOf(row->chars);
+    if (!text->hashed) {
+        text->hash = editorLineHash(text->chars, (size_t) row->size);
+        text->hashed = true;
+    }
+    return text->hash;
+}
+
+void editorFreeRow(struct EditorRow *row, struct EditorRowRender *rrow) {
+    memFree(MEM_RENDER, rrow->render);
+    editorReleaseRowHl(rrow->hl);
+    editorReleaseRowChars(row->chars);
+    memFree(MEM_COLUMNS, row->cols.cx);
+    memFree(MEM_COLUMNS, row->cols.len);
+    memFree(MEM_COLUMNS, row->cols.rx);
 }
@@ -1,35 +1,118 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define TAB_STOP 8
 
+//Rows longer than this are in long-line mode: only a window of them is rendered and highlighted
+#define LONG_LINE_THRESHOLD (64 * 1024)
+//Number of columns rendered before the requested column of a long row
+#define LONG_LINE_MARGIN 4096
+//Number of columns rendered in the window of a long row
+#define LONG_LINE_WINDOW (4 * LONG_LINE_MARGIN)
+
+/*
+ * The row table is split into separate packed arrays, so sweeps over every
+ * row (saving, searching, highlighting, drawing) only touch the data they need:
+ *  - struct EditorRow holds the text, which is only touched by edits and saves
+ *  - struct EditorRowRender holds the rendered text, read on every frame
+ *  - the multi-line comment state of each row is kept in its own bool array
+ * The index of a row is its position in these arrays.
+ */
+
+/*
+ * Index of the chars of a row which aren't one byte taking up one column (tabs and
+ * multi-byte UTF-8 sequences), so cx and rx can be converted without scanning the row.
+ * Between two indexed chars every byte takes up exactly one column.
+ */
+struct EditorColumnIndex {
+    //cx of each indexed char, in order
+    int64_t *cx;
+    //Number of bytes in each indexed char
+    unsigned char *len;
+    //rx just after each indexed char
+    int64_t *rx;
+    int64_t count;
+    int64_t capacity;
+    //Number of rx values which are up to date, the rest are recomputed when needed
+    int64_t validRx;
+};
+
 struct EditorRow {
-    //Index in rows array
-    int idx;
     //Size of chars in line
-    int size;
-    //size of the chars rendered in the line
-    int rsize;
+    int64_t size;
+    //Allocated size of chars
+    int64_t capacity;
     char *chars;
+    struct EditorColumnIndex cols;
+};
+
+struct EditorRowRender {
+    //rx of the first char rendered, only non-zero in long-line mode
+    int64_t rstart;
+    //size of the chars rendered in the line, in bytes
+    int rsize;
+    //number of columns rendered
+    int rwidth;
     //chars rendered
     char *render;
     //highlighting color for each char
     unsigned char *hl;
-    //Whether the previous line is part of an unclosed multi-line comment
-    bool hlOpenComment;
 };
 
-int editorRowCxToRx(struct EditorRow *row, int cx);
+bool editorRowIsLong(struct EditorRow *row);
+
+char *editorAllocRowChars(size_t len);
+
+char *editorRetainRowChars(char *chars);
+
+void editorReleaseRowChars(char *chars);
+
+unsigned char *editorRetainRowHl(unsigned char *hl);
+
+void editorReleaseRowHl(unsigned char *hl);
+
+void editorRowReserveHl(struct EditorRowRender *rrow);
 
-int editorRowRxToCx(struct EditorRow *row, int rx);
+void editorRowUnshareHl(struct EditorRowRender *rrow);
 
-void editorUpdateRowRender(struct EditorRow *row);
+int64_t editorRowCxToRx(struct EditorRow *row, int64_t cx);
 
-void editorRowInsertChar(struct EditorRow *row, int at, int c);
+int64_t editorRowRxToCx(struct EditorRow *row, int64_t rx);
+
+void editorInitRow(struct EditorRow *row, struct EditorRowRender *rrow, const char *s, size_t len);
+
+void editorInitRowOwned(struct EditorRow *row, struct EditorRowRender *rrow, char *chars, size_t len);
+
+void editorUpdateRowRender(struct EditorRow *row, struct EditorRowRender *rrow);
+
+void editorUpdateRowRenderWindow(struct EditorRow *row, struct EditorRowRender *rrow, int64_t rx);
+
+bool editorRowRenderCovers(struct EditorRow *row, struct EditorRowRender *rrow, int64_t rx, int width);
+
+int64_t editorRowNextChar(struct EditorRow *row, int64_t cx);
+
+int64_t editorRowPrevChar(struct EditorRow *row, int64_t cx);
+
+int64_t editorRowCharStart(struct EditorRow *row, int64_t cx);
+
+void editorRowInsertChar(struct EditorRow *row, int64_t at, int c);
+
+void editorRowInsertString(struct EditorRow *row, int64_t at, const char *s, size_t len);
 
 void editorRowAppendString(struct EditorRow *row, char *s, size_t len);
 
-bool editorRowDelChar(struct EditorRow *row, int at);
+bool editorRowDelChar(struct EditorRow *row, int64_t at);
+
+void editorRowTruncate(struct EditorRow *row, int64_t at);
+
+long long editorRowReplaceAll(struct EditorRow *row, const char *needle, size_t needleLen,
+                              const char *replacement, size_t replacementLen);
+
+uint64_t editorLineHash(const char *s, size_t len);
+
+uint64_t editorRowHash(struct EditorRow *row);
 
-void editorFreeRow(struct EditorRow *row);
+void editorFreeRow(struct EditorRow *row, struct EditorRowRender *rrow);
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+//Longest a client can take to make room for a frame before it's dropped
+#define SEND_TIMEOUT_MS 1000
+
+/**
+ * Picks the socket a server listens on when no path is given:
+ * in $XDG_RUNTIME_DIR if it's set, otherwise in /tmp with the user id in the name.
+ */
+void serverDefaultPath(char *buf, size_t size) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && dir[0]) snprintf(buf, size, "%s/pound.sock", dir);
+    else snprintf(buf, size, "/tmp/pound-%u.sock", (unsigned) getuid());
+}
+
+static int serverAddress(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/**
+ * Connects to a server.
+ *
+ * @param path of the server's socket
+ * @return the connected socket, or -1 if there's no server listening there
+ */
+int serverConnect(const char *path) {
+    struct sockaddr_un addr;
+    if (serverAddress(&addr, path) == -1) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Starts listening for clients. A socket left behind by a server which has exited is replaced,
+ * but not one which a server is still listening on.
+ *
+ * @param server to start
+ * @param path of the socket
+ * @return 0 if successful, -1 otherwise
+ */
+int serverListen(struct Server *server, const char *path) {
+    struct sockaddr_un addr;
+    if (serverAddress(&addr, path) == -1) return -1;
+
+    int running = serverConnect(path);
+    if (running != -1) {
+        close(running);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+
+    server->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->fd == -1) return -1;
+    if (bind(server->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(server->fd, 8) == -1) {
+        close(server->fd);
+        return -1;
+    }
+    server->path = strdup(path);
+    server->clients = NULL;
+    server->numClients = 0;
+    return 0;
+}
+
+static void serverAccept(struct Server *server) {
+    int fd;
+    while ((fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        struct ServerClient *client = calloc(1, sizeof(struct ServerClient));
+        if (client == NULL) {
+            close(fd);
+            return;
+        }
+        client->fd = fd;
+
+        struct ServerClient **clients = realloc(server->clients,
+                                                sizeof(struct ServerClient *) * (size_t) (server->numClients + 1));
+        if (clients == NULL) {
+            close(fd);
+            free(client);
+            return;
+        }
+        server->clients = clients;
+        server->clients[server->numClients++] = client;
+    }
+}
+
+static uint16_t readUint16(const char *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Handles a whole message from a client.
+ *
+ * @return true if the client needs a new frame
+ */
+static bool serverHandle(struct ServerClient *client, char type, const char *data, size_t len) {
+    switch (type) {
+        case MSG_HELLO:
+            if (len < 5 || client->hello) break;
+            client->hello = true;
+            client->rows = readUint16(data);
+            client->cols = readUint16(data + 2);
+            client->flags = (unsigned char) data[4];
+            client->path = strndup(data + 5, len - 5);
+            return true;
+
+        case MSG_RESIZE:
+            if (len < 4) break;
+            client->rows = readUint16(data);
+            client->cols = readUint16(data + 2);
+            free(client->lineHash);
+            client->lineHash = NULL;
+            return true;
+
+        case MSG_KEYS:
+            //Drop the keys which have been read, rather than growing forever
+            if (client->inputPos == client->inputLen) client->inputPos = client->inputLen = 0;
+            if (client->inputLen + len > client->inputCap) {
+                client->inputCap = (client->inputLen + len) * 2;
+                client->input = realloc(client->input, client->inputCap);
+                if (client->input == NULL) {
+                    client->closed = true;
+                    break;
+                }
+            }
+            memcpy(&client->input[client->inputLen], data, len);
+            client->inputLen += len;
+            return false;
+
+        default:
+            break;
+    }
+    return false;
+}
+
+/**
+ * Reads what a client has sent, handling each whole message.
+ *
+ * @return true if the client needs a new frame
+ */
+static bool serverReceive(struct ServerClient *client) {
+    bool refresh = false;
+    while (1) {
+        if (client->recvCap - client->recvLen < 4096) {
+            client->recvCap = client->recvCap ? client->recvCap * 2 : 8192;
+            client->recv = realloc(client->recv, client->recvCap);
+            if (client->recv == NULL) {
+                client->closed = true;
+                return true;
+            }
+        }
+
+        ssize_t nread = read(client->fd, &client->recv[client->recvLen], client->recvCap - client->recvLen);
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread == -1 && errno == EAGAIN) break;
+        if (nread <= 0) {
+            client->closed = true;
+            return true;
+        }
+        client->recvLen += (size_t) nread;
+    }
+
+    size_t pos = 0;
+    while (client->recvLen - pos >= MSG_HEADER_SIZE) {
+        uint32_t len;
+        memcpy(&len, &client->recv[pos + 1], sizeof(len));
+        if (client->recvLen - pos - MSG_HEADER_SIZE < len) break;
+        if (serverHandle(client, client->recv[pos], &client->recv[pos + MSG_HEADER_SIZE], len)) refresh = true;
+        pos += MSG_HEADER_SIZE + len;
+    }
+    memmove(client->recv, &client->recv[pos], client->recvLen - pos);
+    client->recvLen -= pos;
+    return refresh;
+}
+
+/**
+ * Waits for clients to connect or send something, and takes in what they sent.
+ *
+ * @param server to wait on
+ * @param timeout number of milliseconds to wait, or -1 to wait until something happens
+ * @return true if a client has attached, resized, or gone, so the screen needs to be redrawn
+ */
+bool serverPoll(struct Server *server, int timeout) {
+    struct pollfd pfds[server->numClients + 1];
+    pfds[0].fd = server->fd;
+    pfds[0].events = POLLIN;
+    for (int i = 0; i < server->numClients; i++) {
+        pfds[i + 1].fd = server->clients[i]->closed ? -1 : server->clients[i]->fd;
+        pfds[i + 1].events = POLLIN;
+    }
+
+    int ready = poll(pfds, (nfds_t) server->numClients + 1, timeout);
+    if (ready <= 0) return false;
+
+    bool refresh = false;
+    int numClients = server->numClients;
+    for (int i = 0; i < numClients; i++) {
+        if (pfds[i + 1].revents && serverReceive(server->clients[i])) refresh = true;
+    }
+    if (pfds[0].revents & POLLIN) serverAccept(server);
+    return refresh;
+}
+
+/**
+ * Reads a key the client typed.
+ *
+ * @param client to read from
+ * @param c set to the byte read
+ * @return 1 if a byte was read, 0 if there are none waiting
+ */
+int serverRead(struct ServerClient *client, char *c) {
+    if (client->inputPos == client->inputLen) return 0;
+    *c = client->input[client->inputPos++];
+    return 1;
+}
+
+/**
+ * Writes a whole message to a socket, waiting for room if it's non-blocking.
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int serverWriteMessage(int fd, char type, const char *data, size_t len) {
+    char header[MSG_HEADER_SIZE];
+    uint32_t len32 = (uint32_t) len;
+    header[0] = type;
+    memcpy(&header[1], &len32, sizeof(len32));
+
+    const char *parts[] = {header, data};
+    size_t lens[] = {MSG_HEADER_SIZE, len};
+    for (int i = 0; i < 2; i++) {
+        size_t sent = 0;
+        while (sent < lens[i]) {
+            //MSG_NOSIGNAL, so a client which has gone doesn't kill the server with SIGPIPE
+            ssize_t n = send(fd, parts[i] + sent, lens[i] - sent, MSG_NOSIGNAL);
+            if (n >= 0) {
+                sent += (size_t) n;
+            } else if (errno == EAGAIN) {
+                struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+                if (poll(&pfd, 1, SEND_TIMEOUT_MS) <= 0) return -1;
+            } else if (errno != EINTR) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Sends a message to a client, marking it closed if it can't take it.
+ */
+void serverSend(struct ServerClient *client, char type, const char *data, size_t len) {
+    if (client->closed) return;
+    if (serverWriteMessage(client->fd, type, data, len) == -1) client->closed = true;
+}
+
+/**
+ * Reads a whole message from a blocking socket.
+ *
+ * @param data set to the payload, which the caller must free
+ * @return 0 if successful, -1 on error or once the other end has gone
+ */
+int serverReadMessage(int fd, char *type, char **data, size_t *len) {
+    char header[MSG_HEADER_SIZE];
+    size_t got = 0;
+    while (got < MSG_HEADER_SIZE) {
+        ssize_t n = read(fd, &header[got], MSG_HEADER_SIZE - got);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += (size_t) n;
+    }
+
+    uint32_t len32;
+    memcpy(&len32, &header[1], sizeof(len32));
+    *type = header[0];
+    *len = len32;
+    *data = malloc(*len + 1);
+    if (*data == NULL) return -1;
+
+    got = 0;
+    while (got < *len) {
+        ssize_t n = read(fd, &(*data)[got], *len - got);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            free(*data);
+            return -1;
+        }
+        got += (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * Disconnects a client and frees it.
+ */
+void serverClose(struct Server *server, struct ServerClient *client) {
+    for (int i = 0; i < server->numClients; i++) {
+        if (server->clients[i] != client) continue;
+        memmove(&server->clients[i], &server->clients[i + 1],
+                sizeof(struct ServerClient *) * (size_t) (server->numClients - i - 1));
+        server->numClients--;
+        break;
+    }
+
+    close(client->fd);
+    free(client->recv);
+    free(client->input);
+    free(client->path);
+    free(client->lineHash);
+    free(client);
+}
+
+/**
+ * Disconnects every client and removes the socket.
+ */
+void serverStop(struct Server *server) {
+    while (server->numClients > 0) serverClose(server, server->clients[0]);
+    free(server->clients);
+    close(server->fd);
+    unlink(server->path);
+    free(server->path);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Messages between a pound server and the clients attached to it over a Unix socket.
+ *
+ * Each message is a type byte followed by the length of its payload (a native uint32,
+ * as both ends are on the same machine) and then the payload.
+ */
+
+//Client to server: uint16 rows, uint16 cols, uint8 flags, then the path of the file to show (may be empty)
+#define MSG_HELLO 'h'
+//Client to server: bytes typed into the client's terminal
+#define MSG_KEYS 'k'
+//Client to server: uint16 rows, uint16 cols
+#define MSG_RESIZE 'r'
+//Server to client: bytes to write to the client's terminal
+#define MSG_OUTPUT 'o'
+//Server to client: the client has been detached and should exit
+#define MSG_EXIT 'x'
+
+#define MSG_HEADER_SIZE 5
+
+//The client's terminal supports synchronized output
+#define HELLO_SYNC_UPDATE (1<<0)
+//The file should be opened read-only in the viewer
+#define HELLO_VIEW (1<<1)
+
+struct ServerClient {
+    int fd;
+    //Bytes received which don't make up a whole message yet
+    char *recv;
+    size_t recvLen;
+    size_t recvCap;
+    //Keys received which haven't been read yet
+    char *input;
+    size_t inputLen;
+    size_t inputPos;
+    size_t inputCap;
+    //Whether the hello has been received, and whether the editor has set the client up since
+    bool hello;
+    bool attached;
+    //Whether the client has gone, so it should be closed
+    bool closed;
+    int rows, cols;
+    int flags;
+    char *path;
+    //Index of the buffer the client is showing
+    int buffer;
+    //Message shown in the client's status bar, kept while other clients are being served
+    char statusMsg[80];
+    time_t statusMsgTime;
+    //Hash of each screen line last sent to the client, or NULL if the next frame has to be sent whole
+    uint64_t *lineHash;
+    int numLines;
+    //Hash of what followed the screen lines in the last frame, which places the cursor
+    uint64_t tailHash;
+};
+
+struct Server {
+    int fd;
+    char *path;
+    struct ServerClient **clients;
+    int numClients;
+};
+
+void serverDefaultPath(char *buf, size_t size);
+
+int serverListen(struct Server *server, const char *path);
+
+bool serverPoll(struct Server *server, int timeout);
+
+int serverRead(struct ServerClient *client, char *c);
+
+void serverSend(struct ServerClient *client, char type, const char *data, size_t len);
+
+void serverClose(struct Server *server, struct ServerClient *client);
+
+void serverStop(struct Server *server);
+
+int serverConnect(const char *path);
+
+int serverReadMessage(int fd, char *type, char **data, size_t *len);
+
+int serverWriteMessage(int fd, char type, const char *data, size_t len);
@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+static void *streamRead(void *arg) {
+    struct Stream *stream = arg;
+
+    while (1) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->queued >= STREAM_MAX_QUEUED && !stream->stopping)
+            pthread_cond_wait(&stream->taken, &stream->lock);
+        bool stopping = stream->stopping;
+        pthread_mutex_unlock(&stream->lock);
+        if (stopping) break;
+
+        //Running out of memory ends the stream with an error, like failing to read it does
+        struct StreamChunk *chunk = malloc(sizeof(struct StreamChunk) + STREAM_CHUNK_SIZE);
+        ssize_t nread = -1;
+        if (chunk == NULL) {
+            errno = ENOMEM;
+        } else {
+            do {
+                nread = read(stream->fd, chunk->data, STREAM_CHUNK_SIZE);
+            } while (nread == -1 && errno == EINTR);
+        }
+
+        if (nread <= 0) {
+            free(chunk);
+            pthread_mutex_lock(&stream->lock);
+            stream->done = true;
+            stream->error = nread == -1 ? errno : 0;
+            pthread_mutex_unlock(&stream->lock);
+            break;
+        }
+
+        //Pipes rarely fill a whole chunk, so only keep what was read
+        struct StreamChunk *shrunk = realloc(chunk, sizeof(struct StreamChunk) + (size_t) nread);
+        if (shrunk) chunk = shrunk;
+        chunk->next = NULL;
+        chunk->len = (size_t) nread;
+
+        pthread_mutex_lock(&stream->lock);
+        if (stream->tail) stream->tail->next = chunk;
+        else stream->head = chunk;
+        stream->tail = chunk;
+        stream->queued += chunk->len;
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts reading the specified file descriptor on a background thread.
+ *
+ * @param stream to start
+ * @param fd to read, which is closed when the stream is stopped
+ * @return 0 if successful, -1 otherwise
+ */
+int streamStart(struct Stream *stream, int fd) {
+    stream->fd = fd;
+    stream->head = NULL;
+    stream->tail = NULL;
+    stream->queued = 0;
+    stream->done = false;
+    stream->error = 0;
+    stream->stopping = false;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->taken, NULL);
+
+    if (pthread_create(&stream->thread, NULL, streamRead, stream) != 0) return -1;
+    return 0;
+}
+
+/**
+ * Takes every chunk which has been read so far.
+ *
+ * @param stream to take from
+ * @param done set to whether the end of the stream has been reached
+ * @param error set to the errno of the error which ended the stream, or 0
+ * @return linked list of chunks, which the caller must free, or NULL if nothing new was read
+ */
+struct StreamChunk *streamTake(struct Stream *stream, bool *done, int *error) {
+    pthread_mutex_lock(&stream->lock);
+    struct StreamChunk *chunks = stream->head;
+    stream->head = NULL;
+    stream->tail = NULL;
+    stream->queued = 0;
+    *done = stream->done;
+    *error = stream->error;
+    pthread_cond_signal(&stream->taken);
+    pthread_mutex_unlock(&stream->lock);
+    return chunks;
+}
+
+/**
+ * Stops the background thread, which must have reached the end of the stream
+ * unless it's waiting for chunks to be taken, and frees what's left of the stream.
+ */
+void streamStop(struct Stream *stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->stopping = true;
+    pthread_cond_signal(&stream->taken);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+
+    while (stream->head) {
+        struct StreamChunk *next = stream->head->next;
+        free(stream->head);
+        stream->head = next;
+    }
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->taken);
+    close(stream->fd);
+}
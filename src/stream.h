@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Maximum number of bytes read from the stream at once
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+//Number of bytes which can be waiting to be taken before the reader stops reading
+#define STREAM_MAX_QUEUED (64 * 1024 * 1024)
+
+struct StreamChunk {
+    struct StreamChunk *next;
+    size_t len;
+    char data[];
+};
+
+/*
+ * Reads a file descriptor, such as a pipe, on a background thread.
+ * The chunks read are queued until they are taken by the main thread.
+ */
+struct Stream {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    //Signalled when chunks are taken, so the reader can carry on if it was stopped
+    pthread_cond_t taken;
+    struct StreamChunk *head;
+    struct StreamChunk *tail;
+    size_t queued;
+    //Whether the end of the stream (or an error) was reached
+    bool done;
+    //errno of the error which ended the stream, or 0
+    int error;
+    bool stopping;
+};
+
+int streamStart(struct Stream *stream, int fd);
+
+struct StreamChunk *streamTake(struct Stream *stream, bool *done, int *error);
+
+void streamStop(struct Stream *stream);
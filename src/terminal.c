@@ -1,6 +1,9 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -82,6 +85,25 @@ void enableRawMode() {
     }
 }
 
+/**
+ * Points stdin at the controlling terminal, so keys can still be read
+ * when stdin is a pipe that the file is being read from.
+ *
+ * @return file descriptor for what stdin was before, or -1 if there is no terminal
+ */
+int terminalReopenStdin() {
+    int tty = open("/dev/tty", O_RDWR);
+    if (tty == -1) return -1;
+
+    int fd = dup(STDIN_FILENO);
+    if (fd == -1 || dup2(tty, STDIN_FILENO) == -1) {
+        close(tty);
+        return -1;
+    }
+    close(tty);
+    return fd;
+}
+
 /**
  * Writes the specified command into he terminal.
  *
@@ -93,6 +115,45 @@ int terminalWrite(char *s, int len) {
     return (result >= 0 && result == len) ? 0 : -1;
 }
 
+/**
+ * Checks whether there is input waiting to be read.
+ *
+ * @param timeout number of milliseconds to wait for input, or -1 to wait until there is some
+ * @return true if there is input waiting, false if the timeout passed or a signal arrived
+ */
+bool terminalInputPending(int timeout) {
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready == -1 && errno != EINTR) die("poll");
+    return ready > 0;
+}
+
+/**
+ * Asks the terminal whether it supports synchronized output (DEC private mode 2026).
+ *
+ * The DECRQM query is followed by a cursor position request, which every terminal
+ * answers, so terminals which don't know the query don't have to be waited on.
+ *
+ * @return true if the mode is supported
+ */
+bool terminalSupportsSyncUpdate() {
+    if (terminalWrite(SYNC_UPDATE_QUERY_CMD) || terminalWrite(CURSOR_POSITION_CMD)) return false;
+
+    char buf[64];
+    unsigned int i = 0;
+    while (i < sizeof(buf) - 1) {
+        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+        if (buf[i] == 'R') break;
+        i++;
+    }
+    buf[i] = '\0';
+
+    //The reply is ESC [ ? 2026 ; Ps $ y, where Ps is 1 (set), 2 (reset) or 3 (permanently set) if the mode can be
+    //used, while 0 is unknown and 4 is permanently reset
+    char *reply = strstr(buf, "\x1b[?2026;");
+    return reply && reply[8] >= '1' && reply[8] <= '3' && reply[9] == '$';
+}
+
 /**
  * Sets the row and column values of the position of the cursor
  * to the specified pointers.
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #define CLEAR_DISPLAY_CMD "\x1b[2J"
 
 #define INVERT_COLOR_CMD "\x1b[7m", 4
+#define NO_INVERT_COLOR_CMD "\x1b[27m", 5
 #define RESET_RENDITION_CMD "\x1b[m", 3
 
 #define RESET_COLOR_CMD "\x1b[39m", 5
@@ -15,6 +17,11 @@
 
 #define ERASE_PAST_CURSOR_CMD "\x1b[K", 3
 
+//Synchronized output (DEC private mode 2026): the terminal holds back drawing until the end of the update
+#define SYNC_UPDATE_BEGIN_CMD "\x1b[?2026h", 8
+#define SYNC_UPDATE_END_CMD "\x1b[?2026l", 8
+#define SYNC_UPDATE_QUERY_CMD "\x1b[?2026$p", 9
+
 /**
  * Sets the specified string to the terminal command to set the text color.
  *
@@ -59,8 +66,14 @@ void die(const char *s);
 
 void enableRawMode();
 
+int terminalReopenStdin();
+
 int terminalWrite(char *s, int len);
 
+bool terminalInputPending(int timeout);
+
+bool terminalSupportsSyncUpdate();
+
 int getCursorPosition(int *rows, int *cols);
 
 int getWindowSize(int *rows, int *cols);
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+
+bool traceEnabled = false;
+
+static const char *probeNames[TRACE_PROBES] = {"input", "highlight", "draw", "write"};
+
+struct ProbeTiming {
+    //Whether the probe has begun and not ended yet
+    bool active;
+    long long start;
+    //Start of the first time the probe ran in the frame
+    long long first;
+    //Total time the probe ran for in the frame, leaving out the time of any probes nested in it
+    long long total;
+    int calls;
+};
+
+static struct ProbeTiming probes[TRACE_PROBES];
+//Probes which have begun and not ended yet, in the order they began, only the last of which is being timed
+static enum TraceProbe nested[TRACE_PROBES];
+static int depth = 0;
+//Total time each probe ran for in the last frame
+static long long lastFrame[TRACE_PROBES];
+//File the trace events of every frame are written to, or NULL
+static FILE *traceFile = NULL;
+static unsigned long frames = 0;
+static bool firstEvent = true;
+
+static long long traceNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Starts timing a probe. A probe which began before it and hasn't ended is paused until it ends,
+ * so highlighting done while handling a key or drawing isn't counted in both.
+ */
+void traceBeginProbe(enum TraceProbe probe) {
+    struct ProbeTiming *timing = &probes[probe];
+    if (timing->active) return;
+    long long now = traceNow();
+    if (depth > 0) {
+        struct ProbeTiming *outer = &probes[nested[depth - 1]];
+        outer->total += now - outer->start;
+    }
+    nested[depth++] = probe;
+    timing->active = true;
+    timing->start = now;
+    if (timing->calls == 0) timing->first = timing->start;
+}
+
+/**
+ * Stops timing a probe, carrying on timing the probe it was nested in.
+ */
+void traceEndProbe(enum TraceProbe probe) {
+    struct ProbeTiming *timing = &probes[probe];
+    if (!timing->active) return;
+    long long now = traceNow();
+    timing->active = false;
+    timing->calls++;
+
+    //Probes are normally ended in the reverse order they began, but one may outlive a probe nested in it
+    int at = depth - 1;
+    while (nested[at] != probe) at--;
+    if (at == depth - 1) {
+        timing->total += now - timing->start;
+        if (at > 0) probes[nested[at - 1]].start = now;
+    }
+    for (int i = at; i < depth - 1; i++) nested[i] = nested[i + 1];
+    depth--;
+}
+
+/**
+ * Finishes the frame which was just written, keeping its timings for the HUD
+ * and adding them to the trace file.
+ */
+void traceEndFrame() {
+    for (int i = 0; i < TRACE_PROBES; i++) {
+        struct ProbeTiming *timing = &probes[i];
+        lastFrame[i] = timing->total;
+        if (traceFile && timing->calls > 0) {
+            fprintf(traceFile, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                               "\"pid\":1,\"tid\":1,\"args\":{\"frame\":%lu,\"calls\":%d}}",
+                    firstEvent ? "" : ",\n", probeNames[i], (double) timing->first / 1000,
+                    (double) timing->total / 1000, frames, timing->calls);
+            firstEvent = false;
+        }
+        timing->total = 0;
+        timing->calls = 0;
+    }
+    frames++;
+}
+
+/**
+ * Starts writing the timings of every frame to a file, as Chrome trace events.
+ *
+ * @param path of the file
+ * @return 0 if successful, -1 otherwise
+ */
+int traceStart(const char *path) {
+    traceFile = fopen(path, "w");
+    if (traceFile == NULL) return -1;
+    //The JSON array format, which can be left unterminated if pound doesn't exit cleanly
+    fputs("[\n", traceFile);
+    traceEnabled = true;
+    return 0;
+}
+
+/**
+ * Turns timing on or off, it's always on while a trace file is being written.
+ */
+void traceSetEnabled(bool enabled) {
+    traceEnabled = enabled || traceFile != NULL;
+    for (int i = 0; i < TRACE_PROBES; i++) probes[i].active = false;
+    depth = 0;
+}
+
+/**
+ * Formats how long each part of the last frame took, in milliseconds. Each probe's time leaves out the
+ * probes nested in it, so they add up to the time of the whole frame.
+ */
+void traceFormat(char *buf, size_t size) {
+    snprintf(buf, size, "in %.2f hl %.2f draw %.2f wr %.2f ms",
+             (double) lastFrame[TRACE_INPUT] / 1e6, (double) lastFrame[TRACE_HIGHLIGHT] / 1e6,
+             (double) lastFrame[TRACE_DRAW] / 1e6, (double) lastFrame[TRACE_WRITE] / 1e6);
+}
+
+void traceStop() {
+    if (traceFile == NULL) return;
+    fputs("\n]\n", traceFile);
+    fclose(traceFile);
+    traceFile = NULL;
+}
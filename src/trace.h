@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+//Parts of handling a key and drawing a frame which are timed
+enum TraceProbe {
+    //Decoding and handling the key, from when it's read until the next frame or wait for input
+    TRACE_INPUT = 0,
+    TRACE_HIGHLIGHT,
+    TRACE_DRAW,
+    TRACE_WRITE,
+    TRACE_PROBES
+};
+
+//Whether the probes are timing, checked inline so disabled probes are a single branch
+extern bool traceEnabled;
+
+void traceBeginProbe(enum TraceProbe probe);
+
+void traceEndProbe(enum TraceProbe probe);
+
+void traceEndFrame();
+
+static inline void traceBegin(enum TraceProbe probe) {
+    if (__builtin_expect(traceEnabled, 0)) traceBeginProbe(probe);
+}
+
+static inline void traceEnd(enum TraceProbe probe) {
+    if (__builtin_expect(traceEnabled, 0)) traceEndProbe(probe);
+}
+
+static inline void traceFrame() {
+    if (__builtin_expect(traceEnabled, 0)) traceEndFrame();
+}
+
+int traceStart(const char *path);
+
+void traceSetEnabled(bool enabled);
+
+void traceFormat(char *buf, size_t size);
+
+void traceStop();
@@ -0,0 +1,304 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "treap.h"
+
+/**
+ * Gets the priority of a node, which is worked out from its index rather than being stored.
+ * Parents have higher priorities than their children.
+ *
+ * The number of trailing zero bits of the index puts the node on a level, like the levels of a
+ * skip list, and a hash of the index orders the nodes on the same level. Nodes 1 to n handed out
+ * in order then make a perfectly balanced tree, which treapBuild builds directly, while nodes
+ * handed out later end up at random heights, as in any treap.
+ */
+static uint32_t treapPriority(int node) {
+    uint32_t x = (uint32_t) node;
+    uint32_t level = 0;
+    while (!(x >> level & 1)) level++;
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return level << 27 | x >> 5;
+}
+
+/**
+ * Starts an empty treap.
+ *
+ * @param treap to start
+ * @param payloadSize number of bytes of the payload of each node, a multiple of sizeof(int)
+ * @param pull works out what a node's payload says about its subtree
+ */
+void treapInit(struct Treap *treap, size_t payloadSize, TreapPull pull) {
+    treap->numRows = 0;
+    treap->root = 0;
+    treap->pool = NULL;
+    treap->stride = sizeof(struct TreapNode) + payloadSize;
+    treap->payloadSize = payloadSize;
+    treap->capacity = 0;
+    treap->used = 0;
+    treap->freeNode = 0;
+    treap->pull = pull;
+}
+
+static void treapReserve(struct Treap *treap, int capacity) {
+    if (capacity <= treap->capacity) return;
+    treap->capacity = capacity;
+    treap->pool = realloc(treap->pool, treap->stride * (size_t) capacity);
+    if (treap->pool == NULL) die("realloc");
+}
+
+static int treapNodeAlloc(struct Treap *treap) {
+    int node = treap->freeNode;
+    if (node != 0) {
+        treap->freeNode = treapNode(treap, node)->left;
+    } else {
+        //Node 0 is the empty subtree
+        if (treap->used == 0) {
+            treapReserve(treap, 64);
+            memset(treapNode(treap, treap->used++), 0, treap->stride);
+        }
+        if (treap->used == treap->capacity) treapReserve(treap, treap->capacity * 2);
+        node = treap->used++;
+    }
+    *treapNode(treap, node) = (struct TreapNode) {0, 0, 1};
+    return node;
+}
+
+/**
+ * Frees every node of a subtree, from its last row back. They're handed out again in the order of
+ * their rows, so rows built from them get their priorities in the same order and a tree as well
+ * balanced as the one they came from. Freeing the root first would hand out the highest priorities
+ * first, and the rows built from them would make a chain.
+ */
+static void treapNodeFree(struct Treap *treap, int node) {
+    if (node == 0) return;
+    struct TreapNode *n = treapNode(treap, node);
+    int left = n->left;
+    treapNodeFree(treap, n->right);
+    n->left = treap->freeNode;
+    treap->freeNode = node;
+    treapNodeFree(treap, left);
+}
+
+/**
+ * Gives a node new children, pulling its subtree's payload up from them again.
+ */
+static void treapLink(struct Treap *treap, int node, int left, int right) {
+    struct TreapNode *n = treapNode(treap, node);
+    n->left = left;
+    n->right = right;
+    n->size = treapNode(treap, left)->size + 1 + treapNode(treap, right)->size;
+    treap->pull(n + 1, treapPayload(treap, left), treapPayload(treap, right));
+}
+
+/**
+ * Splits a subtree in two, in O(log n).
+ *
+ * @param node root of the subtree
+ * @param count number of rows to put in the first part
+ * @param left set to the root of the first count rows
+ * @param right set to the root of the rest of the rows
+ */
+static void treapSplit(struct Treap *treap, int node, int count, int *left, int *right) {
+    if (node == 0) {
+        *left = *right = 0;
+        return;
+    }
+
+    struct TreapNode n = *treapNode(treap, node);
+    int leftSize = treapNode(treap, n.left)->size;
+    int sub;
+    if (count <= leftSize) {
+        treapSplit(treap, n.left, count, left, &sub);
+        treapLink(treap, node, sub, n.right);
+        *right = node;
+    } else {
+        treapSplit(treap, n.right, count - leftSize - 1, &sub, right);
+        treapLink(treap, node, n.left, sub);
+        *left = node;
+    }
+}
+
+/**
+ * Joins two subtrees, the rows of the first coming before those of the second, in O(log n).
+ *
+ * @return root of the joined subtree
+ */
+static int treapMerge(struct Treap *treap, int left, int right) {
+    if (left == 0) return right;
+    if (right == 0) return left;
+
+    if (treapPriority(left) > treapPriority(right)) {
+        struct TreapNode n = *treapNode(treap, left);
+        treapLink(treap, left, n.left, treapMerge(treap, n.right, right));
+        return left;
+    }
+    struct TreapNode n = *treapNode(treap, right);
+    treapLink(treap, right, treapMerge(treap, left, n.left), n.right);
+    return right;
+}
+
+/**
+ * Builds a subtree of rows in O(n), keeping a stack of the nodes down its right-hand side.
+ * A node only gets its payload pulled up once it's taken off the stack, when its subtree is finished.
+ *
+ * @param count number of rows
+ * @param init fills in the payload of each row
+ * @param rows passed to init
+ * @return root of the subtree
+ */
+static int treapBuildNodes(struct Treap *treap, int count, TreapInit init, const void *rows) {
+    if (count == 0) return 0;
+    //The right-hand side is only O(log n) nodes long, so the stack starts small rather than with room for every row
+    struct {
+        int node;
+        uint32_t priority;
+    } *stack = NULL;
+    int stackCap = 0;
+
+    int top = 0;
+    for (int i = 0; i < count; i++) {
+        if (top == stackCap) {
+            stackCap = stackCap ? stackCap * 2 : 64;
+            stack = realloc(stack, sizeof(*stack) * (size_t) stackCap);
+            if (stack == NULL) die("realloc");
+        }
+        int node = treapNodeAlloc(treap);
+        uint32_t priority = treapPriority(node);
+        init(treapPayload(treap, node), i, rows);
+        int last = 0;
+        while (top > 0 && stack[top - 1].priority < priority) {
+            last = stack[--top].node;
+            struct TreapNode *n = treapNode(treap, last);
+            treapLink(treap, last, n->left, n->right);
+        }
+        treapNode(treap, node)->left = last;
+        if (top > 0) treapNode(treap, stack[top - 1].node)->right = node;
+        stack[top].node = node;
+        stack[top++].priority = priority;
+    }
+    while (top > 0) {
+        int last = stack[--top].node;
+        struct TreapNode *n = treapNode(treap, last);
+        treapLink(treap, last, n->left, n->right);
+    }
+    int root = stack[0].node;
+    free(stack);
+    return root;
+}
+
+/**
+ * Builds the subtree of a node of a tree made by treapBuild, from the bottom up.
+ *
+ * @param node at the top of the subtree, which may be past the last row
+ * @param step lowest set bit of node
+ * @return node at the top of the rows of the subtree which there are, 0 if there are none
+ */
+static int treapBuildBalanced(struct Treap *treap, int node, int step, int numRows, TreapInit init, const void *rows) {
+    //Past the last row, only the left subtree has any rows in it
+    while (node > numRows) {
+        if (step == 1) return 0;
+        step /= 2;
+        node -= step;
+    }
+
+    int left = 0, right = 0;
+    if (step > 1) {
+        left = treapBuildBalanced(treap, node - step / 2, step / 2, numRows, init, rows);
+        right = treapBuildBalanced(treap, node + step / 2, step / 2, numRows, init, rows);
+    }
+    init(treapPayload(treap, node), node - 1, rows);
+    treapLink(treap, node, left, right);
+    return node;
+}
+
+/**
+ * Replaces every row of the treap, in O(n).
+ *
+ * Row i goes in node i + 1. With the priorities treapPriority gives them, the tree is then the one
+ * a binary search of the nodes walks down: node i has the nodes i - L / 2 and i + L / 2 as its
+ * children, where L is its lowest set bit. So it's built directly, without comparing any priorities.
+ *
+ * @param treap to build
+ * @param numRows number of rows
+ * @param init fills in the payload of each row
+ * @param rows passed to init
+ */
+void treapBuild(struct Treap *treap, int numRows, TreapInit init, const void *rows) {
+    //Node 0 is the empty subtree
+    treapReserve(treap, numRows + 1);
+    memset(treapNode(treap, 0), 0, treap->stride);
+    treap->used = numRows + 1;
+    treap->freeNode = 0;
+
+    int root = numRows > 0 ? 1 : 0;
+    while (root > 0 && root <= numRows / 2) root *= 2;
+    treap->root = root > 0 ? treapBuildBalanced(treap, root, root, numRows, init, rows) : 0;
+    treap->numRows = numRows;
+}
+
+/**
+ * Replaces a range of rows, in O(log n) plus the number of rows replaced.
+ *
+ * @param treap to update
+ * @param at index of the first row replaced
+ * @param delCount number of rows removed
+ * @param insCount number of rows inserted in their place
+ * @param init fills in the payload of each row inserted
+ * @param rows passed to init
+ */
+void treapSplice(struct Treap *treap, int at, int delCount, int insCount, TreapInit init, const void *rows) {
+    int left, removed, right;
+    treapSplit(treap, treap->root, at, &left, &right);
+    treapSplit(treap, right, delCount, &removed, &right);
+    treapNodeFree(treap, removed);
+
+    int inserted = treapBuildNodes(treap, insCount, init, rows);
+    treap->root = treapMerge(treap, treapMerge(treap, left, inserted), right);
+    treap->numRows += insCount - delCount;
+}
+
+/**
+ * Gets the payload of a row, in O(log n). Once what it says about the row has been changed,
+ * treapPullRow has to be called to update the subtrees it's in.
+ */
+void *treapRow(struct Treap *treap, int at) {
+    int node = treap->root;
+    while (node != 0) {
+        struct TreapNode *n = treapNode(treap, node);
+        int leftSize = treapNode(treap, n->left)->size;
+        if (at == leftSize) break;
+        if (at < leftSize) {
+            node = n->left;
+        } else {
+            at -= leftSize + 1;
+            node = n->right;
+        }
+    }
+    return treapPayload(treap, node);
+}
+
+static void treapPullPath(struct Treap *treap, int node, int at) {
+    struct TreapNode *n = treapNode(treap, node);
+    int leftSize = treapNode(treap, n->left)->size;
+    if (at < leftSize) treapPullPath(treap, n->left, at);
+    else if (at > leftSize) treapPullPath(treap, n->right, at - leftSize - 1);
+    treap->pull(n + 1, treapPayload(treap, n->left), treapPayload(treap, n->right));
+}
+
+/**
+ * Updates the subtrees a row is in after its payload was changed, in O(log n).
+ */
+void treapPullRow(struct Treap *treap, int at) {
+    if (at < treap->numRows) treapPullPath(treap, treap->root, at);
+}
+
+void treapFree(struct Treap *treap) {
+    free(treap->pool);
+    treapInit(treap, treap->payloadSize, treap->pull);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A row in a treap, along with every row in its subtree. The payload of the treap's user follows it.
+ */
+struct TreapNode {
+    //Index of each child node, 0 if there isn't one
+    int left;
+    int right;
+    //Number of rows in the subtree
+    int size;
+};
+
+/*
+ * Works out what a node's payload says about its subtree from what it says about its own row
+ * and what its children's payloads say about theirs.
+ */
+typedef void (*TreapPull)(void *node, const void *left, const void *right);
+
+/*
+ * Fills in the payload of the i-th of a run of rows being added, from what it was added with.
+ */
+typedef void (*TreapInit)(void *node, int i, const void *rows);
+
+/*
+ * Rows kept in order in a treap, a binary tree balanced by giving each node a pseudo-random
+ * priority. Each node carries a payload of a fixed size, made of ints, with what its user
+ * needs to know about its row and its subtree. This way a row can be found by its index, or by
+ * searching down the payloads, and rows inserted or removed, in O(log n).
+ */
+struct Treap {
+    int numRows;
+    int root;
+    //Each node followed by its payload, node 0 standing for an empty subtree with a payload of zeros
+    char *pool;
+    size_t stride;
+    size_t payloadSize;
+    int capacity;
+    //Number of nodes which have been handed out, some of which may since have been freed
+    int used;
+    //First free node, each free node's left is the next, 0 if there are none
+    int freeNode;
+    TreapPull pull;
+};
+
+static inline struct TreapNode *treapNode(const struct Treap *treap, int node) {
+    return (struct TreapNode *) (treap->pool + (size_t) node * treap->stride);
+}
+
+static inline void *treapPayload(const struct Treap *treap, int node) {
+    return treapNode(treap, node) + 1;
+}
+
+void treapInit(struct Treap *treap, size_t payloadSize, TreapPull pull);
+
+void treapBuild(struct Treap *treap, int numRows, TreapInit init, const void *rows);
+
+void treapSplice(struct Treap *treap, int at, int delCount, int insCount, TreapInit init, const void *rows);
+
+void *treapRow(struct Treap *treap, int at);
+
+void treapPullRow(struct Treap *treap, int at);
+
+void treapFree(struct Treap *treap);
@@ -0,0 +1,216 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "utf8.h"
+
+/**
+ * Decodes the UTF-8 sequence at the start of the specified string.
+ *
+ * Invalid, overlong and truncated sequences decode as a single byte.
+ *
+ * @param s string to decode from
+ * @param len number of bytes available in s
+ * @param codepoint set to the decoded code point, or the byte if the sequence is invalid
+ * @return number of bytes in the sequence
+ */
+int utf8Decode(const char *s, int len, int *codepoint) {
+    const unsigned char *u = (const unsigned char *) s;
+    *codepoint = u[0];
+    if (u[0] < 0x80) return 1;
+
+    int seqLen, cp, min;
+    if ((u[0] & 0xe0) == 0xc0) {
+        seqLen = 2;
+        cp = u[0] & 0x1f;
+        min = 0x80;
+    } else if ((u[0] & 0xf0) == 0xe0) {
+        seqLen = 3;
+        cp = u[0] & 0x0f;
+        min = 0x800;
+    } else if ((u[0] & 0xf8) == 0xf0) {
+        seqLen = 4;
+        cp = u[0] & 0x07;
+        min = 0x10000;
+    } else {
+        return 1;
+    }
+
+    if (seqLen > len) return 1;
+    for (int i = 1; i < seqLen; i++) {
+        if ((u[i] & 0xc0) != 0x80) return 1;
+        cp = (cp << 6) | (u[i] & 0x3f);
+    }
+    if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return 1;
+
+    *codepoint = cp;
+    return seqLen;
+}
+
+/**
+ * Encodes a code point as UTF-8.
+ *
+ * @param codepoint to encode
+ * @param buf to write the sequence to
+ * @return number of bytes written
+ */
+int utf8Encode(int codepoint, char buf[UTF8_MAX_LEN]) {
+    if (codepoint < 0x80) {
+        buf[0] = (char) codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        buf[0] = (char) (0xc0 | (codepoint >> 6));
+        buf[1] = (char) (0x80 | (codepoint & 0x3f));
+        return 2;
+    } else if (codepoint < 0x10000) {
+        buf[0] = (char) (0xe0 | (codepoint >> 12));
+        buf[1] = (char) (0x80 | ((codepoint >> 6) & 0x3f));
+        buf[2] = (char) (0x80 | (codepoint & 0x3f));
+        return 3;
+    } else {
+        buf[0] = (char) (0xf0 | (codepoint >> 18));
+        buf[1] = (char) (0x80 | ((codepoint >> 12) & 0x3f));
+        buf[2] = (char) (0x80 | ((codepoint >> 6) & 0x3f));
+        buf[3] = (char) (0x80 | (codepoint & 0x3f));
+        return 4;
+    }
+}
+
+struct CodepointRange {
+    int first;
+    int last;
+};
+
+static const struct CodepointRange zeroWidth[] = {
+        {0x0300,  0x036f},
+        {0x0483,  0x0489},
+        {0x0591,  0x05bd},
+        {0x0610,  0x061a},
+        {0x064b,  0x065f},
+        {0x0e31,  0x0e31},
+        {0x0e34,  0x0e3a},
+        {0x1ab0,  0x1aff},
+        {0x1dc0,  0x1dff},
+        {0x200b,  0x200f},
+        {0x20d0,  0x20ff},
+        {0xfe00,  0xfe0f},
+        {0xfe20,  0xfe2f},
+        {0xe0100, 0xe01ef},
+};
+
+static const struct CodepointRange doubleWidth[] = {
+        {0x1100,  0x115f},
+        {0x2e80,  0x303e},
+        {0x3041,  0x33ff},
+        {0x3400,  0x4dbf},
+        {0x4e00,  0x9fff},
+        {0xa000,  0xa4cf},
+        {0xac00,  0xd7a3},
+        {0xf900,  0xfaff},
+        {0xfe30,  0xfe4f},
+        {0xff00,  0xff60},
+        {0xffe0,  0xffe6},
+        {0x1f300, 0x1f64f},
+        {0x1f900, 0x1f9ff},
+        {0x20000, 0x2fffd},
+        {0x30000, 0x3fffd},
+};
+
+static int inRanges(int codepoint, const struct CodepointRange *ranges, int count) {
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (codepoint < ranges[mid].first) hi = mid - 1;
+        else if (codepoint > ranges[mid].last) lo = mid + 1;
+        else return 1;
+    }
+    return 0;
+}
+
+/**
+ * Gets the number of columns a code point takes up in the terminal.
+ *
+ * Control characters count as one column, as they are drawn as a single inverted symbol.
+ *
+ * @param codepoint to get the width of
+ * @return 0, 1 or 2
+ */
+int utf8Width(int codepoint) {
+    if (codepoint < 0x300) return 1;
+    if (inRanges(codepoint, zeroWidth, sizeof(zeroWidth) / sizeof(zeroWidth[0]))) return 0;
+    if (inRanges(codepoint, doubleWidth, sizeof(doubleWidth) / sizeof(doubleWidth[0]))) return 2;
+    return 1;
+}
+
+/**
+ * Gets the number of bytes at the start of a string which are ASCII,
+ * checking 16 bytes at a time where SSE2 is available.
+ *
+ * @param s string to check
+ * @param len number of bytes in s
+ * @return index of the first non-ASCII byte, or len
+ */
+int utf8AsciiPrefix(const char *s, int len) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) &s[i]));
+        if (mask) return i + __builtin_ctz((unsigned int) mask);
+    }
+#endif
+    for (; i < len; i++)
+        if ((unsigned char) s[i] >= 0x80) return i;
+    return len;
+}
+
+/**
+ * Gets the number of columns the specified bytes take up in the terminal.
+ *
+ * @param s string to measure
+ * @param len number of bytes in s
+ * @return number of columns
+ */
+int utf8StringWidth(const char *s, int len) {
+    int width = 0;
+    int i = 0;
+    while (i < len) {
+        int ascii = utf8AsciiPrefix(&s[i], len - i);
+        width += ascii;
+        i += ascii;
+        if (i == len) break;
+
+        int cp;
+        i += utf8Decode(&s[i], len - i, &cp);
+        width += utf8Width(cp);
+    }
+    return width;
+}
+
+/**
+ * Finds the first char of a string which starts at or after the specified column.
+ *
+ * @param s string to search
+ * @param len number of bytes in s
+ * @param col column to find
+ * @param pad set to the number of columns between col and the start of the char found,
+ *            which is only non-zero when col is in the middle of a wide char
+ * @return byte offset of the char, or len if the string isn't that wide
+ */
+int utf8ColumnOffset(const char *s, int len, int col, int *pad) {
+    int width = 0;
+    int i = 0;
+    *pad = 0;
+    while (i < len && width < col) {
+        int ascii = utf8AsciiPrefix(&s[i], len - i);
+        if (ascii > col - width) ascii = col - width;
+        width += ascii;
+        i += ascii;
+        if (i == len || width == col) break;
+
+        int cp;
+        i += utf8Decode(&s[i], len - i, &cp);
+        width += utf8Width(cp);
+    }
+    if (width > col) *pad = width - col;
+    return i;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#define UTF8_MAX_LEN 4
+
+int utf8Decode(const char *s, int len, int *codepoint);
+
+int utf8Encode(int codepoint, char buf[UTF8_MAX_LEN]);
+
+int utf8Width(int codepoint);
+
+int utf8AsciiPrefix(const char *s, int len);
+
+int utf8StringWidth(const char *s, int len);
+
+int utf8ColumnOffset(const char *s, int len, int col, int *pad);
@@ -0,0 +1,97 @@
+#define _DEFAULT_SOURCE
+
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "watch.h"
+
+/**
+ * Watches the file which the path currently refers to, replacing the previous watch.
+ */
+static void watchAddFile(struct FileWatch *watch) {
+    if (watch->inotifyFd == -1) return;
+    if (watch->fileWatch != -1) inotify_rm_watch(watch->inotifyFd, watch->fileWatch);
+    watch->fileWatch = inotify_add_watch(watch->inotifyFd, watch->path,
+                                         IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+}
+
+/**
+ * Starts watching the file at the specified path for changes.
+ *
+ * @param watch to start
+ * @param path of the file
+ * @return 0 if successful, -1 if inotify can't be used (the file is still checked with stat)
+ */
+int watchStart(struct FileWatch *watch, const char *path) {
+    watch->path = strdup(path);
+    watch->fileWatch = -1;
+    watch->dirWatch = -1;
+    watch->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watchUpdate(watch);
+    if (watch->inotifyFd == -1) return -1;
+
+    char *dir = strdup(path);
+    watch->dirWatch = inotify_add_watch(watch->inotifyFd, dirname(dir), IN_CREATE | IN_MOVED_TO);
+    free(dir);
+    return 0;
+}
+
+/**
+ * Checks whether the file was changed since it was last read or written, without blocking.
+ *
+ * @param watch file to check
+ * @return true if the file is different
+ */
+bool watchChanged(struct FileWatch *watch) {
+    if (watch->path == NULL) return false;
+
+    if (watch->inotifyFd != -1) {
+        char events[4096];
+        bool pending = false;
+        while (read(watch->inotifyFd, events, sizeof(events)) > 0) pending = true;
+        if (!pending) return false;
+    }
+
+    struct stat st;
+    if (stat(watch->path, &st) == -1) return false;
+    if (!watch->exists) return true;
+    return st.st_dev != watch->dev || st.st_ino != watch->inode || st.st_size != watch->size ||
+           st.st_mtim.tv_sec != watch->mtime.tv_sec || st.st_mtim.tv_nsec != watch->mtime.tv_nsec;
+}
+
+/**
+ * Records the file as it is now, after it was read or written.
+ *
+ * @param watch file which was read or written
+ */
+void watchUpdate(struct FileWatch *watch) {
+    //Events caused by our own write are already accounted for
+    if (watch->inotifyFd != -1) {
+        char events[4096];
+        while (read(watch->inotifyFd, events, sizeof(events)) > 0);
+    }
+
+    struct stat st;
+    watch->exists = stat(watch->path, &st) == 0;
+    if (!watch->exists) return;
+
+    if (st.st_dev != watch->dev || st.st_ino != watch->inode || watch->fileWatch == -1) {
+        watch->dev = st.st_dev;
+        watch->inode = st.st_ino;
+        watchAddFile(watch);
+    }
+    watch->size = st.st_size;
+    watch->mtime = st.st_mtim;
+}
+
+void watchStop(struct FileWatch *watch) {
+    if (watch->path == NULL) return;
+    if (watch->inotifyFd != -1) close(watch->inotifyFd);
+    watch->inotifyFd = -1;
+    free(watch->path);
+    watch->path = NULL;
+}
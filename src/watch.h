@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Notices when a file is changed by another process. inotify says when something
+ * may have happened, then the file's inode, size and modification time are compared
+ * with what they were when it was last read or written. Without inotify the file is
+ * checked with stat every time it is polled.
+ */
+struct FileWatch {
+    char *path;
+    int inotifyFd;
+    //Watch on the file, for writes, and on its directory, for the file being replaced
+    int fileWatch;
+    int dirWatch;
+    //Whether the file existed when it was last read or written
+    bool exists;
+    dev_t dev;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+};
+
+int watchStart(struct FileWatch *watch, const char *path);
+
+bool watchChanged(struct FileWatch *watch);
+
+void watchUpdate(struct FileWatch *watch);
+
+void watchStop(struct FileWatch *watch);
@@ -0,0 +1,140 @@
+#include <stdint.h>
+
+#include "wrap.h"
+
+/*
+ * Rows being added to the layout, passed to wrapInitNode.
+ */
+struct WrapWidths {
+    const int64_t *widths;
+    int cols;
+};
+
+/**
+ * Gets the number of screen lines a row of the specified width wraps onto.
+ *
+ * A row which exactly fills its last line gets an extra line for the cursor to sit on.
+ */
+int wrapLineCount(int64_t width, int cols) {
+    return (int) (width / cols + 1);
+}
+
+static void wrapPull(void *node, const void *left, const void *right) {
+    struct WrapLines *n = node;
+    n->rows = ((const struct WrapLines *) left)->rows + n->row + ((const struct WrapLines *) right)->rows;
+}
+
+static void wrapInitNode(void *node, int i, const void *rows) {
+    const struct WrapWidths *widths = rows;
+    struct WrapLines *n = node;
+    n->row = wrapLineCount(widths->widths[i], widths->cols);
+}
+
+void wrapInit(struct WrapLayout *wrap) {
+    wrap->cols = 0;
+    treapInit(&wrap->tree, sizeof(struct WrapLines), wrapPull);
+}
+
+/**
+ * Marks the layout as out of date, so it gets rebuilt before it's next used.
+ */
+void wrapInvalidate(struct WrapLayout *wrap) {
+    wrap->cols = 0;
+}
+
+/**
+ * Builds the layout from the display width of every row in O(n).
+ *
+ * @param wrap layout to build
+ * @param widths display width of each row
+ * @param numRows number of rows
+ * @param cols number of columns on the screen
+ */
+void wrapBuild(struct WrapLayout *wrap, const int64_t *widths, int numRows, int cols) {
+    wrap->cols = cols;
+    struct WrapWidths rows = {widths, cols};
+    treapBuild(&wrap->tree, numRows, wrapInitNode, &rows);
+}
+
+/**
+ * Updates the layout after a range of rows was replaced, in O(log n) plus the number of rows replaced.
+ *
+ * @param wrap layout to update
+ * @param at index of the first row replaced
+ * @param delCount number of rows removed
+ * @param widths display width of each row inserted in their place
+ * @param insCount number of rows inserted
+ */
+void wrapSplice(struct WrapLayout *wrap, int at, int delCount, const int64_t *widths, int insCount) {
+    if (wrap->cols == 0) return;
+    struct WrapWidths rows = {widths, wrap->cols};
+    treapSplice(&wrap->tree, at, delCount, insCount, wrapInitNode, &rows);
+}
+
+/**
+ * Updates the layout after the width of a row changed, in O(log n).
+ */
+void wrapUpdate(struct WrapLayout *wrap, int at, int64_t oldWidth, int64_t newWidth) {
+    if (wrap->cols == 0 || at >= wrap->tree.numRows) return;
+    int lines = wrapLineCount(newWidth, wrap->cols);
+    if (lines == wrapLineCount(oldWidth, wrap->cols)) return;
+    ((struct WrapLines *) treapRow(&wrap->tree, at))->row = lines;
+    treapPullRow(&wrap->tree, at);
+}
+
+/**
+ * Gets the screen line the specified row starts on.
+ */
+int wrapLinesBefore(struct WrapLayout *wrap, int at) {
+    int lines = 0;
+    int node = wrap->tree.root;
+    while (node != 0) {
+        struct TreapNode *n = treapNode(&wrap->tree, node);
+        int leftSize = treapNode(&wrap->tree, n->left)->size;
+        if (at <= leftSize) {
+            node = n->left;
+        } else {
+            const struct WrapLines *left = treapPayload(&wrap->tree, n->left);
+            lines += left->rows + ((const struct WrapLines *) treapPayload(&wrap->tree, node))->row;
+            at -= leftSize + 1;
+            node = n->right;
+        }
+    }
+    return lines;
+}
+
+/**
+ * Finds the row which the specified screen line is part of.
+ *
+ * @param wrap layout to search
+ * @param line screen line to find
+ * @param lineInRow set to the screen line within the row
+ * @return index of the row, or the number of rows if line is past the end
+ */
+int wrapFindRow(struct WrapLayout *wrap, int line, int *lineInRow) {
+    int row = 0;
+    int node = wrap->tree.root;
+    while (node != 0) {
+        struct TreapNode *n = treapNode(&wrap->tree, node);
+        int leftLines = ((const struct WrapLines *) treapPayload(&wrap->tree, n->left))->rows;
+        int ownLines = ((const struct WrapLines *) treapPayload(&wrap->tree, node))->row;
+        int leftSize = treapNode(&wrap->tree, n->left)->size;
+        if (line < leftLines) {
+            node = n->left;
+        } else if (line < leftLines + ownLines) {
+            *lineInRow = line - leftLines;
+            return row + leftSize;
+        } else {
+            line -= leftLines + ownLines;
+            row += leftSize + 1;
+            node = n->right;
+        }
+    }
+    *lineInRow = line;
+    return row;
+}
+
+void wrapFree(struct WrapLayout *wrap) {
+    treapFree(&wrap->tree);
+    wrap->cols = 0;
+}
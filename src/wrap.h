@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "treap.h"
+
+/*
+ * Screen lines taken up by a row in the wrap layout's tree, and by every row in its subtree.
+ */
+struct WrapLines {
+    int row;
+    int rows;
+};
+
+/*
+ * Layout of rows wrapped onto screen lines. Each row takes up width / cols + 1
+ * screen lines. The rows are kept in order in a treap with the number of lines in each
+ * subtree, so a row's screen line and the row at a screen line can be found, and rows
+ * inserted or removed, in O(log n).
+ */
+struct WrapLayout {
+    //Screen columns the layout was built for, 0 if it has to be rebuilt
+    int cols;
+    //Payloads are struct WrapLines
+    struct Treap tree;
+};
+
+int wrapLineCount(int64_t width, int cols);
+
+void wrapInit(struct WrapLayout *wrap);
+
+void wrapInvalidate(struct WrapLayout *wrap);
+
+void wrapBuild(struct WrapLayout *wrap, const int64_t *widths, int numRows, int cols);
+
+void wrapSplice(struct WrapLayout *wrap, int at, int delCount, const int64_t *widths, int insCount);
+
+void wrapUpdate(struct WrapLayout *wrap, int at, int64_t oldWidth, int64_t newWidth);
+
+int wrapLinesBefore(struct WrapLayout *wrap, int at);
+
+int wrapFindRow(struct WrapLayout *wrap, int line, int *lineInRow);
+
+void wrapFree(struct WrapLayout *wrap);
@@ -0,0 +1,27 @@
+#!/bin/sh
+#Jumps between matching brackets on different lines of a C file without a terminal, typing a char at each,
+#with lines added in between whose brackets are in a string and a comment, saves it and checks what was written.
+#Usage: brackets.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/brackets.c
+
+printf 'int f() {\n    if (x) {\n        y();\n    }\n}\n' > "$file"
+
+#Jump from the brace on line 1 to the one closing it and type Z there
+printf '\033[F\033[D\035Z' > "$dir/script"
+#Add a line after line 3 with brackets which don't count
+printf '\0073\r\033[F\rs = "}"; /* } */' >> "$dir/script"
+#Jump from the braces on lines 1 and 2 again, type Y and W at their matches, and save
+printf '\0071\r\033[F\033[D\035Y\0072\r\033[F\033[D\035W\023' >> "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+printf 'int f() {\n    if (x) {\n        y();\ns = "}"; /* } */\n    W}\nZY}\n' > "$dir/expected.txt"
+if ! cmp -s "$dir/expected.txt" "$file"; then
+    echo "Saved:"
+    cat "$file"
+    exit 1
+fi
+echo "Jumped to 3 matching brackets"
@@ -0,0 +1,26 @@
+#!/bin/sh
+#Edits files in several buffers without a terminal, moving between them, saves each and checks what was written.
+#Usage: buffers.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+printf 'one\n' > "$dir/a.txt"
+printf 'two\n' > "$dir/b.txt"
+printf 'three\n' > "$dir/c.txt"
+
+#Type A in the first buffer, B in the second and save it, go back to the first and save it,
+#then open the third with Ctrl-O, type C in it, and save that too
+printf 'A\016B\023\020\023\017%s\rC\023' "$dir/c.txt" > "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$dir/a.txt" "$dir/b.txt" > /dev/null || exit 1
+
+for expected in a:Aone b:Btwo c:Cthree; do
+    name=${expected%%:*}
+    text=${expected#*:}
+    if [ "$(cat "$dir/$name.txt")" != "$text" ]; then
+        echo "$name.txt holds \"$(cat "$dir/$name.txt")\", expected \"$text\""
+        exit 1
+    fi
+done
+echo "Saved 3 buffers"
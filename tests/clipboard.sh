@@ -0,0 +1,26 @@
+#!/bin/sh
+#Copies, cuts and pastes lines without a terminal, editing the rows copied in between, saves the file and
+#checks what was written. The clipboard shares the chars of whole lines with their rows, so the edits mustn't
+#change what's pasted.
+#Usage: clipboard.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/clipboard.txt
+
+printf 'one\ntwo\nthree\n' > "$file"
+
+#Copy the first two lines, type X and Y at the start of them, and paste them at the end of the file
+printf '\002\033[B\033[B\003\033[A\033[AX\033[B\033[DY\007999\r\026' > "$dir/script"
+#Cut the first line, paste it at the end of the file as well, then save
+printf '\0071\r\002\033[B\030\007999\r\026\023' >> "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+printf 'Ytwo\nthree\none\ntwo\nXone\n' > "$dir/expected.txt"
+if ! cmp -s "$dir/expected.txt" "$file"; then
+    echo "Saved:"
+    cat "$file"
+    exit 1
+fi
+echo "Pasted and saved 5 lines"
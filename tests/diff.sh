@@ -0,0 +1,33 @@
+#!/bin/sh
+#Changes, deletes and adds lines of a file without a terminal, saves the diff of the changes against the file
+#on disk and checks what was written, then checks the file itself wasn't saved.
+#Usage: diff.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/diff.txt
+
+printf 'a\nb\nc\nd\ne\nf\ng\nh\ni\nj\n' > "$file"
+cp "$file" "$dir/expected.txt" || exit 1
+
+#Type X at the end of line 2, cut line 4 and add k at the end of the file
+printf '\0072\r\033[FX\0074\r\002\033[B\030\007999\rk' > "$dir/script"
+#Show the diff in a buffer of its own and save it
+printf '\004\023%s\r' "$dir/changes.diff" >> "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+{
+    printf -- '--- %s\n+++ %s\n' "$file" "$file"
+    printf '@@ -1,10 +1,10 @@\n a\n-b\n+bX\n c\n-d\n e\n f\n g\n h\n i\n j\n+k\n'
+} > "$dir/expected.diff"
+if ! cmp -s "$dir/expected.diff" "$dir/changes.diff"; then
+    echo "Saved diff:"
+    cat "$dir/changes.diff"
+    exit 1
+fi
+if ! cmp -s "$dir/expected.txt" "$file"; then
+    echo "The file being diffed was changed on disk"
+    exit 1
+fi
+echo "Saved a diff of 3 changes"
@@ -0,0 +1,23 @@
+#!/bin/sh
+#Filters lines of a file through shell commands without a terminal, saves it and checks what was written.
+#Usage: filter.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/filter.txt
+
+printf 'c\nb\na\nd\n' > "$file"
+
+#Sort the whole file, upper-case lines 2 to 3, replace line 1 with output that has no newline at the end,
+#and run a command which fails, which leaves the lines as they were, then save
+printf '\025sort\r\0252,3 tr a-z A-Z\r\0251,1 printf q\r\0251,4 exit 3\r\023' > "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+printf 'q\nB\nC\nd\n' > "$dir/expected.txt"
+if ! cmp -s "$dir/expected.txt" "$file"; then
+    echo "Saved:"
+    cat "$file"
+    exit 1
+fi
+echo "Filtered and saved 4 lines"
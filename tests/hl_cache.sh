@@ -0,0 +1,33 @@
+#!/bin/sh
+#Opens a C file made of two lines repeated over and over without a terminal, edits one of them and changes it
+#back, and checks from the stats printed at exit that every repeat was highlighted from the cache.
+#Usage: hl_cache.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/repeated.c
+
+i=0
+while [ $i -lt 500 ]; do
+    printf 'int x = 1; /* c */\n"str" + y;\n'
+    i=$((i + 1))
+done > "$file"
+
+#Type X at the start of the first line, which makes a line the cache hasn't seen, then delete it again
+printf 'X\177' > "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 --stats "$file" 2> "$dir/stats" > /dev/null || exit 1
+
+line=$(grep '^hl cache:' "$dir/stats")
+hits=$(echo "$line" | awk '{print $3}')
+misses=$(echo "$line" | awk '{print $5}')
+if [ -z "$hits" ] || [ -z "$misses" ]; then
+    echo "No hl cache stats printed"
+    exit 1
+fi
+#Each of the two lines is highlighted once, and so is the edited line, the other 999 highlights are hits
+if [ "$misses" -gt 3 ] || [ "$hits" -lt 999 ]; then
+    echo "Expected at least 999 hits and at most 3 misses: $line"
+    exit 1
+fi
+echo "$line"
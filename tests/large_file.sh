@@ -0,0 +1,50 @@
+#!/bin/sh
+#Edits both ends of a sparse file over 4 GB without a terminal, saves it and checks what was written.
+#Usage: large_file.sh POUND
+pound=$1
+
+#Past 4 GB, in rows of 64 MB so only one row's worth is ever held twice while it's opened
+size=$((4 * 1024 * 1024 * 1024 + 4096))
+chunk=$((64 * 1024 * 1024))
+
+#The whole file is held in memory, which not every machine running the tests has
+available=$(awk '/^MemAvailable:/ {print $2}' /proc/meminfo)
+if [ -z "$available" ] || [ "$available" -lt $((size / 1024 + 512 * 1024)) ]; then
+    echo "Skipped: not enough memory to open a $size byte file"
+    exit 77
+fi
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/large.txt
+
+printf 'head\n' > "$file"
+truncate -s $size "$file" || exit 1
+offset=$chunk
+while [ $offset -lt $size ]; do
+    printf '\n' | dd of="$file" bs=1 seek=$offset conv=notrunc status=none || exit 1
+    offset=$((offset + chunk))
+done
+printf '\ntail\n' >> "$file"
+cp --sparse=always "$file" "$dir/expected.txt" || exit 1
+
+#Type X at the start of the file, go past the last line, type Y at the start of it, then save
+printf 'X\007999999\r\033[AY\023' > "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+expectedSize=$((size + 6 + 2))
+actualSize=$(stat -c %s "$file")
+if [ "$actualSize" -ne $expectedSize ]; then
+    echo "Saved $actualSize bytes, expected $expectedSize"
+    exit 1
+fi
+if [ "$(head -c 6 "$file")" != "$(printf 'Xhead')" ] || [ "$(tail -c 6 "$file")" != "$(printf 'Ytail')" ]; then
+    echo "The edits at either end of the file weren't saved"
+    exit 1
+fi
+#Everything between the edits is unchanged, just one byte further on
+if ! cmp -n $((size + 1 - 5)) -i 5:6 "$dir/expected.txt" "$file"; then
+    echo "The rows between the edits weren't saved as they were"
+    exit 1
+fi
+echo "Saved $actualSize bytes"
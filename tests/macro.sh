@@ -0,0 +1,25 @@
+#!/bin/sh
+#Records a macro without a terminal, plays it back a number of times and then to the end of the file,
+#saves the file and checks what was written.
+#Usage: macro.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/macro.txt
+
+printf 'a\nb\nc\nd\ne\n' > "$file"
+
+#Record typing "> " at the start of a line and moving to the start of the next one
+printf '\013> \033[B\033[H\013' > "$dir/script"
+#Play it twice, then until the end of the file, and save
+printf '\0312\r\031\r\023' >> "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+printf '> a\n> b\n> c\n> d\n> e\n' > "$dir/expected.txt"
+if ! cmp -s "$dir/expected.txt" "$file"; then
+    echo "Saved:"
+    cat "$file"
+    exit 1
+fi
+echo "Played the macro over 4 lines and saved 5"
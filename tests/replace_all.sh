@@ -0,0 +1,24 @@
+#!/bin/sh
+#Replaces every occurrence of some strings without a terminal, saves the file and checks what was written.
+#Usage: replace_all.sh POUND
+pound=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+file=$dir/replace.txt
+
+printf 'foo bar foo\nfoofoo\nbaz\nh\303\251\n' > "$file"
+
+#Replace foo with x, then a with aa, which holds what it replaces, then z with nothing
+printf '\022foo\rx\r\022a\raa\r\022z\r\r' > "$dir/script"
+#Replace the UTF-8 e acute with an o umlaut typed after a char deleted from the prompt, and save
+printf '\022\303\251\r\303\274\177\303\266\r\023' >> "$dir/script"
+"$pound" --headless="$dir/script" --size=24x80 "$file" > /dev/null || exit 1
+
+printf 'x baar x\nxx\nbaa\nh\303\266\n' > "$dir/expected.txt"
+if ! cmp -s "$dir/expected.txt" "$file"; then
+    echo "Saved:"
+    cat "$file"
+    exit 1
+fi
+echo "Replaced and saved 4 lines"
@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "terminal.h"
+
+/*
+ * Stands in for the clients of a pound server, speaking the protocol directly rather than through
+ * a terminal, and checks the frames the server sends back.
+ *
+ * Usage: server_client POUND
+ */
+
+//Longest to wait for something a client should be sent
+#define WAIT_MS 3000
+
+/*
+ * A client attached to the server, and everything it's been sent since it was last checked.
+ */
+struct TestClient {
+    int fd;
+    char *output;
+    size_t outputLen;
+    bool exited;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok) failures++;
+}
+
+static long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Sends a hello or a resize message with the size of the client's screen.
+ *
+ * @param path of the file to show, only sent in a hello
+ */
+static void sendSize(struct TestClient *client, char type, int rows, int cols, const char *path) {
+    char msg[4 + 1 + 256];
+    uint16_t size[2] = {(uint16_t) rows, (uint16_t) cols};
+    memcpy(msg, size, sizeof(size));
+    size_t len = 4;
+    if (type == MSG_HELLO) {
+        msg[len++] = 0;
+        size_t pathLen = strlen(path);
+        memcpy(&msg[len], path, pathLen);
+        len += pathLen;
+    }
+    if (serverWriteMessage(client->fd, type, msg, len) == -1) perror("serverWriteMessage");
+}
+
+static void sendKeys(struct TestClient *client, const char *keys) {
+    if (serverWriteMessage(client->fd, MSG_KEYS, keys, strlen(keys)) == -1) perror("serverWriteMessage");
+}
+
+/**
+ * Reads the messages the client has been sent, adding any output to what it's been sent so far.
+ *
+ * @param timeout number of milliseconds to wait for the first message
+ * @return false if nothing arrived in time, or the server has gone
+ */
+static bool receive(struct TestClient *client, int timeout) {
+    struct pollfd pfd = {.fd = client->fd, .events = POLLIN};
+    bool received = false;
+    while (!client->exited && poll(&pfd, 1, received ? 0 : timeout) > 0) {
+        char type;
+        char *data;
+        size_t len;
+        if (serverReadMessage(client->fd, &type, &data, &len) == -1) return received;
+        if (type == MSG_OUTPUT) {
+            client->output = realloc(client->output, client->outputLen + len + 1);
+            if (client->output == NULL) exit(1);
+            memcpy(&client->output[client->outputLen], data, len);
+            client->outputLen += len;
+            client->output[client->outputLen] = '\0';
+        } else if (type == MSG_EXIT) {
+            client->exited = true;
+        }
+        free(data);
+        received = true;
+    }
+    return received;
+}
+
+static bool sent(struct TestClient *client, const char *text) {
+    return client->output && memmem(client->output, client->outputLen, text, strlen(text)) != NULL;
+}
+
+/**
+ * Waits until the client has been sent some text since it was last checked.
+ *
+ * @return true if it was sent in time
+ */
+static bool waitFor(struct TestClient *client, const char *text) {
+    long long deadline = now() + WAIT_MS;
+    while (!sent(client, text)) {
+        long long left = deadline - now();
+        if (left <= 0 || !receive(client, (int) left)) return false;
+    }
+    return true;
+}
+
+/**
+ * Reads everything which is still on its way to the client, until it's been sent nothing for a while.
+ */
+static void settle(struct TestClient *client) {
+    while (receive(client, 200));
+}
+
+/**
+ * Forgets what the client has been sent, after reading anything which is still on its way.
+ */
+static void clear(struct TestClient *client) {
+    settle(client);
+    client->outputLen = 0;
+    if (client->output) client->output[0] = '\0';
+}
+
+static bool connectClient(struct TestClient *client, const char *socketPath) {
+    memset(client, 0, sizeof(*client));
+    //The server may still be starting up
+    for (int i = 0; i < 100; i++) {
+        client->fd = serverConnect(socketPath);
+        if (client->fd != -1) return true;
+        usleep(50 * 1000);
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s POUND\n", argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/pound-test-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char socketPath[64], filePath[64];
+    snprintf(socketPath, sizeof(socketPath), "%s/sock", dir);
+    snprintf(filePath, sizeof(filePath), "%s/file.txt", dir);
+    FILE *fp = fopen(filePath, "w");
+    if (fp == NULL) {
+        perror(filePath);
+        return 1;
+    }
+    fputs("first line\nsecond line\nthird line\n", fp);
+    fclose(fp);
+
+    char serverArg[80];
+    snprintf(serverArg, sizeof(serverArg), "--server=%s", socketPath);
+    pid_t server = fork();
+    if (server == 0) {
+        execl(argv[1], argv[1], serverArg, (char *) NULL);
+        perror(argv[1]);
+        _exit(127);
+    }
+
+    struct TestClient a, b;
+    if (!connectClient(&a, socketPath)) {
+        check(false, "connect to the server");
+        kill(server, SIGTERM);
+        return 1;
+    }
+
+    //Hello: the first frame is the whole screen with the file in it
+    sendSize(&a, MSG_HELLO, 10, 40, filePath);
+    check(waitFor(&a, "third line"), "hello is answered with the file");
+    check(sent(&a, CLEAR_DISPLAY_CMD), "the first frame is drawn whole");
+    clear(&a);
+
+    //Keys, and the frame diff: only the lines which changed are sent
+    sendKeys(&a, "X");
+    check(waitFor(&a, "Xfirst line"), "keys are typed into the file");
+    clear(&a);
+    sendKeys(&a, "\x1b[B\x1b[HY");
+    check(waitFor(&a, "Ysecond line"), "keys are typed on the next row");
+    check(!sent(&a, CLEAR_DISPLAY_CMD), "a frame after a key isn't drawn whole");
+    check(!sent(&a, "first line") && !sent(&a, "third line"), "unchanged lines aren't sent again");
+    clear(&a);
+
+    //Resize: the whole screen is sent again at the new size
+    sendSize(&a, MSG_RESIZE, 12, 50, NULL);
+    check(waitFor(&a, "third line"), "resizing redraws the screen");
+    check(sent(&a, CLEAR_DISPLAY_CMD), "the frame after a resize is drawn whole");
+    clear(&a);
+
+    //A prompt is answered only by the client which opened it, and only shown to that client
+    if (!connectClient(&b, socketPath)) {
+        check(false, "connect a second client");
+    } else {
+        sendSize(&b, MSG_HELLO, 10, 40, filePath);
+        check(waitFor(&b, "Ysecond line"), "a second client is shown the same buffer");
+        clear(&b);
+
+        sendKeys(&a, "\x06");
+        check(waitFor(&a, "Search:"), "the first client opens a prompt");
+        sendKeys(&b, "Q");
+        settle(&a);
+        settle(&b);
+        check(!sent(&a, "Search: Q"), "keys from the second client don't go into the prompt");
+        check(!sent(&b, "Search:"), "the prompt isn't shown to the second client");
+
+        sendKeys(&a, "\x1b");
+        check(waitFor(&b, "YQsecond line"), "the second client's keys are handled once the prompt is closed");
+        clear(&a);
+
+        //A client which goes with a prompt open doesn't leave the others waiting on it
+        sendKeys(&b, "\x06");
+        check(waitFor(&b, "Search:"), "the second client opens a prompt");
+        close(b.fd);
+        clear(&a);
+        sendKeys(&a, "Z");
+        check(waitFor(&a, "YQZsecond line"), "keys are handled again after the client with the prompt has gone");
+    }
+
+    //Detach: the client is told to exit, leaving the server running
+    sendKeys(&a, "\x11");
+    while (!a.exited && receive(&a, WAIT_MS));
+    check(a.exited, "Ctrl-Q detaches the client");
+    close(a.fd);
+    check(waitpid(server, NULL, WNOHANG) == 0, "the server keeps running after its clients detach");
+
+    kill(server, SIGTERM);
+    int status;
+    waitpid(server, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the server exits on SIGTERM");
+    check(access(socketPath, F_OK) == -1, "the server removes its socket");
+
+    unlink(filePath);
+    rmdir(dir);
+    free(a.output);
+    free(b.output);
+    return failures > 0;
+}